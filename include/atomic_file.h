@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Writes a whole file through `write` into a temporary file next to `path`,
+// then renames it over `path`, so that readers, also in other processes,
+// never see partial data. Creates missing parent directories. Fails, leaving
+// no temporary file behind, if `write` returns false or the stream fails.
+bool write_file_atomically(const std::string &path, const std::function<bool(std::ostream &)> &write);
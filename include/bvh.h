@@ -0,0 +1,58 @@
+#pragma once
+
+#include "frustum.h"
+
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    // Bounds of the box after an affine transform
+    Aabb transformed(const glm::mat4 &matrix) const;
+};
+
+// Bounding volume hierarchy over object boxes, for culling whole objects.
+// Objects are identified by their index in the boxes passed to build().
+class Bvh {
+public:
+    // Builds top-down, splitting at the median of the longest centroid axis
+    void build(std::span<const Aabb> boxes);
+
+    // Replaces the box of one object and refits the nodes above it. Much
+    // cheaper than a rebuild, but the tree degrades if objects move far.
+    void update(size_t object, const Aabb &box);
+
+    // Appends the objects whose boxes intersect the frustum to `visible`.
+    // Returns the number of nodes tested.
+    size_t cull(const Frustum &frustum, std::vector<unsigned int> &visible) const;
+
+    size_t num_objects() const { return boxes_.size(); }
+
+private:
+    static constexpr unsigned int kNone = ~0u;
+    static constexpr unsigned int kMaxLeafObjects = 4;
+
+    struct Node {
+        Aabb box;
+        unsigned int parent;
+        // Inner nodes: index of the first child; the second child follows
+        // it. Leaves: range of objects_.
+        unsigned int first;
+        unsigned int count;
+
+        bool is_leaf() const { return count > 0; }
+    };
+
+    void build_node(unsigned int index, unsigned int begin, unsigned int end);
+    void refit(unsigned int node);
+    void append_objects(const Node &node, std::vector<unsigned int> &visible) const;
+
+    std::vector<Aabb> boxes_;
+    std::vector<Node> nodes_;
+    // Object indices ordered so that every leaf holds a contiguous range
+    std::vector<unsigned int> objects_;
+    std::vector<unsigned int> object_leaves_;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "shader_uniforms.h"
+#include "uniform_buffer.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// A point light for ClusteredLighting. Its light fades out towards
+// `radius` and ends there.
+struct PointLight {
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    // Slot of the light's cube map in the PointShadowMap, or -1 for a light
+    // without shadows
+    int shadow_slot = -1;
+};
+
+struct ClusterStats {
+    size_t lights = 0;
+    // Lights that touch at least one cluster
+    size_t visible_lights = 0;
+    // Light indices over all clusters
+    size_t light_indices = 0;
+    size_t max_cluster_lights = 0;
+};
+
+// Clustered forward shading: the view frustum is split into a grid of
+// clusters, kGridX x kGridY tiles of the viewport by kGridZ depth slices
+// of exponentially increasing thickness. Every frame, each light is added
+// to the clusters its bounding sphere may touch, so that fragments only
+// loop over the lights of their cluster. The shaders read the lists from
+// buffer textures (see shader/phong.fs with CLUSTERED).
+class ClusteredLighting {
+public:
+    static constexpr unsigned int kGridX = 16;
+    static constexpr unsigned int kGridY = 9;
+    static constexpr unsigned int kGridZ = 24;
+    static constexpr unsigned int kNumClusters = kGridX * kGridY * kGridZ;
+
+    ClusteredLighting();
+
+    // Assigns the lights to the clusters of a view and uploads the lists
+    // and the Clusters block. `near` and `far` are the planes of the
+    // perspective `projection`.
+    void update(std::span<const PointLight> lights, const glm::mat4 &view, const glm::mat4 &projection,
+                float near, float far, int width, int height);
+
+    // Binds the buffer textures to their TextureUnit
+    void bind() const;
+
+    const ClusterStats &stats() const { return stats_; }
+
+private:
+    // Inclusive cluster ranges along each axis touched by a light
+    struct ClusterBounds {
+        glm::uvec3 min;
+        glm::uvec3 max;
+    };
+
+    // False if the light is entirely outside the view frustum
+    bool cluster_bounds(const PointLight &light, const glm::mat4 &view, const glm::mat4 &projection,
+                        float near, float far, ClusterBounds &bounds) const;
+    unsigned int slice(float depth, float near, float far) const;
+
+    std::unique_ptr<UniformBuffer> uniforms_;
+    std::unique_ptr<TextureBuffer> light_data_;
+    std::unique_ptr<TextureBuffer> cluster_lights_;
+    std::unique_ptr<TextureBuffer> light_indices_;
+
+    // Scratch, kept between frames to avoid allocations
+    std::vector<glm::vec4> light_texels_;
+    std::vector<ClusterBounds> bounds_;
+    std::vector<int> visible_;
+    std::vector<glm::uvec2> clusters_;
+    std::vector<uint32_t> indices_;
+
+    ClusterStats stats_;
+};
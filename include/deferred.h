@@ -0,0 +1,89 @@
+#pragma once
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <memory>
+
+// Render targets of DeferredRenderer, 16 bytes per pixel:
+// - GL_DEPTH24_STENCIL8 depth, the depth buffer of the geometry pass.
+//   Positions are rebuilt from it, and it matches the usual default
+//   framebuffer, so that it can be copied there.
+// - GL_RG16 world space normal, octahedral encoded
+// - GL_SRGB8_ALPHA8 diffuse color, and shininess / 255
+// - GL_SRGB8_ALPHA8 ambient color, and the mean of the specular color
+class GBuffer {
+public:
+    static constexpr int kBytesPerPixel = 16;
+
+    GBuffer();
+    ~GBuffer();
+
+    GBuffer(const GBuffer &) = delete;
+    GBuffer &operator=(const GBuffer &) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Reallocates the targets if the size changed
+    void resize(int width, int height);
+
+    void bind() const;
+    // Binds the targets to their TextureUnit
+    void bind_textures() const;
+    // Copies depth into `fbo`, so that forward passes drawn after lighting
+    // are hidden by the scene
+    void blit_depth(GLuint fbo) const;
+
+private:
+    enum Target {
+        kDepth,
+        kNormal,
+        kDiffuse,
+        kAmbient,
+        kNumTargets,
+    };
+
+    GLuint fbo_;
+    GLuint textures_[kNumTargets];
+    int width_;
+    int height_;
+};
+
+// Deferred shading: a geometry pass stores the nearest surface of every
+// pixel in a GBuffer, then a lighting pass shades each pixel once, so that
+// fragments hidden by later ones are never lit. The lighting pass takes the
+// same ShaderFeature bits as the forward programs.
+class DeferredRenderer {
+public:
+    DeferredRenderer();
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer &) = delete;
+    DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+
+    const GBuffer &gbuffer() const { return gbuffer_; }
+
+    // Submits the programs of a feature set without waiting for them
+    void prepare(uint32_t features);
+
+    // Binds the G-buffer, sized to the viewport, and clears its depth
+    void begin_geometry_pass(int width, int height);
+    // Fails if the geometry program did not build
+    bool bind_geometry_pipeline(bool instanced, const RasterState &raster);
+    // Shades the G-buffer into `fbo` and copies its depth there. Fails if
+    // the lighting program did not build.
+    bool light(uint32_t features, GLuint fbo);
+
+private:
+    GBuffer gbuffer_;
+    // Geometry programs only differ by INSTANCED, lighting ones by the rest
+    std::unique_ptr<ShaderVariants> geometry_variants_;
+    std::unique_ptr<ShaderVariants> lighting_variants_;
+    RasterState lighting_raster_;
+    // Empty; the lighting pass has no vertex attributes
+    GLuint vao_;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// View frustum as six inward-facing planes (ax + by + cz + d >= 0 inside),
+// extracted from a projection matrix. Extracting from projection * view *
+// model gives the frustum in model space.
+class Frustum {
+public:
+    enum Containment {
+        kOutside,
+        kIntersects,
+        kInside,
+    };
+
+    explicit Frustum(const glm::mat4 &matrix);
+
+    const glm::vec4 &plane(int i) const { return planes_[i]; }
+
+    // Conservative tests; may accept volumes just outside a corner
+    bool intersects_sphere(glm::vec3 center, float radius) const;
+    bool intersects_box(glm::vec3 min, glm::vec3 max) const;
+    Containment classify_box(glm::vec3 min, glm::vec3 max) const;
+
+private:
+    glm::vec4 planes_[6];
+};
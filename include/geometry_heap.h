@@ -0,0 +1,157 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <span>
+#include <vector>
+
+// First-fit free-list allocator over a range of units. Adjacent free blocks
+// are merged when freed.
+class RangeAllocator {
+public:
+    static constexpr size_t kInvalid = SIZE_MAX;
+
+    explicit RangeAllocator(size_t capacity = 0);
+
+    // Returns the offset of the new block, or kInvalid if no block fits
+    size_t allocate(size_t size);
+    void free(size_t offset, size_t size);
+
+    // Extends the range at its end
+    void grow(size_t capacity);
+    // Marks [0, used) as allocated and the rest as free, after compaction
+    void reset(size_t used);
+
+    size_t capacity() const { return capacity_; }
+    size_t used() const { return used_; }
+    size_t num_free_blocks() const { return free_blocks_.size(); }
+    size_t largest_free_block() const;
+
+    // 1 - largest free block / total free space; 0 when free space is one block
+    float fragmentation() const;
+
+private:
+    // Offset to size
+    std::map<size_t, size_t> free_blocks_;
+    size_t capacity_;
+    size_t used_;
+};
+
+struct GeometryHeapStats {
+    size_t num_allocations = 0;
+    size_t vertex_capacity = 0;
+    size_t vertex_used = 0;
+    size_t index_capacity = 0;
+    size_t index_used = 0;
+    float vertex_fragmentation = 0.0f;
+    float index_fragmentation = 0.0f;
+    size_t num_grows = 0;
+    size_t num_defragmentations = 0;
+};
+
+void print_geometry_heap_stats(std::ostream &out, const GeometryHeapStats &stats);
+
+// Shared vertex, position and index buffers for all meshes of one vertex
+// format, so that they draw through one pair of vertex arrays. Indices are
+// 16-bit and relative to each mesh's base vertex. Buffers grow in place,
+// keeping their names, and are compacted when frees leave them fragmented.
+class GeometryHeap {
+public:
+    using Handle = uint32_t;
+
+    struct Allocation {
+        size_t first_vertex;
+        size_t num_vertices;
+        size_t first_index;
+        size_t num_indices;
+    };
+
+    // Meshes with more vertices than this cannot use 16-bit indices
+    static constexpr size_t kMaxMeshVertices = 65536;
+    // Frees compact the buffers when either is more fragmented than this
+    static constexpr float kDefragmentThreshold = 0.5f;
+
+    explicit GeometryHeap(VertexFormat format, size_t initial_vertices = 1 << 16, size_t initial_indices = 1 << 18);
+    ~GeometryHeap();
+
+    GeometryHeap(const GeometryHeap &) = delete;
+    GeometryHeap &operator=(const GeometryHeap &) = delete;
+
+    VertexFormat format() const { return format_; }
+    static constexpr GLenum index_type() { return GL_UNSIGNED_SHORT; }
+
+    GLuint vao() const { return vao_; }
+    GLuint depth_vao() const { return depth_vao_; }
+
+    // Copies a mesh in. `vertices` and `positions` hold `num_vertices`
+    // vertices in the heap's format.
+    Handle allocate(std::span<const std::byte> vertices, std::span<const std::byte> positions,
+                    size_t num_vertices, std::span<const uint16_t> indices);
+    void free(Handle handle);
+
+    const Allocation &allocation(Handle handle) const { return allocations_[handle]; }
+
+    // Points a vertex array at the heap's buffers, as the heap's own arrays
+    // are; for meshes that need extra attributes such as instance data
+    void attach(GLuint vao, bool positions_only) const;
+
+    // Moves all allocations to the start of the buffers
+    void defragment();
+
+    GeometryHeapStats stats() const;
+
+private:
+    void reserve(size_t num_vertices, size_t num_indices);
+
+private:
+    VertexFormat format_;
+    size_t vertex_size_;
+    size_t position_size_;
+
+    GLuint vbo_, position_vbo_, ebo_;
+    GLuint vao_, depth_vao_;
+
+    RangeAllocator vertex_allocator_;
+    RangeAllocator index_allocator_;
+
+    std::vector<Allocation> allocations_;
+    std::vector<bool> live_;
+    std::vector<Handle> free_handles_;
+
+    size_t num_grows_;
+    size_t num_defragmentations_;
+};
+
+// Draws from one heap that share all other state (program, uniforms),
+// submitted with one glMultiDrawElementsBaseVertex call
+class DrawBatch {
+public:
+    explicit DrawBatch(const GeometryHeap &heap) : heap_(&heap) {}
+
+    const GeometryHeap &heap() const { return *heap_; }
+    bool empty() const { return counts_.empty(); }
+    size_t size() const { return counts_.size(); }
+
+    void clear();
+
+    // Adds indices [first_index, first_index + num_indices) of an allocation;
+    // ranges continuing the previous one are merged into it
+    void add(GeometryHeap::Handle handle, size_t first_index, size_t num_indices);
+
+    // Draws with the heap's shaded or position-only vertex array
+    void submit(bool depth = false) const;
+
+private:
+    const GeometryHeap *heap_;
+
+    std::vector<GLsizei> counts_;
+    std::vector<const void *> offsets_;
+    std::vector<GLint> base_vertices_;
+    size_t batch_end_ = 0;
+};
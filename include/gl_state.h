@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+class ShaderProgram;
+
+// Fixed-function state set per pipeline
+struct RasterState {
+    GLenum polygon_mode = GL_FILL;
+
+    bool depth_test = true;
+    bool depth_write = true;
+    GLenum depth_func = GL_LESS;
+
+    bool cull_face = false;
+    GLenum cull_mode = GL_BACK;
+
+    bool blend = false;
+    GLenum blend_src = GL_ONE;
+    GLenum blend_dst = GL_ZERO;
+
+    bool operator==(const RasterState &) const = default;
+};
+
+// A program and the raster state it is drawn with. Immutable; variants such
+// as wireframe are separate pipelines.
+class PipelineState {
+public:
+    explicit PipelineState(const ShaderProgram &program, const RasterState &raster = {})
+        : program_(&program), raster_(raster) {}
+
+    const ShaderProgram &program() const { return *program_; }
+    const RasterState &raster() const { return raster_; }
+
+private:
+    const ShaderProgram *program_;
+    RasterState raster_;
+};
+
+// Shadow copy of the bindings and raster state of the current context, so
+// that calls which would not change anything are skipped. Once in use,
+// every change to the tracked state must go through it; objects must be
+// forgotten before they are deleted, as GL may reuse their names. Calls
+// issued and skipped are counted in RenderStats.
+class GlState {
+public:
+    static void use_program(GLuint program);
+    static void bind_vertex_array(GLuint vao);
+    static void bind_framebuffer(GLuint fbo);
+    static void bind_texture(GLenum target, GLuint texture, GLuint unit = 0);
+    static void viewport(int x, int y, int width, int height);
+
+    // Copies the buffers in `mask` of a width x height region from `src` to
+    // `dst`, which is left bound as the framebuffer
+    static void blit_framebuffer(GLuint src, GLuint dst, int width, int height, GLbitfield mask);
+    static void set_raster(const RasterState &raster);
+
+    // Program and raster state of a pipeline
+    static void bind(const PipelineState &pipeline);
+
+    static void forget_program(GLuint program);
+    static void forget_vertex_array(GLuint vao);
+    static void forget_framebuffer(GLuint fbo);
+    static void forget_texture(GLuint texture);
+
+    // Makes all tracked state unknown, e.g. after code that bypasses GlState
+    static void invalidate();
+
+private:
+    static constexpr GLuint kUnknown = ~0u;
+    static constexpr size_t kMaxTextureUnits = 16;
+
+    struct TextureBinding {
+        GLenum target;
+        GLuint texture;
+    };
+
+    // Returns true, and counts the call as issued, if `value` differs from
+    // the tracked value, which is then updated
+    template <typename T>
+    static bool change(T &tracked, const T &value);
+
+    static inline GLuint program_ = kUnknown;
+    static inline GLuint vertex_array_ = kUnknown;
+    static inline GLuint framebuffer_ = kUnknown;
+    static inline GLuint active_texture_unit_ = kUnknown;
+    static inline std::array<TextureBinding, kMaxTextureUnits> textures_ = [] {
+        std::array<TextureBinding, kMaxTextureUnits> textures;
+        textures.fill({GL_NONE, kUnknown});
+        return textures;
+    }();
+    static inline std::array<int, 4> viewport_ = {-1, -1, -1, -1};
+    static inline std::optional<RasterState> raster_;
+};
+
+// Whether the current context exposes an extension, e.g.
+// "GL_KHR_parallel_shader_compile"
+bool has_gl_extension(std::string_view name);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// GPU time of named passes, measured with GL_TIMESTAMP queries at the start
+// and end of each scope, which may nest. A frame's queries are read back
+// kFramesInFlight frames later, when the GPU has normally finished them, so
+// that reading never stalls; a frame whose results are still pending by
+// then is dropped instead.
+class GpuProfiler {
+public:
+    static constexpr int kFramesInFlight = 4;
+    // Frames kept for the rolling statistics
+    static constexpr size_t kHistory = 240;
+
+    // Times a pass from construction to destruction; does nothing without a
+    // profiler
+    class Scope {
+    public:
+        Scope(GpuProfiler *profiler, const char *name);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        GpuProfiler *profiler_;
+    };
+
+    struct PassStats {
+        std::string name;
+        // Nesting level of the pass's scope
+        int depth;
+        size_t frames;
+        double min_ms;
+        double avg_ms;
+        double p99_ms;
+    };
+
+    GpuProfiler();
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler &) = delete;
+    GpuProfiler &operator=(const GpuProfiler &) = delete;
+
+    // Appends the time of every pass of every frame to a CSV file, as
+    // frame,pass,ms rows
+    bool open_csv(const std::string &path);
+
+    void begin_frame();
+    void end_frame();
+
+    void begin(const char *name);
+    void end();
+
+    // Over the last kHistory frames of each pass, in the order the passes
+    // were first seen
+    std::vector<PassStats> stats() const;
+    // Frames whose results were not ready in time
+    size_t dropped_frames() const { return dropped_frames_; }
+
+    // One line per pass, indented by depth
+    void print(std::ostream &out) const;
+    // Average times of the top-level passes, e.g. "shadow 1.20, scene 3.40 ms"
+    std::string summary() const;
+
+private:
+    struct Pass {
+        std::string name;
+        int depth;
+        // Ring of the last kHistory frame times
+        std::vector<double> history;
+        size_t next;
+    };
+
+    struct Marker {
+        int pass;
+        // Indices into Frame::queries
+        size_t begin;
+        size_t end;
+    };
+
+    struct Frame {
+        uint64_t number = 0;
+        // Grows to the most queries a frame used, and is reused
+        std::vector<GLuint> queries;
+        size_t used = 0;
+        std::vector<Marker> markers;
+        bool pending = false;
+    };
+
+    size_t timestamp(Frame &frame);
+    int find_pass(const char *name, int depth);
+    // Reads the results of a frame, or drops it if they are not ready
+    void collect(Frame &frame);
+
+    Frame frames_[kFramesInFlight];
+    Frame *current_;
+    // Markers of the scopes open in the current frame
+    std::vector<size_t> open_markers_;
+    std::vector<Pass> passes_;
+    // Scratch for collect()
+    std::vector<double> frame_ms_;
+    uint64_t frame_number_;
+    size_t dropped_frames_;
+    std::ofstream csv_;
+};
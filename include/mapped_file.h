@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Returns nullptr if the file cannot be opened or mapped
+    static std::unique_ptr<MappedFile> open(const char *filename);
+
+    const std::byte *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile() : data_(nullptr), size_(0) {}
+
+    const std::byte *data_;
+    size_t size_;
+};
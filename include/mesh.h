@@ -2,8 +2,90 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+class DrawBatch;
+class GeometryHeap;
+class MappedFile;
+
+// Layout of the vertex buffer uploaded by BasicMesh::setup
+enum class VertexFormat {
+    // 32-bit float positions and normals (24 bytes per vertex)
+    kFloat,
+    // 16-bit positions normalized to the mesh bounds and 10-bit normals
+    // packed as GL_INT_2_10_10_10_REV (12 bytes per vertex). Positions must
+    // be transformed by BasicMesh::position_transform.
+    kCompact,
+};
+
+// Options for BasicMesh::load
+struct MeshLoadOptions {
+    // Threads used by the OBJ reader; zero uses all hardware threads
+    unsigned int num_threads = 0;
+    // Reorder triangles and vertices for vertex cache and overdraw efficiency
+    bool optimize = false;
+    // Number of coarser levels of detail to generate by decimation
+    unsigned int lod_levels = 0;
+    // Split the full level of detail into meshlets for culling
+    bool meshlets = false;
+    // Vertex format used when uploading; does not affect the loaded data
+    VertexFormat vertex_format = VertexFormat::kFloat;
+};
+
+// Buffer sizes of an uploaded mesh and the error its vertex format introduces
+struct VertexFormatStats {
+    // Bytes with float vertices and 32-bit indices
+    size_t float_bytes = 0;
+    // Bytes actually uploaded
+    size_t bytes = 0;
+    // Largest position error in model units
+    float max_position_error = 0.0f;
+    // Largest normal error in degrees
+    float max_normal_error = 0.0f;
+};
+
+// A cluster of neighbouring triangles occupying a contiguous range of the
+// index buffer, with bounds for culling it as a whole.
+struct Meshlet {
+    size_t first_index;
+    size_t num_indices;
+
+    glm::vec3 center;
+    float radius;
+
+    // Normal cone; the meshlet faces away from any viewpoint for which
+    // dot(normalize(center - eye), cone_axis) >= cone_cutoff, with the
+    // radius added as margin. A cutoff of 1 disables the test.
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+};
+
+// Meshlet culling counters, accumulated over draws
+struct MeshletStats {
+    size_t tested = 0;
+    size_t frustum_culled = 0;
+    size_t backface_culled = 0;
+    size_t drawn = 0;
+    size_t draw_calls = 0;
+};
+
+void print_vertex_format_stats(std::ostream &out, std::string_view name, const VertexFormatStats &stats);
+
+// Bytes per vertex of the shaded and position-only streams of a format
+size_t vertex_size(VertexFormat format);
+size_t position_size(VertexFormat format);
+
+// Sets the attribute pointers of a format for the bound GL_ARRAY_BUFFER on
+// the bound vertex array
+void set_vertex_attributes(VertexFormat format, bool positions_only);
+
 class BasicMesh {
 public:
     struct Vertex {
@@ -11,7 +93,17 @@ public:
         glm::vec3 normal;
     };
 
-    BasicMesh() : vbo_(0), vao_(0), ebo_(0) {}
+    // A range of the index buffer holding one level of detail. All levels
+    // share the vertices; level 0 is the full mesh.
+    struct Lod {
+        size_t first_index;
+        size_t num_indices;
+    };
+
+    BasicMesh()
+        : position_transform_(1.0f), index_type_(GL_UNSIGNED_INT),
+          vbo_(0), position_vbo_(0), vao_(0), depth_vao_(0), ebo_(0), instance_vbo_(0), num_instances_(0),
+          heap_(nullptr), heap_handle_(0) {}
     ~BasicMesh();
 
     BasicMesh(const BasicMesh &) = delete;
@@ -23,16 +115,153 @@ public:
 
     void cleanup();
 
-    bool load(const char *filename);
-    void setup();
-    void draw() const;
+    // Loads OBJ files with the native reader and everything else (or OBJ
+    // files the native reader rejects) through OpenMesh. An up-to-date mesh
+    // cache file is mapped instead when the cache is enabled, and a new one
+    // is written after parsing. Loading does not touch GL, so it may run on
+    // any thread.
+    bool load(const char *filename, const MeshLoadOptions &options = {});
+    bool load_obj(const char *filename, unsigned int num_threads = 0);
+    bool load_openmesh(const char *filename);
+
+    // Reorders triangles for vertex cache locality, then clusters them to
+    // reduce overdraw, then reorders vertices to match the fetch order.
+    // Coarser levels of detail are only reordered for the vertex cache.
+    void optimize();
+
+    // Appends up to `max_levels` decimated levels of detail to the indices
+    void build_lods(unsigned int max_levels);
+
+    // Regroups the triangles of level 0 into meshlets (see build_meshlets)
+    void build_meshlets();
+
+    std::span<const Meshlet> meshlets() const { return meshlets_; }
+
+    size_t num_lods() const { return lods_.empty() ? 1 : lods_.size(); }
+    Lod lod(size_t level) const { return lods_.empty() ? Lod{0, indices().size()} : lods_[level]; }
+
+    // Picks the coarsest level that still has about one triangle per two
+    // pixels of the projected bounds, seen from `eye` with the mesh placed by
+    // `model`. `pixel_scale` is projection[1][1] times half the viewport
+    // height. A positive bias selects coarser levels; each unit halves the
+    // triangle budget.
+    size_t select_lod(const glm::mat4 &model, glm::vec3 eye, float pixel_scale, float bias = 0.0f) const;
+
+    // Center and radius of a sphere around the bounds, with the mesh placed
+    // by `model`
+    std::pair<glm::vec3, float> bounding_sphere(const glm::mat4 &model) const;
+
+    // Vertex and index data, either owned or mapped from a cache file
+    std::span<const Vertex> vertices() const { return mapping_ ? mapped_vertices_ : std::span<const Vertex>(vertices_); }
+    std::span<const unsigned int> indices() const { return mapping_ ? mapped_indices_ : std::span<const unsigned int>(indices_); }
+
+    size_t num_vertices() const { return vertices().size(); }
+    size_t num_triangles() const { return lod(0).num_indices / 3; }
+
+    // Uploads the mesh in the given vertex format, along with a separate
+    // tightly packed position stream for depth-only passes. Indices are
+    // uploaded as 16-bit values whenever the vertex count allows. With a
+    // heap of the same format, the mesh is placed in the heap's buffers
+    // instead of its own, unless it is too large for 16-bit indices.
+    void setup(VertexFormat format = VertexFormat::kFloat, GeometryHeap *heap = nullptr);
+    void draw(size_t lod = 0) const;
+
+    // The heap holding the mesh, if any
+    const GeometryHeap *heap() const { return heap_; }
+
+    // Draws with positions only (attribute 0), for shadow and depth passes
+    void draw_depth(size_t lod = 0) const;
+
+    // Draws the meshlets of level 0 that are inside the frustum of
+    // `view_projection` and not facing away from `eye`, batched into one
+    // glMultiDrawElements call. Falls back to draw() without meshlets.
+    void draw_culled(const glm::mat4 &model, const glm::mat4 &view_projection, glm::vec3 eye,
+                     MeshletStats &stats) const;
+
+    // Like draw() and draw_culled(), but adds the draws to a batch of the
+    // mesh's heap instead of drawing; draw calls are left to the caller
+    void add_draws(DrawBatch &batch, size_t lod = 0) const;
+    void add_culled_draws(DrawBatch &batch, const glm::mat4 &model, const glm::mat4 &view_projection,
+                          glm::vec3 eye, MeshletStats &stats) const;
+
+    // Uploads per-instance model matrices, and optionally colors that replace
+    // the material's ambient and diffuse color, as vertex attributes 2-9 with
+    // a divisor of 1 on both vertex arrays (see shader/*.vs with INSTANCED).
+    // Requires setup().
+    void set_instances(std::span<const glm::mat4> models, std::span<const glm::vec3> colors = {});
+    size_t num_instances() const { return num_instances_; }
+
+    // Draws all instances with glDrawElementsInstancedBaseVertex
+    void draw_instanced(size_t lod = 0) const;
+    void draw_depth_instanced(size_t lod = 0) const;
+
+    // Draws the positions `count` times as instances, for shaders that tell
+    // the copies apart by gl_InstanceID. Per-instance attributes, if any,
+    // still advance once per instance.
+    void draw_depth_repeated(GLsizei count, size_t lod = 0) const;
+
+    // Maps the uploaded positions to model space; multiply it into the model
+    // matrix (but not the normal matrix) when drawing
+    const glm::mat4 &position_transform() const { return position_transform_; }
+
+    const VertexFormatStats &format_stats() const { return format_stats_; }
+
+private:
+    friend class MeshCache;
+
+    void unmap();
+    void make_owned();
+    void update_bounds();
+
+    // Fill the vertex streams uploaded by setup(); float vertices are
+    // uploaded as stored, so only their positions are extracted
+    void encode_float_positions(std::vector<std::byte> &positions) const;
+    void encode_compact_vertices(std::vector<std::byte> &vertices, std::vector<std::byte> &positions);
+
+    // Merges the index ranges of the meshlets that pass culling into
+    // visible_ranges_
+    void cull_meshlets(const glm::mat4 &model, const glm::mat4 &view_projection, glm::vec3 eye,
+                       MeshletStats &stats) const;
+
+    // The mesh's own vertex arrays, or else those of its heap
+    GLuint vertex_array(bool depth) const;
+    GLint base_vertex() const;
+    const void *index_offset(size_t first_index) const;
 
 private:
     std::vector<Vertex> vertices_;
     std::vector<unsigned int> indices_;
+
+    std::shared_ptr<const MappedFile> mapping_;
+    std::span<const Vertex> mapped_vertices_;
+    std::span<const unsigned int> mapped_indices_;
+
+    // Empty unless levels of detail were built
+    std::vector<Lod> lods_;
+    std::vector<Meshlet> meshlets_;
+
+    // Per-draw scratch for draw_culled
+    mutable std::vector<Lod> visible_ranges_;
+    mutable std::vector<GLsizei> draw_counts_;
+    mutable std::vector<const void *> draw_offsets_;
+    mutable std::vector<GLint> draw_base_vertices_;
+
     glm::vec3 centroid_;
     glm::vec3 min_;
     glm::vec3 max_;
 
-    GLuint vbo_, vao_, ebo_;
+    glm::mat4 position_transform_;
+    VertexFormatStats format_stats_;
+    GLenum index_type_;
+
+    GLuint vbo_, position_vbo_;
+    GLuint vao_, depth_vao_;
+    GLuint ebo_;
+    GLuint instance_vbo_;
+    size_t num_instances_;
+
+    // Heap meshes have no buffers of their own, nor vertex arrays unless
+    // they are instanced
+    GeometryHeap *heap_;
+    uint32_t heap_handle_;
 };
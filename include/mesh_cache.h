@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class BasicMesh;
+struct MeshLoadOptions;
+
+// Versioned binary mesh files ("bmesh") holding the vertex and index arrays,
+// levels of detail, meshlets and bounds of a loaded mesh, tagged with the size, modification time and
+// content hash of the source file and with the processing steps applied
+// after loading. Cache files are memory mapped on load, so a valid cache
+// skips parsing entirely.
+class MeshCache {
+public:
+    static constexpr uint32_t kVersion = 4;
+
+    // Processing flags; a cache file only matches a load with the same flags.
+    // The requested number of levels of detail is stored from bit 8 on.
+    enum Flags : uint32_t {
+        kOptimized = 1 << 0,
+        kMeshlets = 1 << 1,
+        kLodLevelsShift = 8,
+    };
+
+    static uint32_t flags(const MeshLoadOptions &options);
+
+    static bool enabled() { return enabled_; }
+    static void set_enabled(bool enabled) { enabled_ = enabled; }
+
+    // Cache files are placed next to their sources unless a directory is set
+    static const std::string &directory() { return directory_; }
+    static void set_directory(std::string directory) { directory_ = std::move(directory); }
+
+    static std::string cache_path(const char *source);
+
+    // Maps a cache file into the mesh. Fails if the file is missing, was
+    // written by another version or with other flags, or is out of date
+    // with the source.
+    static bool read(const char *cache_file, const char *source, uint32_t flags, BasicMesh &mesh);
+    static bool write(const char *cache_file, const char *source, uint32_t flags, const BasicMesh &mesh);
+
+private:
+    static inline bool enabled_ = true;
+    static inline std::string directory_;
+};
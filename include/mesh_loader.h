@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+class GeometryHeap;
+class ThreadPool;
+
+// Loads meshes concurrently on a thread pool, while the calling thread,
+// which owns the GL context, uploads each mesh as soon as it is parsed.
+class MeshLoader {
+public:
+    // Meshes are uploaded into `heap` when given (see BasicMesh::setup)
+    explicit MeshLoader(ThreadPool &pool, MeshLoadOptions options = {}, GeometryHeap *heap = nullptr);
+    ~MeshLoader();
+
+    MeshLoader(const MeshLoader &) = delete;
+    MeshLoader &operator=(const MeshLoader &) = delete;
+
+    // Queues a file for loading into `mesh`, which must outlive the loader
+    void enqueue(std::string filename, BasicMesh &mesh);
+
+    // Uploads all meshes parsed so far without blocking
+    void upload_ready();
+
+    // Waits for and uploads all queued meshes. Returns false if any failed.
+    bool finish();
+
+    void print_report(std::ostream &out) const;
+
+private:
+    struct Job {
+        std::string filename;
+        BasicMesh *mesh;
+        bool loaded = false;
+        double load_ms = 0.0;
+        double upload_ms = 0.0;
+    };
+
+    void upload(Job &job);
+
+private:
+    ThreadPool &pool_;
+    MeshLoadOptions options_;
+    GeometryHeap *heap_;
+
+    std::vector<std::unique_ptr<Job>> jobs_;
+    size_t num_processed_;
+    bool all_loaded_;
+    std::chrono::steady_clock::time_point start_time_;
+    double total_ms_;
+
+    // Jobs queued or running; used to split hardware threads between files
+    std::atomic<size_t> num_outstanding_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Job *> completed_;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <span>
+#include <vector>
+
+// Simplifies a triangle mesh into a chain of coarser levels of detail with
+// the OpenMesh quadric decimater, each level targeting half the triangles of
+// the previous one. The chain ends after `max_levels` levels, below
+// `min_triangles`, or when the decimater stops making progress. Collapses
+// keep the surviving vertices in place, so every level is an index list into
+// the original vertices. Only the coarser levels are returned, finest first.
+std::vector<std::vector<unsigned int>> build_lod_chain(std::span<const BasicMesh::Vertex> vertices,
+                                                       std::span<const unsigned int> indices,
+                                                       unsigned int max_levels, size_t min_triangles = 64);
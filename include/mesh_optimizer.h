@@ -0,0 +1,32 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <span>
+#include <vector>
+
+// Results of simulating a FIFO post-transform vertex cache.
+struct VertexCacheStats {
+    // Average cache misses per triangle (0.5 is optimal, 3 is worst)
+    float acmr;
+    // Average transforms per referenced vertex (1 is optimal)
+    float atvr;
+};
+
+VertexCacheStats analyze_vertex_cache(std::span<const unsigned int> indices, size_t num_vertices,
+                                      unsigned int cache_size = 16);
+
+// Reorders triangles for post-transform cache locality (Forsyth's
+// linear-speed algorithm).
+void optimize_vertex_cache(std::span<unsigned int> indices, size_t num_vertices);
+
+// Splits a cache-optimized index buffer into clusters at cache flushes and
+// sorts the clusters so that outward-facing clusters far from the center
+// are drawn first (Sander et al.). A threshold above 1 allows more clusters
+// at the expense of cache efficiency.
+void optimize_overdraw(std::span<unsigned int> indices, std::span<const BasicMesh::Vertex> vertices,
+                       float threshold = 1.05f);
+
+// Reorders vertices in the order in which they are first referenced, and
+// remaps the indices accordingly. Unreferenced vertices are moved to the end.
+void optimize_vertex_fetch(std::vector<BasicMesh::Vertex> &vertices, std::span<unsigned int> indices);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <span>
+#include <vector>
+
+// Splits the triangles of `indices` into meshlets of at most `max_vertices`
+// unique vertices and `max_triangles` triangles, growing each from a seed
+// through shared vertices, and reorders the indices so that every meshlet is
+// contiguous. Meshlet offsets are relative to the start of `indices`.
+std::vector<Meshlet> build_meshlets(std::span<unsigned int> indices, std::span<const BasicMesh::Vertex> vertices,
+                                    size_t max_vertices = 64, size_t max_triangles = 124);
+
+// Returns true if the meshlet is entirely back-facing as seen from `eye`
+bool meshlet_backfacing(const Meshlet &meshlet, glm::vec3 eye);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <string>
+#include <vector>
+
+// Multithreaded reader for Wavefront OBJ files.
+//
+// The file is split into line-aligned chunks which are parsed concurrently.
+// Only `v`, `vn` and `f` records are interpreted; everything else (texture
+// coordinates, groups, materials, ...) is skipped. Polygons are triangulated
+// as fans, and vertex normals are generated when the file provides none.
+class ObjReader {
+public:
+    enum class Status {
+        kOk,
+        kFileNotFound,
+        kParseError,
+    };
+    using enum Status;
+
+    // A thread count of zero means one thread per hardware thread.
+    explicit ObjReader(unsigned int num_threads = 0);
+
+    Status read(const char *filename, std::vector<BasicMesh::Vertex> &vertices, std::vector<unsigned int> &indices);
+
+    const std::string &error() const { return error_; }
+
+private:
+    unsigned int num_threads_;
+    std::string error_;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "shadow.h"
+
+#include <string>
+#include <vector>
+
+// Command-line options of the main executable
+struct Options {
+    std::vector<std::string> obj_files;
+
+    bool mesh_cache = true;
+    std::string mesh_cache_dir;
+    bool program_cache = true;
+    std::string program_cache_dir = "shader_cache";
+    bool optimize_meshes = false;
+    bool compact_vertices = false;
+    unsigned int lod_levels = 0;
+    float shadow_lod_bias = 1.0f;
+    bool meshlets = false;
+    bool geometry_heap = false;
+
+    // Number of face instances in the demo scene's stress mode (0 is off)
+    unsigned int stress_instances = 0;
+    bool instancing = true;
+
+    PointShadowStrategy shadow_strategy = PointShadowStrategy::kGeometryShader;
+    bool shadow_cache = true;
+    // Frames to render with each shadow strategy before printing their
+    // timings and exiting (0 is off)
+    unsigned int shadow_bench_frames = 0;
+
+    // Point lights besides the main one, which switch the lit shaders to
+    // clustered lighting (0 is off). Every light may be listed in every
+    // cluster, so their number is capped.
+    static constexpr unsigned int kMaxLights = 4096;
+    unsigned int lights = 0;
+    // Lights with a shadow map, including the main light
+    unsigned int shadow_budget = 1;
+    int shadow_size = 2048;
+    // Shadow lookups per light, each a 2x2 PCF of the hardware: 1, 4 or 20
+    int shadow_pcf_taps = 1;
+    // 16, 24 or 32 (floating point)
+    int shadow_depth_bits = 24;
+
+    bool deferred = false;
+    // Frames to render with forward and deferred shading at each light
+    // count of the benchmark before printing their timings and exiting
+    // (0 is off)
+    unsigned int lighting_bench_frames = 0;
+
+    // GPU pass timings of the demo scene (see GpuProfiler), printed every
+    // gpu_profile_dump_interval seconds if not 0
+    bool gpu_profile = false;
+    float gpu_profile_dump_interval = 0.0f;
+    std::string gpu_profile_csv;
+
+    // CPU scopes of startup and of every frame, written as a Chrome
+    // trace-event file on exit if not empty (see Trace)
+    std::string trace_file;
+
+    // Draws, binds and uploads of the last frame in the title (see
+    // RenderStats), and of every frame in frame_stats_file as JSON lines
+    // if not empty
+    bool frame_stats = false;
+    std::string frame_stats_file;
+
+    // Prints usage and returns false on invalid arguments
+    bool parse(int argc, char *argv[]);
+
+    static void print_usage(const char *program);
+};
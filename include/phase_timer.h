@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Wall-clock durations of consecutive phases, e.g. of initialization
+class PhaseTimer {
+public:
+    PhaseTimer();
+
+    // Ends the current phase, recording it under `name`, and starts the next
+    void lap(std::string name);
+
+    double total_ms() const;
+
+    // Prints "<title>: <phase> <ms> ms, ..., total <ms> ms" on one line
+    void print(std::ostream &out, std::string_view title) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start_;
+    Clock::time_point last_;
+    std::vector<std::pair<std::string, double>> phases_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+// On-disk cache of linked program binaries ("pbin"), one file per program,
+// named after a key that hashes the shader sources, with their defines, and
+// the GL vendor, renderer and version strings. Changing a source, a define or the
+// driver therefore misses the cache. Drivers may still reject a binary, in
+// which case the program is compiled from source and the entry replaced.
+class ProgramCache {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    // Accumulates a key from the sources of one program
+    class KeyBuilder {
+    public:
+        KeyBuilder();
+
+        void add(GLenum type, std::string_view source);
+        uint64_t key() const { return hash_; }
+
+    private:
+        void add_bytes(const void *data, size_t size);
+
+        uint64_t hash_;
+    };
+
+    static bool enabled() { return enabled_; }
+    static void set_enabled(bool enabled) { enabled_ = enabled; }
+
+    static const std::string &directory() { return directory_; }
+    static void set_directory(std::string directory) { directory_ = std::move(directory); }
+
+    // Whether the current context can return program binaries at all
+    static bool supported();
+
+    static std::string cache_path(uint64_t key);
+
+    // Loads a cached binary into `program`. Fails if there is no entry for
+    // the key or the driver rejects the binary, leaving the program unlinked.
+    static bool read(uint64_t key, GLuint program);
+    // Stores the binary of a program linked with
+    // GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+    static bool write(uint64_t key, GLuint program);
+
+    static size_t num_hits() { return num_hits_; }
+    static size_t num_misses() { return num_misses_; }
+
+    // Prints hits and misses, unless the cache is disabled or unsupported
+    static void print_report(std::ostream &out);
+
+private:
+    static inline bool enabled_ = true;
+    static inline std::string directory_ = "shader_cache";
+    // -1 until queried
+    static inline int supported_ = -1;
+
+    static inline size_t num_hits_ = 0;
+    static inline size_t num_misses_ = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Work submitted to GL in one frame
+struct FrameStats {
+    size_t draw_calls = 0;
+    size_t triangles = 0;
+    // Indices or array vertices drawn, times instances
+    size_t vertices = 0;
+    // GL calls made through GlState and those it skipped as redundant
+    size_t state_calls = 0;
+    size_t state_calls_avoided = 0;
+    // Binds issued through GlState, not those it skipped
+    size_t program_binds = 0;
+    size_t vertex_array_binds = 0;
+    size_t texture_binds = 0;
+    // Uniform values set and those skipped as unchanged
+    size_t uniform_uploads = 0;
+    size_t uniform_uploads_skipped = 0;
+    size_t buffer_bytes = 0;
+};
+
+// The one registry of per-frame counters: those of the current frame,
+// incremented by the draw, state, bind and upload paths, and a record of
+// the last complete frame. Application::exec starts and ends the frames, so
+// everything done before the first one, such as loading, is not counted.
+// Every frame can also be appended to a file as a JSON line, for comparing
+// runs.
+class RenderStats {
+public:
+    static void count_draw(GLenum mode, size_t vertices, size_t instances = 1) {
+        ++current_.draw_calls;
+        current_.vertices += vertices * instances;
+        if (mode == GL_TRIANGLES) {
+            current_.triangles += vertices / 3 * instances;
+        } else if ((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) && vertices > 2) {
+            current_.triangles += (vertices - 2) * instances;
+        }
+    }
+    static void count_state_calls(size_t count = 1) { current_.state_calls += count; }
+    static void count_state_calls_avoided(size_t count = 1) { current_.state_calls_avoided += count; }
+    static void count_program_bind() { ++current_.program_binds; }
+    static void count_vertex_array_bind() { ++current_.vertex_array_binds; }
+    static void count_texture_bind() { ++current_.texture_binds; }
+    static void count_uniform_upload() { ++current_.uniform_uploads; }
+    static void count_uniform_upload_skipped() { ++current_.uniform_uploads_skipped; }
+    static void count_buffer_upload(size_t bytes) { current_.buffer_bytes += bytes; }
+
+    static void begin_frame() { current_ = {}; }
+    // Records the frame and appends it to the dump file, if one is open
+    static void end_frame();
+
+    static const FrameStats &current() { return current_; }
+    static const FrameStats &last() { return last_; }
+    // Frames ended so far
+    static uint64_t frame() { return frame_; }
+
+    // Appends one JSON object per frame to `path`, replacing its contents
+    static bool open_dump(const std::string &path);
+
+    // The last frame, e.g. "12 draws, 34.5k triangles, ..."
+    static std::string summary();
+
+private:
+    static inline FrameStats current_;
+    static inline FrameStats last_;
+    static inline uint64_t frame_ = 0;
+    static inline std::ofstream dump_;
+};
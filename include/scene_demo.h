@@ -2,25 +2,40 @@
 
 #include "application.h"
 #include "camera.h"
+#include "clustered_lighting.h"
 #include "control.h"
+#include "deferred.h"
+#include "geometry_heap.h"
+#include "gpu_profiler.h"
+#include "gl_state.h"
+#include "mesh.h"
+#include "options.h"
+#include "shader_uniforms.h"
+#include "shadow.h"
+#include "uniform_buffer.h"
 
 #include <glm/glm.hpp>
 
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
+#include <vector>
 
-class BasicMesh;
+class MeshLoader;
 class ShaderProgram;
-class PointShadowMap;
+class ThreadPool;
 
 class SceneDemo : public Application {
 public:
     enum class ShaderType {
         kPhong,
         kGouraud,
+        kDeferred,
     };
     using enum ShaderType;
 
-    explicit SceneDemo();
+    explicit SceneDemo(Options options);
     ~SceneDemo();
 
     void process_input() override;
@@ -33,30 +48,196 @@ protected:
     int render() override;
 
 private:
-    bool load_meshes();
-    bool load_shaders();
+    // Initialization overlaps mesh parsing on worker threads with shader
+    // compilation in the driver
+    std::unique_ptr<MeshLoader> start_loading_meshes(ThreadPool &pool);
+    bool finish_loading_meshes(MeshLoader &loader);
+    bool submit_shaders();
+    bool finish_shaders();
     void init_shadow_map();
     void init_scene();
-    void render_pass(const ShaderProgram &shader, bool shadow_pass);
+    // Places the faces of the stress mode on a grid
+    void init_instances(unsigned int count);
+    // Scatters the lights of --lights over the ground
+    void init_lights(unsigned int count);
+    // Viewpoint of a pass, for level of detail selection and culling
+    struct PassView {
+        glm::vec3 eye;
+        // projection[1][1] times half the viewport height
+        float pixel_scale;
+        // Unset to draw without meshlet culling
+        std::optional<glm::mat4> view_projection;
+    };
+
+    // A mesh drawn into the shadow map, with the cube faces it touches as
+    // bit i for face i. Casters are compared with the previous frame's to
+    // find out what to redraw.
+    struct ShadowCaster {
+        const BasicMesh *mesh;
+        size_t object;
+        glm::mat4 model;
+        size_t lod;
+        uint32_t faces;
+        // Draws all instances of the mesh
+        bool instanced;
+
+        bool operator==(const ShadowCaster &) const = default;
+    };
+
+    // A light's cube map in the shadow map, with the state of its last
+    // update
+    struct ShadowSlot {
+        // Index into lights_, -1 if unused
+        int light = -1;
+        bool valid = false;
+        glm::vec3 light_pos{0.0f};
+        std::vector<ShadowCaster> static_casters;
+        std::vector<ShadowCaster> dynamic_casters;
+    };
+
+    struct ShadowStats {
+        int slots_used = 0;
+        // Faces of the sampled map redrawn this frame over all slots, 0 if
+        // the pass was skipped
+        int faces_updated = 0;
+        int static_slots_updated = 0;
+        size_t draw_calls = 0;
+        // Casters beyond the far plane of every face
+        size_t far_culled = 0;
+    };
+
+    struct ShadowBenchResult {
+        unsigned int warmup_frames = 0;
+        unsigned int frames = 0;
+        double ms = 0.0;
+        size_t draw_calls = 0;
+    };
+
+    // Light counts of the lighting benchmark, each run with forward and
+    // deferred shading
+    static constexpr unsigned int kLightingBenchCounts[] = {1, 16, 256};
+    static constexpr int kNumLightingBenchSteps = 2 * std::size(kLightingBenchCounts);
+
+    struct LightingBenchResult {
+        unsigned int warmup_frames = 0;
+        unsigned int frames = 0;
+        double ms = 0.0;
+    };
+
+    // Writes the frame, lighting and object blocks for this frame
+    void update_uniforms(const glm::mat4 &projection, const glm::mat4 &view);
+    // Moves the lights and gives the nearest ones shadow slots
+    void update_lights();
+    // Splits the casters of a light into static and dynamic ones
+    void collect_shadow_casters(const glm::vec3 &light_pos);
+    // Updates every slot in use
+    void update_shadow_map();
+    // Redraws the faces of a slot that the casters changed, with the static
+    // casters drawn once into their own cube map when cached
+    void update_shadow_slot(int slot);
+    // Draws casters into the faces of a slot of a target that are set in
+    // `faces`
+    void draw_shadow_casters(std::span<const ShadowCaster> casters, int slot, const glm::vec3 &light_pos,
+                             uint32_t faces, PointShadowTarget target);
+    // Times full updates of the shadow map with each strategy in turn, then
+    // prints the results and closes the window
+    void render_shadow_bench();
+    // The next strategy whose programs were built
+    PointShadowStrategy next_shadow_strategy(PointShadowStrategy strategy) const;
+    // Sets the shading and light count of a step of the lighting benchmark
+    void start_lighting_bench_step(int step);
+    // Adds the time of a frame's scene pass to the current step, moving on
+    // to the next when it has enough frames; after the last, prints the
+    // results and closes the window
+    void record_lighting_bench(double ms);
+    void render_pass(const PassView &view);
+    void draw_faces(const PassView &view);
+    // Binds the lit variant for the current shading flags. Fails if the
+    // variant did not build.
+    bool bind_lit_pipeline(bool instanced);
+    uint32_t lit_features(bool instanced) const;
+    void update_title();
 
 private:
+    Options options_;
+
     Camera camera_;
     FirstPersonController controller_;
 
+    // Declared before the meshes, which free their ranges on destruction
+    std::unique_ptr<GeometryHeap> geometry_heap_;
     std::unique_ptr<BasicMesh> mesh_;
     std::unique_ptr<BasicMesh> cube_mesh_;
     std::unique_ptr<BasicMesh> plane_mesh_;
 
-    std::unique_ptr<ShaderProgram> phong_shader_;
-    std::unique_ptr<ShaderProgram> gouraud_shader_;
+    MeshletStats meshlet_stats_;
+    float title_time_;
+
+    // Null unless --gpu-profile
+    std::unique_ptr<GpuProfiler> gpu_profiler_;
+    float profile_dump_time_;
+
+    // All programs, in submission order
+    std::vector<ShaderProgram *> shaders_;
     std::unique_ptr<ShaderProgram> light_cube_shader_;
-    std::unique_ptr<ShaderProgram> point_shadow_shader_;
+    // Indexed by PointShadowStrategy; null where unsupported. Instanced
+    // programs are built for the instanced stress mode.
+    std::unique_ptr<ShaderProgram> point_shadow_shaders_[kNumPointShadowStrategies];
+    std::unique_ptr<ShaderProgram> point_shadow_instanced_shaders_[kNumPointShadowStrategies];
+
+    // Lit programs by ShaderFeature, built as the flags change
+    std::unique_ptr<ShaderVariants> phong_variants_;
+    std::unique_ptr<ShaderVariants> gouraud_variants_;
+    std::unique_ptr<DeferredRenderer> deferred_;
+
+    PointShadowUniforms point_shadow_uniforms_[kNumPointShadowStrategies];
+    PointShadowUniforms point_shadow_instanced_uniforms_[kNumPointShadowStrategies];
+
+    // Indexed by wireframe_
+    RasterState lit_rasters_[2];
+    std::unique_ptr<PipelineState> light_cube_pipelines_[2];
+    std::unique_ptr<PipelineState> point_shadow_pipelines_[kNumPointShadowStrategies];
+    std::unique_ptr<PipelineState> point_shadow_instanced_pipelines_[kNumPointShadowStrategies];
+
+    std::unique_ptr<UniformBuffer> frame_uniforms_;
+    std::unique_ptr<UniformBuffer> lighting_uniforms_;
+    std::unique_ptr<ObjectUniformBuffer> object_uniforms_;
+    size_t face_object_;
+    size_t plane_object_;
+    size_t light_cube_object_;
+    glm::mat4 face_model_;
+    glm::mat4 plane_model_;
+
+    // Stress mode faces, placed by instance_models_[i] * face_model_
+    std::vector<glm::mat4> instance_models_;
+    std::vector<glm::vec3> instance_colors_;
+    size_t first_instance_object_;
 
     std::unique_ptr<PointShadowMap> shadow_map_;
+    PointShadowStrategy shadow_strategy_;
+    std::vector<ShadowCaster> static_casters_;
+    std::vector<ShadowCaster> dynamic_casters_;
+    std::vector<ShadowSlot> shadow_slots_;
+    ShadowStats shadow_stats_;
+    ShadowBenchResult shadow_bench_[kNumPointShadowStrategies];
+    int lighting_bench_step_;
+    LightingBenchResult lighting_bench_[kNumLightingBenchSteps];
 
     glm::vec3 light_pos_;
     glm::vec3 light_color_;
 
+    // With --lights, the main light followed by the others, placed by
+    // rotating light_origins_ about the y axis. Null clustered_lighting_
+    // without.
+    std::vector<PointLight> lights_;
+    // Lights in use, a prefix of lights_
+    size_t active_lights_;
+    std::vector<glm::vec3> light_origins_;
+    std::vector<float> light_speeds_;
+    // Scratch for update_lights()
+    std::vector<int> nearest_lights_;
+    std::unique_ptr<ClusteredLighting> clustered_lighting_;
+
     float angle_;
 
     bool wireframe_;
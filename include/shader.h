@@ -3,8 +3,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <initializer_list>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <vector>
 
 class Shader {
 public:
@@ -17,12 +25,40 @@ public:
     GLuint id() const { return id_; }
 
     bool compile(const char *source);
-    bool compile_from(const char *filename);
+    // `defines` (e.g. "#define INSTANCED\n") is inserted after the #version line
+    bool compile_from(const char *filename, std::string_view defines = {});
+
+    // compile() in two steps: submit() starts compiling without querying the
+    // result, check() waits for it and reports errors
+    void submit(const char *source);
+    bool check() const;
+
+    // Reads a source file and inserts `defines` as compile_from does.
+    // A line `#include "file"` is replaced by that file, relative to the
+    // shader's directory, e.g. to share shader/lighting.glsl.
+    static bool read_source(const char *filename, std::string_view defines, std::string &source);
 
 private:
     GLuint id_;
 };
 
+// Uniform of a ShaderProgram resolved once by ShaderProgram::uniform, so that
+// setting it needs no name lookup. Invalid handles are ignored when set,
+// like location -1 in GL.
+template <typename T>
+class Uniform {
+public:
+    Uniform() = default;
+
+    bool valid() const { return slot_ >= 0; }
+
+private:
+    friend class ShaderProgram;
+    explicit Uniform(int slot) : slot_(slot) {}
+
+    int slot_ = -1;
+};
+
 class ShaderProgram {
 public:
     ShaderProgram();
@@ -35,14 +71,51 @@ public:
 
     void attach_shader(const Shader &shader);
     bool link();
-    bool build_from(std::initializer_list<std::pair<GLenum, const char *>> shaders);
-    bool build_from_vf(const char *prefix);
-    bool build_from_vgf(const char *prefix);
+
+    // Compiles and links the given files, or loads the linked program from
+    // the ProgramCache when it is enabled and holds an up-to-date binary
+    bool build_from(std::initializer_list<std::pair<GLenum, const char *>> shaders, std::string_view defines = {});
+    bool build_from_vf(const char *prefix, std::string_view defines = {});
+    bool build_from_vgf(const char *prefix, std::string_view defines = {});
+
+    // build_from() in two steps. submit() issues all compile and link calls
+    // without querying their status, so that the driver can compile while
+    // the caller does other work; finish() waits for the result. Only
+    // reading the sources can fail in submit().
+    bool submit(std::initializer_list<std::pair<GLenum, const char *>> shaders, std::string_view defines = {});
+    bool submit(std::span<const std::pair<GLenum, const char *>> shaders, std::string_view defines = {});
+    bool submit_vf(const char *prefix, std::string_view defines = {});
+    bool submit_vgf(const char *prefix, std::string_view defines = {});
+    bool finish();
+
+    // Whether finish() would return without waiting. Always true without
+    // GL_KHR_parallel_shader_compile.
+    bool is_ready() const;
+
+    // Lets the driver compile on multiple threads if it supports
+    // GL_KHR_parallel_shader_compile (or the ARB version). Call once after
+    // loading GL; returns whether the extension is used.
+    static bool enable_parallel_compile(GLADloadproc load);
+    static bool parallel_compile() { return parallel_compile_; }
 
     void use() const;
 
     int uniform_location(const char *name) const;
 
+    // Resolves an active uniform of the linked program. Elements of arrays
+    // are resolved as "name[i]". Returns an invalid handle, with a warning
+    // for type mismatches, if the uniform is not active.
+    template <typename T>
+    Uniform<T> uniform(std::string_view name) const;
+
+    // Setters skip the GL call when the value equals the last one uploaded
+    void set(Uniform<bool> uniform, bool value) const;
+    void set(Uniform<int> uniform, int value) const;
+    void set(Uniform<float> uniform, float value) const;
+    void set(Uniform<glm::vec3> uniform, glm::vec3 value) const;
+    void set(Uniform<glm::mat3> uniform, const glm::mat3 &value) const;
+    void set(Uniform<glm::mat4> uniform, const glm::mat4 &value) const;
+
     void set_bool(const char *name, bool value) const;
     void set_int(const char *name, int value) const;
     void set_float(const char *name, float value) const;
@@ -50,6 +123,87 @@ public:
     void set_mat3(const char *name, const glm::mat3 &value) const;
     void set_mat4(const char *name, const glm::mat4 &value) const;
 
+    // Assigns an active uniform block to a binding point; GLSL 3.30 has no
+    // binding layout qualifier. Returns the block's data size in bytes, or 0
+    // if the program has no such block.
+    size_t bind_uniform_block(const char *name, GLuint binding) const;
+
 private:
+    struct UniformSlot {
+        GLint location;
+        GLenum type;
+        bool has_value;
+        // Last uploaded value, large enough for a mat4
+        std::array<float, 16> value;
+    };
+
+    // Transparent hashing, so that lookups by string_view do not allocate
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+
+    // Reports link errors, or reflects the uniforms of the linked program
+    bool check_link();
+    void reflect_uniforms();
+    int find_slot(std::string_view name) const;
+
+    // Records the value and returns false if it is already uploaded
+    bool update_value(int slot, const void *data, size_t size) const;
+
     GLuint id_;
+
+    // Slots hold the last uploaded values, hence mutable
+    mutable std::vector<UniformSlot> uniforms_;
+    std::unordered_map<std::string, int, NameHash, std::equal_to<>> uniform_slots_;
+
+
+    // State between submit() and finish()
+    std::vector<std::unique_ptr<Shader>> pending_shaders_;
+    std::vector<std::string> pending_files_;
+    uint64_t cache_key_;
+    bool loaded_from_cache_;
+
+    static inline bool parallel_compile_ = false;
+};
+
+// Programs built from the same files with different sets of #defines
+// ("variants"), so that features are chosen at compile time instead of by
+// branching on uniforms. Variants are built on first use and kept in a
+// table keyed by a mask of feature bits, where bit i adds
+// "#define <feature_names[i]>".
+class ShaderVariants {
+public:
+    // Runs once per variant after linking, e.g. to bind uniform blocks
+    using Setup = std::function<bool(const ShaderProgram &)>;
+
+    ShaderVariants(std::vector<std::pair<GLenum, std::string>> shaders, std::vector<std::string> feature_names,
+                   Setup setup = {});
+
+    std::string defines(uint32_t features) const;
+
+    // Submits a variant without waiting for it (see ShaderProgram::submit)
+    void prepare(uint32_t features);
+
+    // Returns a variant, building it or waiting for it on first use. Returns
+    // null if it failed to build; the error is only reported once.
+    const ShaderProgram *get(uint32_t features);
+
+    size_t num_variants() const { return variants_.size(); }
+    // Variants that get() would return without waiting
+    size_t num_ready() const;
+
+private:
+    struct Variant {
+        std::unique_ptr<ShaderProgram> program;
+        bool finished = false;
+        bool failed = false;
+    };
+
+    Variant &submit(uint32_t features);
+
+    std::vector<std::pair<GLenum, std::string>> shaders_;
+    std::vector<std::string> feature_names_;
+    Setup setup_;
+    std::unordered_map<uint32_t, Variant> variants_;
 };
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "shader.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Uniform blocks and handles of the programs under shader/
+
+// Binding points of the uniform blocks
+enum UniformBinding : GLuint {
+    kFrameBinding = 0,
+    kLightingBinding = 1,
+    kObjectBinding = 2,
+    kClustersBinding = 3,
+};
+
+// Texture units of the samplers of the lit programs
+enum TextureUnit : GLuint {
+    kShadowUnit = 0,
+    kLightDataUnit = 1,
+    kClusterLightsUnit = 2,
+    kLightIndicesUnit = 3,
+    // G-buffer of DeferredRenderer
+    kGBufferDepthUnit = 4,
+    kGBufferNormalUnit = 5,
+    kGBufferDiffuseUnit = 6,
+    kGBufferAmbientUnit = 7,
+};
+
+// std140 layouts of the blocks. A vec3 takes 16 bytes unless a scalar
+// follows it, so padding is explicit.
+
+// uniform Frame, written once per frame
+struct FrameBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 view_pos;
+    float pad0;
+    // For rebuilding positions from depth; only declared by shader/deferred
+    glm::mat4 inverse_view_projection;
+};
+
+// uniform Lighting, written once per frame
+struct LightingBlock {
+    // struct Light
+    glm::vec3 ambient;
+    float pad0;
+    glm::vec3 diffuse;
+    float pad1;
+    glm::vec3 specular;
+    float pad2;
+
+    glm::vec3 light_pos;
+    float far;
+    float near;
+    // Size of a shadow map texel at unit distance along the major axis,
+    // which spaces the PCF taps
+    float shadow_texel_size;
+    float pad3[2];
+};
+
+// uniform Clusters, written once per frame (see ClusteredLighting)
+struct ClustersBlock {
+    // Clusters along x, y and z, and the number of lights
+    glm::uvec4 grid;
+    // Depth slice scale and bias, and the reciprocal viewport size
+    glm::vec4 params;
+};
+
+// uniform Object, one per draw
+struct ObjectBlock {
+    glm::mat4 model;
+    // A std140 mat3 has vec4 columns; the shaders use mat3(normalMatrix)
+    glm::mat4 normal_matrix;
+
+    // struct Material
+    glm::vec3 ambient;
+    float pad0;
+    glm::vec3 diffuse;
+    float pad1;
+    glm::vec3 specular;
+    float shininess;
+};
+
+// Object block with the model and normal matrices of a mesh placed by
+// `model`; `position_transform` maps the mesh's stored positions to model space
+ObjectBlock object_block(const glm::mat4 &model, const glm::mat4 &position_transform);
+
+static_assert(sizeof(FrameBlock) == 208);
+static_assert(sizeof(LightingBlock) == 80);
+static_assert(sizeof(ObjectBlock) == 176);
+static_assert(sizeof(ClustersBlock) == 32);
+
+// Assigns the blocks a program declares to their binding points. Fails if a
+// block is larger than its struct.
+bool bind_uniform_blocks(const ShaderProgram &shader);
+
+// Feature bits of the lit programs (shader/phong, shader/gouraud); each
+// adds the #define of the same name
+enum ShaderFeature : uint32_t {
+    kBlinnFeature = 1 << 0,
+    kShadowsFeature = 1 << 1,
+    kInstancedFeature = 1 << 2,
+    // Lights from ClusteredLighting instead of the Lighting block's light
+    kClusteredFeature = 1 << 3,
+    // Shadows from a cube map array, as bound by a PointShadowMap with
+    // several slots
+    kShadowArrayFeature = 1 << 4,
+    // Shadow lookups with 4 or 20 taps of 2x2 PCF instead of one
+    kPcf4Feature = 1 << 5,
+    kPcf20Feature = 1 << 6,
+};
+
+// The PCF feature of a number of shadow taps: 1, 4 or 20
+uint32_t pcf_feature(int taps);
+
+// Variants of shader/<prefix>.vs and .fs by ShaderFeature, with their
+// blocks bound and samplers set to their TextureUnit
+std::unique_ptr<ShaderVariants> make_lit_variants(const char *prefix);
+std::unique_ptr<ShaderVariants> make_lit_variants(std::string vertex_path, std::string fragment_path);
+
+// shader/point_shadow and shader/point_shadow_face; each program only
+// resolves the uniforms it declares
+struct PointShadowUniforms {
+    PointShadowUniforms() = default;
+    explicit PointShadowUniforms(const ShaderProgram &shader);
+
+    Uniform<glm::mat4> shadow_matrices[6];
+    Uniform<glm::mat4> shadow_matrix;
+    Uniform<int> faces[6];
+    Uniform<glm::vec3> light_pos;
+    Uniform<int> layer;
+};
@@ -1,32 +1,112 @@
 #pragma once
 
+#include "frustum.h"
+
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// How the six faces of a point shadow map are rendered
+enum class PointShadowStrategy {
+    // One pass; shader/point_shadow.gs copies every triangle to all faces
+    kGeometryShader,
+    // One pass per face with shader/point_shadow_face, drawing only the
+    // casters inside that face's frustum
+    kSixPass,
+    // One pass; every caster is drawn as one instance per face it touches,
+    // and the vertex shader selects the face with gl_Layer. Requires
+    // GL_ARB_shader_viewport_layer_array or GL_AMD_vertex_shader_layer.
+    kLayered,
+};
+
+constexpr int kNumPointShadowStrategies = 3;
+
+// "gs", "six-pass" or "layered"
+const char *point_shadow_strategy_name(PointShadowStrategy strategy);
+std::optional<PointShadowStrategy> parse_point_shadow_strategy(std::string_view name);
+
+// Cube maps of a PointShadowMap
+enum class PointShadowTarget {
+    // Sampled by the lit shaders
+    kShadow,
+    // Static casters only, copied into kShadow before the dynamic casters
+    // are drawn over them
+    kStatic,
+};
+
+constexpr uint32_t kAllCubeFaces = 0x3f;
+
+// Depth cube maps of point lights. A map with several slots is a cube map
+// array with one cube map per slot, layers 6 * slot to 6 * slot + 5, which
+// needs GL_ARB_texture_cube_map_array; all slots share the size and planes.
 class PointShadowMap {
 public:
-    PointShadowMap(int width, int height, float near, float far);
+    // A cached map has a second texture for the static casters (see
+    // PointShadowTarget), which doubles its memory. `depth_bits` is 16, 24
+    // or 32 (floating point).
+    PointShadowMap(int width, int height, float near, float far, int slots = 1, bool cached = false,
+                   int depth_bits = 24);
     ~PointShadowMap();
 
     int width() const { return width_; }
     int height() const { return height_; }
+    int slots() const { return slots_; }
+    int depth_bits() const { return depth_bits_; }
+    // Bytes of all textures
+    size_t memory_size() const;
 
     float near() const { return near_; }
     float far() const { return far_; }
 
-    GLuint fbo() const { return fbo_; }
-    GLuint depth_cubemap() const { return depth_cubemap_; }
+    bool cached() const { return textures_[1] != 0; }
 
+    // GL_TEXTURE_CUBE_MAP, or GL_TEXTURE_CUBE_MAP_ARRAY with several slots
+    GLenum texture_target() const;
+    GLuint depth_cubemap() const { return textures_[0]; }
+
+    // Maps positions relative to the light to the clip space of a face
     const glm::mat4 &shadow_matrix(int face) const { return shadow_matrices_[face]; }
 
-    void bind() const;
+    // Whether the context can set gl_Layer in a vertex shader, as
+    // PointShadowStrategy::kLayered needs
+    static bool layered_supported();
+    // Whether the context has cube map arrays, as more than one slot needs
+    static bool array_supported();
+
+    // Faces whose frustum a sphere around `center`, relative to the light,
+    // touches, as bit i for face i. Zero if the sphere is beyond far() along
+    // any axis and so cannot cast a shadow on any face.
+    uint32_t face_mask(glm::vec3 center, float radius) const;
+
+    // Bind all layers of all slots for layered rendering, or a single face
+    void bind(PointShadowTarget target = PointShadowTarget::kShadow) const;
+    void bind_face(int slot, int face, PointShadowTarget target = PointShadowTarget::kShadow) const;
+    // Clears the faces of one slot
+    void clear(int slot, PointShadowTarget target = PointShadowTarget::kShadow) const;
+
+    // Copies faces of a slot of kStatic to kShadow, as bit i for face i.
+    // Requires a cached map.
+    void copy_static_faces(int slot, uint32_t faces) const;
 
 private:
+    // Creates a texture with a layered framebuffer and one per face
+    void create_texture(int target);
+
     int width_;
     int height_;
+    int slots_;
+    int depth_bits_;
     float near_;
     float far_;
-    GLuint fbo_;
-    GLuint depth_cubemap_;
+    // Indexed by PointShadowTarget; kStatic is 0 unless cached
+    GLuint textures_[2];
+    GLuint fbos_[2];
+    // 6 * slots_ each, face i of slot s at 6 * s + i
+    std::vector<GLuint> face_fbos_[2];
     glm::mat4 shadow_matrices_[6];
+    std::vector<Frustum> face_frustums_;
 };
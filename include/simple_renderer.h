@@ -1,8 +1,17 @@
 #pragma once
 
 #include "application.h"
+#include "bvh.h"
 #include "camera.h"
+#include "clustered_lighting.h"
 #include "control.h"
+#include "deferred.h"
+#include "geometry_heap.h"
+#include "gl_state.h"
+#include "mesh.h"
+#include "options.h"
+#include "shader_uniforms.h"
+#include "uniform_buffer.h"
 
 #include <glm/glm.hpp>
 
@@ -10,19 +19,21 @@
 #include <memory>
 #include <string>
 
-class BasicMesh;
 class CircleMesh;
+class MeshLoader;
 class ShaderProgram;
+class ThreadPool;
 
 class SimpleRenderer : public Application {
 public:
     enum class ShaderType {
         kPhong,
         kGouraud,
+        kDeferred,
     };
     using enum ShaderType;
 
-    explicit SimpleRenderer(std::vector<std::string> obj_files);
+    explicit SimpleRenderer(Options options);
     ~SimpleRenderer();
 
     void process_input() override;
@@ -37,27 +48,71 @@ protected:
     int render() override;
 
 private:
-    bool load_meshes();
-    bool load_shaders();
+    // Initialization overlaps mesh parsing on worker threads with shader
+    // compilation in the driver
+    std::unique_ptr<MeshLoader> start_loading_meshes(ThreadPool &pool);
+    bool finish_loading_meshes(MeshLoader &loader);
+    bool submit_shaders();
+    bool finish_shaders();
     void init_scene();
+    // Scatters the lights of --lights through the scene's bounds
+    void init_lights(unsigned int count, const glm::vec3 &min, const glm::vec3 &max);
+    void update_title();
+    uint32_t lit_features() const;
+
+    // Places a mesh and refits the culling hierarchy
+    void set_model_matrix(size_t mesh, const glm::mat4 &model);
+    void set_exploded(bool exploded);
 
 private:
     Camera camera_;
     ThirdPersonController controller_;
 
-    std::vector<std::string> obj_files_;
+    Options options_;
+    // Declared before the meshes, which free their ranges on destruction
+    std::unique_ptr<GeometryHeap> geometry_heap_;
     std::vector<std::unique_ptr<BasicMesh>> meshes_;
+    std::vector<glm::mat4> model_matrices_;
     std::unique_ptr<CircleMesh> circle_mesh_;
 
-    std::unique_ptr<ShaderProgram> phong_shader_;
-    std::unique_ptr<ShaderProgram> gouraud_shader_;
+    Bvh bvh_;
+    std::vector<unsigned int> visible_meshes_;
+    glm::vec3 scene_center_;
+
+    // Object block index of each visible mesh; heap meshes with equal blocks
+    // share one, so that they can be drawn as one batch
+    std::vector<size_t> mesh_objects_;
+    std::unique_ptr<DrawBatch> draw_batch_;
+
+    MeshletStats meshlet_stats_;
+    size_t num_draw_calls_;
+    float title_time_;
+
+    // Lit programs by ShaderFeature, built as the flags change
+    std::unique_ptr<ShaderVariants> phong_variants_;
+    std::unique_ptr<ShaderVariants> gouraud_variants_;
+    std::unique_ptr<DeferredRenderer> deferred_;
     std::unique_ptr<ShaderProgram> circle_shader_;
 
+    // Indexed by wireframe_
+    RasterState lit_rasters_[2];
+    std::unique_ptr<PipelineState> circle_pipeline_;
+
+    std::unique_ptr<UniformBuffer> frame_uniforms_;
+    std::unique_ptr<UniformBuffer> lighting_uniforms_;
+    std::unique_ptr<ObjectUniformBuffer> object_uniforms_;
+
     glm::vec3 light_pos_;
     glm::vec3 light_color_;
 
+    // With --lights, the camera light followed by the others, none with
+    // shadows. Null clustered_lighting_ without.
+    std::vector<PointLight> lights_;
+    std::unique_ptr<ClusteredLighting> clustered_lighting_;
+
     bool wireframe_;
     bool trackball_;
+    bool exploded_;
 
     ShaderType shader_type_;
     bool blinn_;
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// CPU time of named scopes on any thread, written as a Chrome trace-event
+// JSON file that chrome://tracing and Perfetto open. Each thread appends to
+// a buffer of its own without locking, so scopes on worker threads do not
+// contend. Tracing is off until start(); until then a scope costs one atomic
+// load.
+class Trace {
+public:
+    // Records the time from construction to destruction under `name`, which
+    // is not copied and must outlive the trace, e.g. a string literal
+    class Scope {
+    public:
+        explicit Scope(const char *name)
+            : name_(Trace::enabled() ? name : nullptr),
+              start_(name_ != nullptr ? Trace::now() : 0) {
+        }
+
+        ~Scope() {
+            if (name_ != nullptr) {
+                Trace::record(name_, start_, Trace::now());
+            }
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *name_;
+        int64_t start_;
+    };
+
+    static bool enabled() { return enabled_.load(std::memory_order_acquire); }
+    static void start();
+
+    // Labels the calling thread in the trace; `name` must outlive the trace
+    static void set_thread_name(const char *name);
+
+    // Writes the events recorded so far. The traced scopes should have
+    // ended, e.g. by joining their threads.
+    static bool write(const std::string &path);
+    static size_t num_events();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        const char *name;
+        // Nanoseconds since start()
+        int64_t start;
+        int64_t duration;
+    };
+
+    // Events are appended to the tail chunk and never move, so that the
+    // owning thread needs no lock. `count` publishes them to write().
+    struct Chunk {
+        static constexpr size_t kSize = 1024;
+
+        Event events[kSize];
+        std::atomic<size_t> count{0};
+        std::atomic<Chunk *> next{nullptr};
+    };
+
+    struct ThreadBuffer {
+        ~ThreadBuffer();
+
+        uint32_t id = 0;
+        std::atomic<const char *> name{nullptr};
+        Chunk *head = nullptr;
+        Chunk *tail = nullptr;
+    };
+
+    // Nanoseconds since start()
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch_).count();
+    }
+
+    static void record(const char *name, int64_t start, int64_t end);
+    // Registers the buffer of the calling thread on first use
+    static ThreadBuffer &thread_buffer();
+
+    static inline std::atomic<bool> enabled_{false};
+    static inline Clock::time_point epoch_;
+
+    // Guards registration only
+    static inline std::mutex mutex_;
+    static inline std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
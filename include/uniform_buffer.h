@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Uniform buffer bound in full to a fixed binding point, for data written
+// once per frame and shared by all programs declaring the block.
+class UniformBuffer {
+public:
+    UniformBuffer(size_t size, GLuint binding);
+    ~UniformBuffer();
+
+    UniformBuffer(const UniformBuffer &) = delete;
+    UniformBuffer &operator=(const UniformBuffer &) = delete;
+
+    GLuint id() const { return id_; }
+    GLuint binding() const { return binding_; }
+
+    // Replaces the contents; the previous storage is orphaned, so that
+    // draws still reading it do not stall the upload
+    void update(const void *data);
+
+    template <typename T>
+    void update(const T &block) { update(static_cast<const void *>(&block)); }
+
+private:
+    GLuint id_;
+    GLuint binding_;
+    size_t size_;
+};
+
+// Array of per-object blocks sub-allocated from one uniform buffer. Blocks
+// are added while building a frame, uploaded together and selected per draw
+// by binding their range, instead of setting uniforms for every draw.
+class ObjectUniformBuffer {
+public:
+    ObjectUniformBuffer(size_t block_size, GLuint binding);
+    ~ObjectUniformBuffer();
+
+    ObjectUniformBuffer(const ObjectUniformBuffer &) = delete;
+    ObjectUniformBuffer &operator=(const ObjectUniformBuffer &) = delete;
+
+    size_t size() const { return num_blocks_; }
+
+    void clear();
+    // Returns the index of the new block
+    size_t add(const void *block);
+
+    template <typename T>
+    size_t add(const T &block) { return add(static_cast<const void *>(&block)); }
+
+    void upload();
+    void bind(size_t index) const;
+
+private:
+    GLuint id_;
+    GLuint binding_;
+    size_t block_size_;
+    // Block size rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    size_t stride_;
+    size_t capacity_;
+    size_t num_blocks_;
+    std::vector<std::byte> data_;
+};
+
+// Buffer texture for arrays too large for a uniform block, read in shaders
+// with texelFetch on a samplerBuffer. Grows as needed; never shrinks.
+class TextureBuffer {
+public:
+    // `format` is the sized internal format of the texels, e.g. GL_RGBA32F
+    explicit TextureBuffer(GLenum format);
+    ~TextureBuffer();
+
+    TextureBuffer(const TextureBuffer &) = delete;
+    TextureBuffer &operator=(const TextureBuffer &) = delete;
+
+    GLuint texture() const { return texture_; }
+
+    // Replaces the contents, orphaning the previous storage
+    void update(const void *data, size_t size);
+
+    void bind(GLuint unit) const;
+
+private:
+    GLuint buffer_;
+    GLuint texture_;
+    size_t capacity_;
+};
@@ -0,0 +1,48 @@
+#version 330 core
+#include "lighting.glsl"
+
+out vec4 FragColor;
+
+// See GBuffer in include/deferred.h
+uniform sampler2D gDepth;
+uniform sampler2D gNormal;
+uniform sampler2D gDiffuse;
+uniform sampler2D gAmbient;
+
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Inverse of encodeNormal in shader/gbuffer.fs
+vec3 decodeNormal(vec2 e) {
+    e = 2.0 * e - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n);
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // Nothing was drawn here
+    if (depth == 1.0) {
+        discard;
+    }
+
+    vec2 viewportPos = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 position = inverseViewProjection * vec4(2.0 * vec3(viewportPos, depth) - 1.0, 1.0);
+    vec3 fragPos = position.xyz / position.w;
+
+    vec4 diffuse = texelFetch(gDiffuse, pixel, 0);
+    vec4 ambient = texelFetch(gAmbient, pixel, 0);
+    Material surface;
+    surface.ambient = ambient.rgb;
+    surface.diffuse = diffuse.rgb;
+    surface.specular = vec3(ambient.a);
+    surface.shininess = 255.0 * diffuse.a;
+
+    vec3 normal = decodeNormal(texelFetch(gNormal, pixel, 0).rg);
+    FragColor = vec4(shade(surface, fragPos, normal, viewportPos), 1.0);
+}
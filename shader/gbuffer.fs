@@ -0,0 +1,47 @@
+#version 330 core
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+in vec3 Normal;
+#ifdef INSTANCED
+flat in vec4 InstanceColor;
+#endif
+
+// See GBuffer in include/deferred.h
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gDiffuse;
+layout (location = 2) out vec4 gAmbient;
+
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
+
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Octahedral encoding: the unit sphere is projected onto an octahedron,
+// whose lower half is folded over the upper one into a square
+vec2 encodeNormal(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return 0.5 * e + 0.5;
+}
+
+void main() {
+    Material surface = material;
+#ifdef INSTANCED
+    surface.ambient = mix(surface.ambient, InstanceColor.rgb, InstanceColor.a);
+    surface.diffuse = mix(surface.diffuse, InstanceColor.rgb, InstanceColor.a);
+#endif
+
+    gNormal = encodeNormal(normalize(Normal));
+    gDiffuse = vec4(surface.diffuse, surface.shininess / 255.0);
+    gAmbient = vec4(surface.ambient, dot(surface.specular, vec3(1.0 / 3.0)));
+}
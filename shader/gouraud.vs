@@ -1,93 +1,38 @@
 #version 330 core
-struct Material {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
-
-struct Light {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    bool blinn;
-};
+#include "lighting.glsl"
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+#ifdef INSTANCED
+layout (location = 2) in mat4 aInstanceModel;
+layout (location = 6) in mat3 aInstanceNormalMatrix;
+layout (location = 9) in vec4 aInstanceColor;
+#endif
 
 out vec3 Color;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat3 normalMatrix;
-
-uniform Material material;
-uniform Light light;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-
-uniform bool shadows;
-uniform samplerCube depthCubemap;
-uniform float far;
-
-float pointShadow(vec3 fragPos, vec3 lightPos, float bias) {
-    if (!shadows) {
-        return 0.0;
-    }
-
-    vec3 fragToLight = fragPos - lightPos;
-    float currentDepth = length(fragToLight);
-    if (currentDepth > far) {
-        return 0.0;
-    }
-
-    float shadowMapDepth = far * texture(depthCubemap, fragToLight).r;
-    float shadow = currentDepth > shadowMapDepth + bias ? 1.0 : 0.0;
-    return shadow;
-}
-
-vec3 illuminate(Material material, Light light, vec3 fragPos, vec3 normal, vec3 viewPos, vec3 lightPos) {
-    vec3 lightDir = normalize(lightPos - fragPos);
-    vec3 viewDir = normalize(viewPos - fragPos);
-    normal = normalize(normal);
-
-    // ambient
-    vec3 ambient = material.ambient * light.ambient;
-
-    // diffuse
-    float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = diff * material.diffuse * light.diffuse;
-
-    // specular
-    float spec = 0.0;
-    if (diff > 0.0) {
-        if (light.blinn) {
-            vec3 halfwayDir = normalize(lightDir + viewDir);
-            spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-        } else {
-            vec3 reflectDir = reflect(-lightDir, normal);
-            spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-        }
-    }
-    vec3 specular = spec * material.specular * light.specular;
-
-    // shadow
-    float bias = max(4.0 * (1.0 - diff), 0.2);
-    float shadow = pointShadow(fragPos, lightPos, bias);
-
-    if (dot(normal, viewDir) < 0) {
-        shadow = 1.0;
-    }
-
-    return ambient + (1.0 - shadow) * (diffuse + specular);
-}
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
 
 void main() {
-    vec3 fragPos = vec3(model * vec4(aPos, 1.0));
-    vec3 normal = normalMatrix * aNormal;
-    Color = illuminate(material, light, fragPos, normal, viewPos, lightPos);
-
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    Material surface = material;
+#ifdef INSTANCED
+    mat4 world = aInstanceModel * model;
+    mat3 worldNormal = aInstanceNormalMatrix * mat3(normalMatrix);
+    surface.ambient = mix(surface.ambient, aInstanceColor.rgb, aInstanceColor.a);
+    surface.diffuse = mix(surface.diffuse, aInstanceColor.rgb, aInstanceColor.a);
+#else
+    mat4 world = model;
+    mat3 worldNormal = mat3(normalMatrix);
+#endif
+
+    vec3 fragPos = vec3(world * vec4(aPos, 1.0));
+    vec3 normal = worldNormal * aNormal;
+    gl_Position = projection * view * world * vec4(aPos, 1.0);
+
+    vec2 viewportPos = 0.5 * gl_Position.xy / max(gl_Position.w, 1e-3) + 0.5;
+    Color = shade(surface, fragPos, normal, viewportPos);
 }
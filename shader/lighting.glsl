@@ -0,0 +1,186 @@
+// Lighting shared by the lit shaders, which pull it in with
+// #include "lighting.glsl" right after #version (see Shader::read_source)
+#ifdef SHADOW_ARRAY
+#extension GL_ARB_texture_cube_map_array : require
+#endif
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+struct Light {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    mat4 inverseViewProjection;
+};
+
+layout (std140) uniform Lighting {
+    Light light;
+    vec3 lightPos;
+    float far;
+    float near;
+    // Size of a shadow map texel at unit distance along the major axis
+    float shadowTexelSize;
+};
+
+#ifdef SHADOWS
+// Depth compared by the texture unit, with 2x2 PCF from linear filtering
+#ifdef SHADOW_ARRAY
+uniform samplerCubeArrayShadow depthCubemap;
+#else
+uniform samplerCubeShadow depthCubemap;
+#endif
+#endif
+
+#ifdef CLUSTERED
+layout (std140) uniform Clusters {
+    // x, y and z cluster counts, total number of lights
+    uvec4 grid;
+    // Depth slice scale and bias for log(depth), 1 / viewport size
+    vec4 params;
+};
+
+// Two texels per light: position and radius, color and shadow slot
+uniform samplerBuffer lightData;
+// Offset and count of each cluster's run in lightIndices
+uniform usamplerBuffer clusterLights;
+uniform usamplerBuffer lightIndices;
+
+int clusterIndex(vec2 viewportPos, vec3 fragPos) {
+    float depth = max(-(view * vec4(fragPos, 1.0)).z, 1e-3);
+    uvec3 cluster = uvec3(clamp(viewportPos, 0.0, 1.0) * vec2(grid.xy), max(log(depth) * params.x + params.y, 0.0));
+    cluster = min(cluster, grid.xyz - 1u);
+    return int((cluster.z * grid.y + cluster.y) * grid.x + cluster.x);
+}
+#endif
+
+#ifdef SHADOWS
+// Depth value of the shadow cube map at a distance along the major axis;
+// each face holds the depth of a 90 degree perspective projection
+float shadowDepth(float distance) {
+    float z = (far + near - 2.0 * near * far / distance) / (far - near);
+    return 0.5 * z + 0.5;
+}
+
+// Lit fraction of a direction from the light, compared against `depth`
+float shadowLit(vec3 fragToLight, int slot, float depth) {
+#ifdef SHADOW_ARRAY
+    return texture(depthCubemap, vec4(fragToLight, float(slot)), depth);
+#else
+    return texture(depthCubemap, vec4(fragToLight, depth));
+#endif
+}
+
+#if defined(PCF20)
+const int kPcfTaps = 20;
+const vec3 kPcfOffsets[20] = vec3[](
+    vec3(1, 1, 1), vec3(1, -1, 1), vec3(-1, -1, 1), vec3(-1, 1, 1),
+    vec3(1, 1, -1), vec3(1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),
+    vec3(1, 1, 0), vec3(1, -1, 0), vec3(-1, -1, 0), vec3(-1, 1, 0),
+    vec3(1, 0, 1), vec3(-1, 0, 1), vec3(1, 0, -1), vec3(-1, 0, -1),
+    vec3(0, 1, 1), vec3(0, -1, 1), vec3(0, -1, -1), vec3(0, 1, -1)
+);
+#elif defined(PCF4)
+// Corners of a tetrahedron
+const int kPcfTaps = 4;
+const vec3 kPcfOffsets[4] = vec3[](
+    vec3(1, 1, 1), vec3(1, -1, -1), vec3(-1, 1, -1), vec3(-1, -1, 1)
+);
+#endif
+#endif
+
+// Lights with a negative slot cast no shadows
+float pointShadow(vec3 fragPos, vec3 lightPos, int slot, float bias) {
+#ifdef SHADOWS
+    vec3 fragToLight = fragPos - lightPos;
+    vec3 distances = abs(fragToLight);
+    float currentDepth = max(distances.x, max(distances.y, distances.z));
+    if (slot < 0 || currentDepth > far) {
+        return 0.0;
+    }
+
+    // Every tap compares the fragment's own depth; offset directions have a
+    // larger major axis distance, which would shadow lit surfaces
+    float depth = shadowDepth(currentDepth - bias);
+#if defined(PCF4) || defined(PCF20)
+    // Taps about 1.5 texels apart at the fragment's distance
+    float radius = 1.5 * shadowTexelSize * currentDepth;
+    float lit = 0.0;
+    for (int i = 0; i < kPcfTaps; ++i) {
+        lit += shadowLit(fragToLight + radius * kPcfOffsets[i], slot, depth);
+    }
+    return 1.0 - lit / float(kPcfTaps);
+#else
+    return 1.0 - shadowLit(fragToLight, slot, depth);
+#endif
+#else
+    return 0.0;
+#endif
+}
+
+// Diffuse and specular light of one light, without ambient
+vec3 illuminate(Material material, vec3 lightDiffuse, vec3 lightSpecular, vec3 fragPos, vec3 normal,
+                vec3 viewDir, vec3 lightPos, int shadowSlot) {
+    vec3 lightDir = normalize(lightPos - fragPos);
+
+    // diffuse
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = diff * material.diffuse * lightDiffuse;
+
+    // specular
+    float spec = 0.0;
+    if (diff > 0.0) {
+#ifdef BLINN
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+#else
+        vec3 reflectDir = reflect(-lightDir, normal);
+        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+#endif
+    }
+    vec3 specular = spec * material.specular * lightSpecular;
+
+    // shadow
+    float bias = max(4.0 * (1.0 - diff), 0.2);
+    float shadow = pointShadow(fragPos, lightPos, shadowSlot, bias);
+
+    return (1.0 - shadow) * (diffuse + specular);
+}
+
+vec3 shade(Material material, vec3 fragPos, vec3 normal, vec2 viewportPos) {
+    vec3 viewDir = normalize(viewPos - fragPos);
+    normal = normalize(normal);
+
+    vec3 result = material.ambient * light.ambient;
+    if (dot(normal, viewDir) < 0) {
+        return result;
+    }
+
+#ifdef CLUSTERED
+    uvec2 range = texelFetch(clusterLights, clusterIndex(viewportPos, fragPos)).rg;
+    for (uint i = 0u; i < range.y; ++i) {
+        int index = int(texelFetch(lightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, 2 * index);
+        vec4 colorSlot = texelFetch(lightData, 2 * index + 1);
+
+        vec3 toLight = positionRadius.xyz - fragPos;
+        float falloff = clamp(1.0 - dot(toLight, toLight) / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        if (falloff > 0.0) {
+            result += falloff * falloff * illuminate(material, colorSlot.rgb, colorSlot.rgb, fragPos, normal,
+                                                     viewDir, positionRadius.xyz, int(colorSlot.w));
+        }
+    }
+#else
+    result += illuminate(material, light.diffuse, light.specular, fragPos, normal, viewDir, lightPos, 0);
+#endif
+    return result;
+}
@@ -1,18 +1,51 @@
 #version 330 core
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+#ifdef INSTANCED
+layout (location = 2) in mat4 aInstanceModel;
+layout (location = 6) in mat3 aInstanceNormalMatrix;
+layout (location = 9) in vec4 aInstanceColor;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
+#ifdef INSTANCED
+flat out vec4 InstanceColor;
+#endif
+
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    // Declared, as in shader/lighting.glsl, so that the stages' blocks match
+    mat4 inverseViewProjection;
+};
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
-uniform mat3 normalMatrix;
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = normalize(normalMatrix * aNormal);
+#ifdef INSTANCED
+    mat4 world = aInstanceModel * model;
+    mat3 worldNormal = aInstanceNormalMatrix * mat3(normalMatrix);
+    InstanceColor = aInstanceColor;
+#else
+    mat4 world = model;
+    mat3 worldNormal = mat3(normalMatrix);
+#endif
+
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = normalize(worldNormal * aNormal);
 
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * world * vec4(aPos, 1.0);
 }
@@ -1,9 +1,5 @@
 #version 330 core
-in vec4 FragPos;
-
-uniform float far;
 
+// Depth comes from the rasterizer, so that early depth testing stays on
 void main() {
-    float lightDistance = length(FragPos.xyz);
-    gl_FragDepth = lightDistance / far;
 }
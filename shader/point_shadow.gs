@@ -2,16 +2,15 @@
 layout (triangles) in;
 layout (triangle_strip, max_vertices = 18) out;
 
-out vec4 FragPos;
-
 uniform mat4 shadowMatrices[6];
+// First layer of the light's cube map, 6 * its slot in a cube map array
+uniform int layer;
 
 void main() {
     for (int face = 0; face < 6; face++) {
-        gl_Layer = face;
+        gl_Layer = layer + face;
         for (int i = 0; i < 3; i++) {
-            FragPos = gl_in[i].gl_Position;
-            gl_Position = shadowMatrices[face] * FragPos;
+            gl_Position = shadowMatrices[face] * gl_in[i].gl_Position;
             EmitVertex();
         }
         EndPrimitive();
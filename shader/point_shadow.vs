@@ -1,9 +1,31 @@
 #version 330 core
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
 layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 2) in mat4 aInstanceModel;
+#endif
 
-uniform mat4 model;
+// Position of the light whose map is drawn
 uniform vec3 lightPos;
 
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
+
 void main() {
-    gl_Position = model * vec4(aPos, 1.0) - vec4(lightPos, 0.0);
+#ifdef INSTANCED
+    mat4 world = aInstanceModel * model;
+#else
+    mat4 world = model;
+#endif
+
+    gl_Position = world * vec4(aPos, 1.0) - vec4(lightPos, 0.0);
 }
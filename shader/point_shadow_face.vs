@@ -0,0 +1,52 @@
+#version 330 core
+#ifdef LAYERED
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+#endif
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 2) in mat4 aInstanceModel;
+#endif
+
+// Position of the light whose map is drawn
+uniform vec3 lightPos;
+
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
+
+#ifdef LAYERED
+uniform mat4 shadowMatrices[6];
+// Cube face of each instance
+uniform int faces[6];
+// First layer of the light's cube map, 6 * its slot in a cube map array
+uniform int layer;
+#else
+uniform mat4 shadowMatrix;
+#endif
+
+void main() {
+#ifdef INSTANCED
+    mat4 world = aInstanceModel * model;
+#else
+    mat4 world = model;
+#endif
+
+    vec4 position = world * vec4(aPos, 1.0) - vec4(lightPos, 0.0);
+#ifdef LAYERED
+    int face = faces[gl_InstanceID];
+    gl_Layer = layer + face;
+    gl_Position = shadowMatrices[face] * position;
+#else
+    gl_Position = shadowMatrix * position;
+#endif
+}
@@ -1,9 +1,20 @@
 #version 330 core
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
 
 out vec4 FragColor;
 
-uniform vec3 objectColor;
+layout (std140) uniform Object {
+    mat4 model;
+    mat4 normalMatrix;
+    Material material;
+};
 
+// Unlit: the diffuse color as is
 void main() {
-    FragColor = vec4(objectColor, 1.0);
+    FragColor = vec4(material.diffuse, 1.0);
 }
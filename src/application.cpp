@@ -1,4 +1,6 @@
 #include "application.h"
+#include "render_stats.h"
+#include "trace.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -72,24 +74,42 @@ int Application::exec() {
         return 1;
     }
 
-    if (int ret = init(); ret != 0) {
-        return ret;
+    {
+        TRACE_SCOPE("init");
+        if (int ret = init(); ret != 0) {
+            return ret;
+        }
     }
 
     // Main loop
     while (!glfwWindowShouldClose(window_)) {
+        TRACE_SCOPE("frame");
         float last_time = time_;
         time_ = (float)glfwGetTime();
         delta_time_ = time_ - last_time;
 
-        process_input();
+        {
+            TRACE_SCOPE("process input");
+            process_input();
+        }
 
-        if (int ret = render(); ret != 0) {
-            return ret;
+        {
+            TRACE_SCOPE("render");
+            RenderStats::begin_frame();
+            if (int ret = render(); ret != 0) {
+                return ret;
+            }
+            RenderStats::end_frame();
         }
 
-        glfwSwapBuffers(window_);
-        glfwPollEvents();
+        {
+            TRACE_SCOPE("swap buffers");
+            glfwSwapBuffers(window_);
+        }
+        {
+            TRACE_SCOPE("poll events");
+            glfwPollEvents();
+        }
     }
 
     return 0;
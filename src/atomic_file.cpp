@@ -0,0 +1,62 @@
+#include "atomic_file.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Unique across the threads and processes that write the same file
+string temp_suffix() {
+    static atomic<unsigned int> counter = 0;
+#ifdef _WIN32
+    auto pid = _getpid();
+#else
+    auto pid = getpid();
+#endif
+    return ".tmp" + to_string(pid) + "-" + to_string(hash<thread::id>()(this_thread::get_id())) + "-" +
+        to_string(counter++);
+}
+
+} // namespace
+
+bool write_file_atomically(const string &path, const function<bool(ostream &)> &write) {
+    fs::path target(path);
+    error_code ec;
+    if (target.has_parent_path()) {
+        fs::create_directories(target.parent_path(), ec);
+    }
+
+    fs::path temp_path = target;
+    temp_path += temp_suffix();
+
+    {
+        ofstream out(temp_path, ios::binary);
+        if (!out.is_open()) {
+            return false;
+        }
+        if (!write(out) || !out.flush()) {
+            out.close();
+            fs::remove(temp_path, ec);
+            return false;
+        }
+    }
+
+    fs::rename(temp_path, target, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,151 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+static Aabb empty_box() {
+    return {glm::vec3(numeric_limits<float>::max()), glm::vec3(numeric_limits<float>::lowest())};
+}
+
+static Aabb merge(const Aabb &lhs, const Aabb &rhs) {
+    return {glm::min(lhs.min, rhs.min), glm::max(lhs.max, rhs.max)};
+}
+
+Aabb Aabb::transformed(const glm::mat4 &matrix) const {
+    // Arvo: accumulate the extremes of each matrix term separately
+    Aabb result = {glm::vec3(matrix[3]), glm::vec3(matrix[3])};
+    for (int i = 0; i < 3; ++i) {
+        glm::vec3 a = glm::vec3(matrix[i]) * min[i];
+        glm::vec3 b = glm::vec3(matrix[i]) * max[i];
+        result.min += glm::min(a, b);
+        result.max += glm::max(a, b);
+    }
+    return result;
+}
+
+void Bvh::build(span<const Aabb> boxes) {
+    boxes_.assign(boxes.begin(), boxes.end());
+    nodes_.clear();
+    objects_.resize(boxes_.size());
+    object_leaves_.assign(boxes_.size(), kNone);
+    for (unsigned int i = 0; i < objects_.size(); ++i) {
+        objects_[i] = i;
+    }
+
+    if (!boxes_.empty()) {
+        nodes_.reserve(2 * boxes_.size());
+        nodes_.push_back({empty_box(), kNone, 0, 0});
+        build_node(0, 0, (unsigned int)objects_.size());
+    }
+}
+
+void Bvh::build_node(unsigned int index, unsigned int begin, unsigned int end) {
+    Aabb box = empty_box();
+    Aabb centroids = empty_box();
+    for (unsigned int i = begin; i < end; ++i) {
+        const Aabb &object = boxes_[objects_[i]];
+        box = merge(box, object);
+        glm::vec3 centroid = 0.5f * (object.min + object.max);
+        centroids = merge(centroids, {centroid, centroid});
+    }
+    nodes_[index].box = box;
+
+    if (end - begin <= kMaxLeafObjects) {
+        nodes_[index].first = begin;
+        nodes_[index].count = end - begin;
+        for (unsigned int i = begin; i < end; ++i) {
+            object_leaves_[objects_[i]] = index;
+        }
+        return;
+    }
+
+    glm::vec3 extent = centroids.max - centroids.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    unsigned int middle = begin + (end - begin) / 2;
+    nth_element(objects_.begin() + begin, objects_.begin() + middle, objects_.begin() + end,
+                [&](unsigned int lhs, unsigned int rhs) {
+                    return boxes_[lhs].min[axis] + boxes_[lhs].max[axis] <
+                        boxes_[rhs].min[axis] + boxes_[rhs].max[axis];
+                });
+
+    // Siblings are allocated together so that the second follows the first
+    unsigned int first = (unsigned int)nodes_.size();
+    nodes_[index].first = first;
+    nodes_.push_back({empty_box(), index, 0, 0});
+    nodes_.push_back({empty_box(), index, 0, 0});
+
+    build_node(first, begin, middle);
+    build_node(first + 1, middle, end);
+}
+
+void Bvh::update(size_t object, const Aabb &box) {
+    boxes_[object] = box;
+    for (unsigned int node = object_leaves_[object]; node != kNone; node = nodes_[node].parent) {
+        Aabb old_box = nodes_[node].box;
+        refit(node);
+
+        // Ancestors already enclose an unchanged box
+        if (nodes_[node].box.min == old_box.min && nodes_[node].box.max == old_box.max) {
+            break;
+        }
+    }
+}
+
+void Bvh::refit(unsigned int index) {
+    Node &node = nodes_[index];
+    if (node.is_leaf()) {
+        node.box = empty_box();
+        for (unsigned int i = node.first; i < node.first + node.count; ++i) {
+            node.box = merge(node.box, boxes_[objects_[i]]);
+        }
+    } else {
+        node.box = merge(nodes_[node.first].box, nodes_[node.first + 1].box);
+    }
+}
+
+void Bvh::append_objects(const Node &node, vector<unsigned int> &visible) const {
+    if (node.is_leaf()) {
+        visible.insert(visible.end(), objects_.begin() + node.first, objects_.begin() + node.first + node.count);
+    } else {
+        append_objects(nodes_[node.first], visible);
+        append_objects(nodes_[node.first + 1], visible);
+    }
+}
+
+size_t Bvh::cull(const Frustum &frustum, vector<unsigned int> &visible) const {
+    if (nodes_.empty()) {
+        return 0;
+    }
+
+    size_t num_tested = 0;
+    unsigned int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node &node = nodes_[stack[--top]];
+        ++num_tested;
+
+        auto containment = frustum.classify_box(node.box.min, node.box.max);
+        if (containment == Frustum::kOutside) {
+            continue;
+        }
+
+        // Everything below a node inside the frustum is visible
+        if (containment == Frustum::kInside) {
+            append_objects(node, visible);
+        } else if (node.is_leaf()) {
+            for (unsigned int i = node.first; i < node.first + node.count; ++i) {
+                const Aabb &box = boxes_[objects_[i]];
+                if (frustum.intersects_box(box.min, box.max)) {
+                    visible.push_back(objects_[i]);
+                }
+            }
+        } else {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+    }
+    return num_tested;
+}
@@ -0,0 +1,139 @@
+#include "clustered_lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+ClusteredLighting::ClusteredLighting()
+    : uniforms_(make_unique<UniformBuffer>(sizeof(ClustersBlock), kClustersBinding)),
+      light_data_(make_unique<TextureBuffer>(GL_RGBA32F)),
+      cluster_lights_(make_unique<TextureBuffer>(GL_RG32UI)),
+      light_indices_(make_unique<TextureBuffer>(GL_R32UI)),
+      clusters_(kNumClusters) {
+}
+
+unsigned int ClusteredLighting::slice(float depth, float near, float far) const {
+    float z = log(glm::clamp(depth, near, far) / near) / log(far / near) * kGridZ;
+    return min((unsigned int)z, kGridZ - 1);
+}
+
+bool ClusteredLighting::cluster_bounds(const PointLight &light, const glm::mat4 &view,
+                                       const glm::mat4 &projection, float near, float far,
+                                       ClusterBounds &bounds) const {
+    glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    float radius = light.radius;
+
+    // The view looks down -z
+    float min_depth = -center.z - radius;
+    float max_depth = -center.z + radius;
+    if (max_depth < near || min_depth > far) {
+        return false;
+    }
+    bounds.min.z = slice(min_depth, near, far);
+    bounds.max.z = slice(max_depth, near, far);
+
+    // Project the corners of the sphere's box, unless it reaches behind the
+    // near plane, where the projection flips
+    glm::vec2 min_ndc(-1.0f);
+    glm::vec2 max_ndc(1.0f);
+    if (min_depth > near) {
+        min_ndc = glm::vec2(1.0f);
+        max_ndc = glm::vec2(-1.0f);
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f,
+                                                          i & 4 ? 1.0f : -1.0f);
+            glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+            min_ndc = glm::min(min_ndc, ndc);
+            max_ndc = glm::max(max_ndc, ndc);
+        }
+        if (max_ndc.x < -1.0f || max_ndc.y < -1.0f || min_ndc.x > 1.0f || min_ndc.y > 1.0f) {
+            return false;
+        }
+    }
+
+    glm::vec2 grid(kGridX, kGridY);
+    glm::vec2 min_tile = glm::clamp((0.5f * min_ndc + 0.5f) * grid, glm::vec2(0.0f), grid - 1.0f);
+    glm::vec2 max_tile = glm::clamp((0.5f * max_ndc + 0.5f) * grid, glm::vec2(0.0f), grid - 1.0f);
+    bounds.min.x = (unsigned int)min_tile.x;
+    bounds.min.y = (unsigned int)min_tile.y;
+    bounds.max.x = (unsigned int)max_tile.x;
+    bounds.max.y = (unsigned int)max_tile.y;
+    return true;
+}
+
+void ClusteredLighting::update(span<const PointLight> lights, const glm::mat4 &view, const glm::mat4 &projection,
+                               float near, float far, int width, int height) {
+    stats_ = {};
+    stats_.lights = lights.size();
+
+    // Two texels per light: position and radius, then color and shadow slot
+    light_texels_.clear();
+    for (const auto &light : lights) {
+        light_texels_.emplace_back(light.position, light.radius);
+        light_texels_.emplace_back(light.color, (float)light.shadow_slot);
+    }
+
+    // Count the lights of each cluster, then place the lists one after
+    // another and fill them
+    bounds_.clear();
+    visible_.clear();
+    fill(clusters_.begin(), clusters_.end(), glm::uvec2(0));
+    for (size_t i = 0; i < lights.size(); ++i) {
+        ClusterBounds bounds;
+        if (!cluster_bounds(lights[i], view, projection, near, far, bounds)) {
+            continue;
+        }
+        bounds_.push_back(bounds);
+        visible_.push_back((int)i);
+
+        for (unsigned int z = bounds.min.z; z <= bounds.max.z; ++z) {
+            for (unsigned int y = bounds.min.y; y <= bounds.max.y; ++y) {
+                for (unsigned int x = bounds.min.x; x <= bounds.max.x; ++x) {
+                    ++clusters_[(z * kGridY + y) * kGridX + x].y;
+                }
+            }
+        }
+    }
+    stats_.visible_lights = visible_.size();
+
+    uint32_t offset = 0;
+    for (auto &cluster : clusters_) {
+        cluster.x = offset;
+        offset += cluster.y;
+        stats_.max_cluster_lights = max<size_t>(stats_.max_cluster_lights, cluster.y);
+        cluster.y = 0;
+    }
+    stats_.light_indices = offset;
+
+    indices_.resize(offset);
+    for (size_t i = 0; i < visible_.size(); ++i) {
+        const ClusterBounds &bounds = bounds_[i];
+        for (unsigned int z = bounds.min.z; z <= bounds.max.z; ++z) {
+            for (unsigned int y = bounds.min.y; y <= bounds.max.y; ++y) {
+                for (unsigned int x = bounds.min.x; x <= bounds.max.x; ++x) {
+                    auto &cluster = clusters_[(z * kGridY + y) * kGridX + x];
+                    indices_[cluster.x + cluster.y++] = (uint32_t)visible_[i];
+                }
+            }
+        }
+    }
+
+    light_data_->update(light_texels_.data(), light_texels_.size() * sizeof(glm::vec4));
+    cluster_lights_->update(clusters_.data(), clusters_.size() * sizeof(glm::uvec2));
+    light_indices_->update(indices_.data(), indices_.size() * sizeof(uint32_t));
+
+    // slice = log(depth) * scale + bias
+    ClustersBlock block{};
+    block.grid = glm::uvec4(kGridX, kGridY, kGridZ, (unsigned int)lights.size());
+    float scale = kGridZ / log(far / near);
+    block.params = glm::vec4(scale, -scale * log(near), 1.0f / width, 1.0f / height);
+    uniforms_->update(block);
+}
+
+void ClusteredLighting::bind() const {
+    light_data_->bind(kLightDataUnit);
+    cluster_lights_->bind(kClusterLightsUnit);
+    light_indices_->bind(kLightIndicesUnit);
+}
@@ -0,0 +1,137 @@
+#include "deferred.h"
+#include "render_stats.h"
+#include "shader_uniforms.h"
+
+using namespace std;
+
+GBuffer::GBuffer() : fbo_(0), textures_(), width_(0), height_(0) {
+    glGenFramebuffers(1, &fbo_);
+    glGenTextures(kNumTargets, textures_);
+
+    // Only read with texelFetch, but without mipmaps the default filter
+    // would leave the textures incomplete
+    for (GLuint texture : textures_) {
+        GlState::bind_texture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    resize(1, 1);
+
+    GlState::bind_framebuffer(fbo_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, textures_[kDepth], 0);
+    for (int i = kNormal; i < kNumTargets; ++i) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i - kNormal, GL_TEXTURE_2D, textures_[i], 0);
+    }
+    const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+    glDrawBuffers(3, draw_buffers);
+    GlState::bind_framebuffer(0);
+}
+
+GBuffer::~GBuffer() {
+    GlState::forget_framebuffer(fbo_);
+    for (GLuint texture : textures_) {
+        GlState::forget_texture(texture);
+    }
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteTextures(kNumTargets, textures_);
+}
+
+void GBuffer::resize(int width, int height) {
+    if (width == width_ && height == height_) {
+        return;
+    }
+    width_ = width;
+    height_ = height;
+
+    struct Format {
+        GLint internal_format;
+        GLenum format;
+        GLenum type;
+    };
+    static const Format formats[kNumTargets] = {
+        {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8},
+        {GL_RG16, GL_RG, GL_UNSIGNED_SHORT},
+        {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE},
+        {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    };
+    for (int i = 0; i < kNumTargets; ++i) {
+        GlState::bind_texture(GL_TEXTURE_2D, textures_[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[i].internal_format, width_, height_, 0, formats[i].format,
+                     formats[i].type, nullptr);
+    }
+}
+
+void GBuffer::bind() const {
+    GlState::bind_framebuffer(fbo_);
+    GlState::viewport(0, 0, width_, height_);
+}
+
+void GBuffer::bind_textures() const {
+    GlState::bind_texture(GL_TEXTURE_2D, textures_[kDepth], kGBufferDepthUnit);
+    GlState::bind_texture(GL_TEXTURE_2D, textures_[kNormal], kGBufferNormalUnit);
+    GlState::bind_texture(GL_TEXTURE_2D, textures_[kDiffuse], kGBufferDiffuseUnit);
+    GlState::bind_texture(GL_TEXTURE_2D, textures_[kAmbient], kGBufferAmbientUnit);
+}
+
+void GBuffer::blit_depth(GLuint fbo) const {
+    GlState::blit_framebuffer(fbo_, fbo, width_, height_, GL_DEPTH_BUFFER_BIT);
+}
+
+DeferredRenderer::DeferredRenderer()
+    : geometry_variants_(make_lit_variants("shader/phong.vs", "shader/gbuffer.fs")),
+      lighting_variants_(make_lit_variants("shader/deferred.vs", "shader/deferred.fs")),
+      vao_(0) {
+    // Every pixel is covered once; depth is only read, as a texture
+    lighting_raster_.depth_test = false;
+
+    glGenVertexArrays(1, &vao_);
+}
+
+DeferredRenderer::~DeferredRenderer() {
+    GlState::forget_vertex_array(vao_);
+    glDeleteVertexArrays(1, &vao_);
+}
+
+void DeferredRenderer::prepare(uint32_t features) {
+    geometry_variants_->prepare(features & kInstancedFeature);
+    lighting_variants_->prepare(features & ~kInstancedFeature);
+}
+
+void DeferredRenderer::begin_geometry_pass(int width, int height) {
+    gbuffer_.resize(width, height);
+    gbuffer_.bind();
+
+    // Pixels left at the far plane are skipped by the lighting pass, so the
+    // color targets need no clearing
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+bool DeferredRenderer::bind_geometry_pipeline(bool instanced, const RasterState &raster) {
+    const ShaderProgram *program = geometry_variants_->get(instanced ? kInstancedFeature : 0u);
+    if (!program) {
+        return false;
+    }
+    GlState::bind(PipelineState(*program, raster));
+    return true;
+}
+
+bool DeferredRenderer::light(uint32_t features, GLuint fbo) {
+    const ShaderProgram *program = lighting_variants_->get(features & ~kInstancedFeature);
+    if (!program) {
+        return false;
+    }
+
+    GlState::bind_framebuffer(fbo);
+    GlState::viewport(0, 0, gbuffer_.width(), gbuffer_.height());
+    gbuffer_.bind_textures();
+    GlState::bind(PipelineState(*program, lighting_raster_));
+    GlState::bind_vertex_array(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    RenderStats::count_draw(GL_TRIANGLES, 3);
+
+    gbuffer_.blit_depth(fbo);
+    return true;
+}
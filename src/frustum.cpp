@@ -0,0 +1,66 @@
+#include "frustum.h"
+
+Frustum::Frustum(const glm::mat4 &matrix) {
+    // Gribb and Hartmann: each plane is the fourth row plus or minus another
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i) {
+        row[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+    }
+
+    planes_[0] = row[3] + row[0]; // left
+    planes_[1] = row[3] - row[0]; // right
+    planes_[2] = row[3] + row[1]; // bottom
+    planes_[3] = row[3] - row[1]; // top
+    planes_[4] = row[3] + row[2]; // near
+    planes_[5] = row[3] - row[2]; // far
+
+    // Normalize so that sphere tests measure distances
+    for (auto &plane : planes_) {
+        float length = glm::length(glm::vec3(plane));
+        if (length > 0.0f) {
+            plane /= length;
+        }
+    }
+}
+
+bool Frustum::intersects_sphere(glm::vec3 center, float radius) const {
+    for (const auto &plane : planes_) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersects_box(glm::vec3 min, glm::vec3 max) const {
+    for (const auto &plane : planes_) {
+        // The corner furthest along the plane normal
+        glm::vec3 corner(plane.x >= 0.0f ? max.x : min.x,
+                         plane.y >= 0.0f ? max.y : min.y,
+                         plane.z >= 0.0f ? max.z : min.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Frustum::Containment Frustum::classify_box(glm::vec3 min, glm::vec3 max) const {
+    Containment result = kInside;
+    for (const auto &plane : planes_) {
+        glm::vec3 normal(plane);
+        glm::vec3 furthest(normal.x >= 0.0f ? max.x : min.x,
+                           normal.y >= 0.0f ? max.y : min.y,
+                           normal.z >= 0.0f ? max.z : min.z);
+        glm::vec3 nearest(normal.x >= 0.0f ? min.x : max.x,
+                          normal.y >= 0.0f ? min.y : max.y,
+                          normal.z >= 0.0f ? min.z : max.z);
+        if (glm::dot(normal, furthest) + plane.w < 0.0f) {
+            return kOutside;
+        }
+        if (glm::dot(normal, nearest) + plane.w < 0.0f) {
+            result = kIntersects;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,363 @@
+#include "geometry_heap.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// Resizes a buffer keeping its name, so that vertex arrays referencing it
+// stay valid, and its first `used` bytes
+void resize_buffer(GLuint buffer, size_t used, size_t size) {
+    GLuint temp;
+    glGenBuffers(1, &temp);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+    if (used > 0) {
+        glBufferData(GL_COPY_WRITE_BUFFER, used, nullptr, GL_STATIC_COPY);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+    }
+    glBufferData(GL_COPY_READ_BUFFER, size, nullptr, GL_STATIC_DRAW);
+    if (used > 0) {
+        glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, used);
+    }
+    glDeleteBuffers(1, &temp);
+}
+
+// Copies byte ranges of a buffer, in order, to its start. Source and
+// destination may overlap, so the data goes through a temporary buffer.
+void compact_buffer(GLuint buffer, span<const pair<size_t, size_t>> ranges) {
+    size_t total = 0;
+    for (const auto &range : ranges) {
+        total += range.second;
+    }
+    if (total == 0) {
+        return;
+    }
+
+    GLuint temp;
+    glGenBuffers(1, &temp);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+    glBufferData(GL_COPY_WRITE_BUFFER, total, nullptr, GL_STATIC_COPY);
+
+    size_t offset = 0;
+    for (const auto &[source, size] : ranges) {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source, offset, size);
+        offset += size;
+    }
+    glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, total);
+    glDeleteBuffers(1, &temp);
+}
+
+void upload(GLuint buffer, size_t offset, span<const byte> data) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, data.size(), data.data());
+    RenderStats::count_buffer_upload(data.size());
+}
+
+} // namespace
+
+RangeAllocator::RangeAllocator(size_t capacity)
+    : capacity_(capacity), used_(0) {
+    if (capacity_ > 0) {
+        free_blocks_.emplace(0, capacity_);
+    }
+}
+
+size_t RangeAllocator::allocate(size_t size) {
+    if (size == 0) {
+        return kInvalid;
+    }
+
+    for (auto it = free_blocks_.begin(); it != free_blocks_.end(); ++it) {
+        auto [offset, block_size] = *it;
+        if (block_size < size) {
+            continue;
+        }
+        free_blocks_.erase(it);
+        if (block_size > size) {
+            free_blocks_.emplace(offset + size, block_size - size);
+        }
+        used_ += size;
+        return offset;
+    }
+    return kInvalid;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+    used_ -= size;
+    auto next = free_blocks_.lower_bound(offset);
+
+    // Merge with the following block
+    if (next != free_blocks_.end() && offset + size == next->first) {
+        size += next->second;
+        next = free_blocks_.erase(next);
+    }
+
+    // Merge with the preceding block
+    if (next != free_blocks_.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    free_blocks_.emplace_hint(next, offset, size);
+}
+
+void RangeAllocator::grow(size_t capacity) {
+    if (capacity <= capacity_) {
+        return;
+    }
+
+    size_t added = capacity - capacity_;
+    if (!free_blocks_.empty()) {
+        auto last = std::prev(free_blocks_.end());
+        if (last->first + last->second == capacity_) {
+            last->second += added;
+            capacity_ = capacity;
+            return;
+        }
+    }
+    free_blocks_.emplace(capacity_, added);
+    capacity_ = capacity;
+}
+
+void RangeAllocator::reset(size_t used) {
+    free_blocks_.clear();
+    if (used < capacity_) {
+        free_blocks_.emplace(used, capacity_ - used);
+    }
+    used_ = used;
+}
+
+size_t RangeAllocator::largest_free_block() const {
+    size_t largest = 0;
+    for (const auto &block : free_blocks_) {
+        largest = max(largest, block.second);
+    }
+    return largest;
+}
+
+float RangeAllocator::fragmentation() const {
+    size_t free = capacity_ - used_;
+    return free > 0 ? 1.0f - (float)largest_free_block() / free : 0.0f;
+}
+
+void print_geometry_heap_stats(ostream &out, const GeometryHeapStats &stats) {
+    auto percent = [](size_t used, size_t capacity) {
+        return capacity > 0 ? 100.0 * used / capacity : 0.0;
+    };
+
+    ostringstream line;
+    line << fixed << setprecision(1) << "Geometry heap: " << stats.num_allocations << " meshes, vertices "
+         << stats.vertex_used << "/" << stats.vertex_capacity << " (" << percent(stats.vertex_used, stats.vertex_capacity)
+         << "% used, " << 100.0f * stats.vertex_fragmentation << "% fragmented), indices "
+         << stats.index_used << "/" << stats.index_capacity << " (" << percent(stats.index_used, stats.index_capacity)
+         << "% used, " << 100.0f * stats.index_fragmentation << "% fragmented), "
+         << stats.num_grows << " grows, " << stats.num_defragmentations << " defragmentations\n";
+    out << line.str();
+}
+
+GeometryHeap::GeometryHeap(VertexFormat format, size_t initial_vertices, size_t initial_indices)
+    : format_(format),
+      vertex_size_(vertex_size(format)),
+      position_size_(position_size(format)),
+      vertex_allocator_(initial_vertices),
+      index_allocator_(initial_indices),
+      num_grows_(0),
+      num_defragmentations_(0) {
+    glGenBuffers(1, &vbo_);
+    glGenBuffers(1, &position_vbo_);
+    glGenBuffers(1, &ebo_);
+    resize_buffer(vbo_, 0, initial_vertices * vertex_size_);
+    resize_buffer(position_vbo_, 0, initial_vertices * position_size_);
+    resize_buffer(ebo_, 0, initial_indices * sizeof(uint16_t));
+
+    glGenVertexArrays(1, &vao_);
+    glGenVertexArrays(1, &depth_vao_);
+    attach(vao_, false);
+    attach(depth_vao_, true);
+}
+
+GeometryHeap::~GeometryHeap() {
+    GlState::forget_vertex_array(vao_);
+    GlState::forget_vertex_array(depth_vao_);
+    glDeleteVertexArrays(1, &vao_);
+    glDeleteVertexArrays(1, &depth_vao_);
+    glDeleteBuffers(1, &vbo_);
+    glDeleteBuffers(1, &position_vbo_);
+    glDeleteBuffers(1, &ebo_);
+}
+
+void GeometryHeap::attach(GLuint vao, bool positions_only) const {
+    GlState::bind_vertex_array(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, positions_only ? position_vbo_ : vbo_);
+    set_vertex_attributes(format_, positions_only);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+    GlState::bind_vertex_array(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryHeap::reserve(size_t num_vertices, size_t num_indices) {
+    size_t vertex_capacity = vertex_allocator_.capacity();
+    if (vertex_allocator_.largest_free_block() < num_vertices) {
+        size_t capacity = max(2 * vertex_capacity, vertex_capacity + num_vertices);
+        resize_buffer(vbo_, vertex_capacity * vertex_size_, capacity * vertex_size_);
+        resize_buffer(position_vbo_, vertex_capacity * position_size_, capacity * position_size_);
+        vertex_allocator_.grow(capacity);
+        ++num_grows_;
+    }
+
+    size_t index_capacity = index_allocator_.capacity();
+    if (index_allocator_.largest_free_block() < num_indices) {
+        size_t capacity = max(2 * index_capacity, index_capacity + num_indices);
+        resize_buffer(ebo_, index_capacity * sizeof(uint16_t), capacity * sizeof(uint16_t));
+        index_allocator_.grow(capacity);
+        ++num_grows_;
+    }
+}
+
+GeometryHeap::Handle GeometryHeap::allocate(span<const byte> vertices, span<const byte> positions,
+                                            size_t num_vertices, span<const uint16_t> indices) {
+    reserve(num_vertices, indices.size());
+
+    Allocation allocation;
+    allocation.first_vertex = vertex_allocator_.allocate(num_vertices);
+    allocation.num_vertices = num_vertices;
+    allocation.first_index = index_allocator_.allocate(indices.size());
+    allocation.num_indices = indices.size();
+
+    upload(vbo_, allocation.first_vertex * vertex_size_, vertices);
+    upload(position_vbo_, allocation.first_vertex * position_size_, positions);
+    upload(ebo_, allocation.first_index * sizeof(uint16_t), as_bytes(indices));
+
+    Handle handle;
+    if (!free_handles_.empty()) {
+        handle = free_handles_.back();
+        free_handles_.pop_back();
+        allocations_[handle] = allocation;
+        live_[handle] = true;
+    } else {
+        handle = (Handle)allocations_.size();
+        allocations_.push_back(allocation);
+        live_.push_back(true);
+    }
+    return handle;
+}
+
+void GeometryHeap::free(Handle handle) {
+    const auto &allocation = allocations_[handle];
+    vertex_allocator_.free(allocation.first_vertex, allocation.num_vertices);
+    index_allocator_.free(allocation.first_index, allocation.num_indices);
+    live_[handle] = false;
+    free_handles_.push_back(handle);
+
+    bool fragmented = vertex_allocator_.fragmentation() > kDefragmentThreshold ||
+        index_allocator_.fragmentation() > kDefragmentThreshold;
+    if (fragmented) {
+        defragment();
+    }
+}
+
+void GeometryHeap::defragment() {
+    vector<Handle> live;
+    for (Handle handle = 0; handle < allocations_.size(); ++handle) {
+        if (live_[handle]) {
+            live.push_back(handle);
+        }
+    }
+
+    // Vertices and positions share offsets
+    sort(live.begin(), live.end(), [&](Handle lhs, Handle rhs) {
+        return allocations_[lhs].first_vertex < allocations_[rhs].first_vertex;
+    });
+    vector<pair<size_t, size_t>> vertex_ranges, position_ranges;
+    size_t first_vertex = 0;
+    for (Handle handle : live) {
+        auto &allocation = allocations_[handle];
+        vertex_ranges.emplace_back(allocation.first_vertex * vertex_size_, allocation.num_vertices * vertex_size_);
+        position_ranges.emplace_back(allocation.first_vertex * position_size_, allocation.num_vertices * position_size_);
+        allocation.first_vertex = first_vertex;
+        first_vertex += allocation.num_vertices;
+    }
+    compact_buffer(vbo_, vertex_ranges);
+    compact_buffer(position_vbo_, position_ranges);
+    vertex_allocator_.reset(first_vertex);
+
+    // Indices are relative to the base vertex, so they move unchanged
+    sort(live.begin(), live.end(), [&](Handle lhs, Handle rhs) {
+        return allocations_[lhs].first_index < allocations_[rhs].first_index;
+    });
+    vector<pair<size_t, size_t>> index_ranges;
+    size_t first_index = 0;
+    for (Handle handle : live) {
+        auto &allocation = allocations_[handle];
+        index_ranges.emplace_back(allocation.first_index * sizeof(uint16_t), allocation.num_indices * sizeof(uint16_t));
+        allocation.first_index = first_index;
+        first_index += allocation.num_indices;
+    }
+    compact_buffer(ebo_, index_ranges);
+    index_allocator_.reset(first_index);
+
+    ++num_defragmentations_;
+}
+
+GeometryHeapStats GeometryHeap::stats() const {
+    GeometryHeapStats stats;
+    stats.num_allocations = allocations_.size() - free_handles_.size();
+    stats.vertex_capacity = vertex_allocator_.capacity();
+    stats.vertex_used = vertex_allocator_.used();
+    stats.index_capacity = index_allocator_.capacity();
+    stats.index_used = index_allocator_.used();
+    stats.vertex_fragmentation = vertex_allocator_.fragmentation();
+    stats.index_fragmentation = index_allocator_.fragmentation();
+    stats.num_grows = num_grows_;
+    stats.num_defragmentations = num_defragmentations_;
+    return stats;
+}
+
+void DrawBatch::clear() {
+    counts_.clear();
+    offsets_.clear();
+    base_vertices_.clear();
+    batch_end_ = 0;
+}
+
+void DrawBatch::add(GeometryHeap::Handle handle, size_t first_index, size_t num_indices) {
+    if (num_indices == 0) {
+        return;
+    }
+
+    const auto &allocation = heap_->allocation(handle);
+    size_t begin = allocation.first_index + first_index;
+    GLint base_vertex = (GLint)allocation.first_vertex;
+
+    if (!counts_.empty() && batch_end_ == begin && base_vertices_.back() == base_vertex) {
+        counts_.back() += (GLsizei)num_indices;
+    } else {
+        counts_.push_back((GLsizei)num_indices);
+        offsets_.push_back((const void *)(begin * sizeof(uint16_t)));
+        base_vertices_.push_back(base_vertex);
+    }
+    batch_end_ = begin + num_indices;
+}
+
+void DrawBatch::submit(bool depth) const {
+    if (counts_.empty()) {
+        return;
+    }
+
+    GlState::bind_vertex_array(depth ? heap_->depth_vao() : heap_->vao());
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts_.data(), GeometryHeap::index_type(),
+                                  offsets_.data(), (GLsizei)counts_.size(), base_vertices_.data());
+    RenderStats::count_draw(GL_TRIANGLES, accumulate(counts_.begin(), counts_.end(), size_t(0)));
+}
@@ -0,0 +1,175 @@
+#include "gl_state.h"
+#include "render_stats.h"
+#include "shader.h"
+
+using namespace std;
+
+namespace {
+
+void set_capability(GLenum capability, bool enabled) {
+    if (enabled) {
+        glEnable(capability);
+    } else {
+        glDisable(capability);
+    }
+}
+
+} // namespace
+
+template <typename T>
+bool GlState::change(T &tracked, const T &value) {
+    if (tracked == value) {
+        RenderStats::count_state_calls_avoided();
+        return false;
+    }
+    tracked = value;
+    RenderStats::count_state_calls();
+    return true;
+}
+
+void GlState::use_program(GLuint program) {
+    if (change(program_, program)) {
+        glUseProgram(program);
+        RenderStats::count_program_bind();
+    }
+}
+
+void GlState::bind_vertex_array(GLuint vao) {
+    if (change(vertex_array_, vao)) {
+        glBindVertexArray(vao);
+        RenderStats::count_vertex_array_bind();
+    }
+}
+
+void GlState::bind_framebuffer(GLuint fbo) {
+    if (change(framebuffer_, fbo)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+}
+
+void GlState::bind_texture(GLenum target, GLuint texture, GLuint unit) {
+    if (unit >= kMaxTextureUnits) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        RenderStats::count_texture_bind();
+        active_texture_unit_ = unit;
+        RenderStats::count_state_calls(2);
+        return;
+    }
+
+    auto &binding = textures_[unit];
+    if (binding.target == target && binding.texture == texture) {
+        RenderStats::count_state_calls_avoided();
+        return;
+    }
+    if (change(active_texture_unit_, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    glBindTexture(target, texture);
+    RenderStats::count_texture_bind();
+    binding = {target, texture};
+    RenderStats::count_state_calls();
+}
+
+void GlState::blit_framebuffer(GLuint src, GLuint dst, int width, int height, GLbitfield mask) {
+    // Only GL_FRAMEBUFFER, which sets both bindings, is tracked, so the read
+    // binding is restored after the blit
+    bind_framebuffer(dst);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, mask, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dst);
+    RenderStats::count_state_calls(2);
+}
+
+void GlState::viewport(int x, int y, int width, int height) {
+    if (change(viewport_, array<int, 4>{x, y, width, height})) {
+        glViewport(x, y, width, height);
+    }
+}
+
+void GlState::set_raster(const RasterState &raster) {
+    // Unknown state is set in full
+    bool known = raster_.has_value();
+    RasterState &current = known ? *raster_ : raster_.emplace(raster);
+
+    auto update = [&](auto member, auto &&apply) {
+        if (known && current.*member == raster.*member) {
+            RenderStats::count_state_calls_avoided();
+            return;
+        }
+        current.*member = raster.*member;
+        apply();
+        RenderStats::count_state_calls();
+    };
+
+    update(&RasterState::polygon_mode, [&] { glPolygonMode(GL_FRONT_AND_BACK, raster.polygon_mode); });
+    update(&RasterState::depth_test, [&] { set_capability(GL_DEPTH_TEST, raster.depth_test); });
+    update(&RasterState::depth_write, [&] { glDepthMask(raster.depth_write ? GL_TRUE : GL_FALSE); });
+    update(&RasterState::depth_func, [&] { glDepthFunc(raster.depth_func); });
+    update(&RasterState::cull_face, [&] { set_capability(GL_CULL_FACE, raster.cull_face); });
+    update(&RasterState::cull_mode, [&] { glCullFace(raster.cull_mode); });
+    update(&RasterState::blend, [&] { set_capability(GL_BLEND, raster.blend); });
+
+    // Both factors are set by one call
+    if (known && current.blend_src == raster.blend_src && current.blend_dst == raster.blend_dst) {
+        RenderStats::count_state_calls_avoided();
+    } else {
+        current.blend_src = raster.blend_src;
+        current.blend_dst = raster.blend_dst;
+        glBlendFunc(raster.blend_src, raster.blend_dst);
+        RenderStats::count_state_calls();
+    }
+}
+
+void GlState::bind(const PipelineState &pipeline) {
+    use_program(pipeline.program().id());
+    set_raster(pipeline.raster());
+}
+
+void GlState::forget_program(GLuint program) {
+    if (program_ == program) {
+        program_ = kUnknown;
+    }
+}
+
+void GlState::forget_vertex_array(GLuint vao) {
+    // Deleting the bound vertex array binds 0
+    if (vertex_array_ == vao) {
+        vertex_array_ = kUnknown;
+    }
+}
+
+void GlState::forget_framebuffer(GLuint fbo) {
+    if (framebuffer_ == fbo) {
+        framebuffer_ = kUnknown;
+    }
+}
+
+void GlState::forget_texture(GLuint texture) {
+    for (auto &binding : textures_) {
+        if (binding.texture == texture) {
+            binding = {GL_NONE, kUnknown};
+        }
+    }
+}
+
+void GlState::invalidate() {
+    program_ = kUnknown;
+    vertex_array_ = kUnknown;
+    framebuffer_ = kUnknown;
+    active_texture_unit_ = kUnknown;
+    textures_.fill({GL_NONE, kUnknown});
+    viewport_ = {-1, -1, -1, -1};
+    raster_.reset();
+}
+
+bool has_gl_extension(string_view name) {
+    int num_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (int i = 0; i < num_extensions; ++i) {
+        if (reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i)) == name) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,180 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+GpuProfiler::Scope::Scope(GpuProfiler *profiler, const char *name) : profiler_(profiler) {
+    if (profiler_) {
+        profiler_->begin(name);
+    }
+}
+
+GpuProfiler::Scope::~Scope() {
+    if (profiler_) {
+        profiler_->end();
+    }
+}
+
+GpuProfiler::GpuProfiler() : current_(nullptr), frame_number_(0), dropped_frames_(0) {
+}
+
+GpuProfiler::~GpuProfiler() {
+    for (Frame &frame : frames_) {
+        glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+    }
+}
+
+bool GpuProfiler::open_csv(const string &path) {
+    csv_.open(path);
+    if (!csv_.is_open()) {
+        cerr << "ERROR::GPU_PROFILER::CSV_NOT_WRITABLE\nFILE: " << path << endl;
+        return false;
+    }
+    csv_ << "frame,pass,ms\n";
+    return true;
+}
+
+void GpuProfiler::begin_frame() {
+    current_ = &frames_[frame_number_ % kFramesInFlight];
+    if (current_->pending) {
+        collect(*current_);
+    }
+
+    current_->number = frame_number_;
+    current_->used = 0;
+    current_->markers.clear();
+    open_markers_.clear();
+}
+
+void GpuProfiler::end_frame() {
+    current_->pending = !current_->markers.empty();
+    current_ = nullptr;
+    ++frame_number_;
+}
+
+void GpuProfiler::begin(const char *name) {
+    int pass = find_pass(name, (int)open_markers_.size());
+    open_markers_.push_back(current_->markers.size());
+    current_->markers.push_back({pass, timestamp(*current_), 0});
+}
+
+void GpuProfiler::end() {
+    current_->markers[open_markers_.back()].end = timestamp(*current_);
+    open_markers_.pop_back();
+}
+
+size_t GpuProfiler::timestamp(Frame &frame) {
+    if (frame.used == frame.queries.size()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        frame.queries.push_back(query);
+    }
+    glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+    return frame.used++;
+}
+
+int GpuProfiler::find_pass(const char *name, int depth) {
+    for (size_t i = 0; i < passes_.size(); ++i) {
+        if (passes_[i].name == name) {
+            return (int)i;
+        }
+    }
+    passes_.push_back({name, depth, {}, 0});
+    return (int)passes_.size() - 1;
+}
+
+void GpuProfiler::collect(Frame &frame) {
+    frame.pending = false;
+
+    // Queries complete in order, so the last one being available means all are
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        ++dropped_frames_;
+        return;
+    }
+
+    // Scopes of a pass that ran more than once in the frame add up
+    frame_ms_.assign(passes_.size(), -1.0);
+    for (const Marker &marker : frame.markers) {
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(frame.queries[marker.begin], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[marker.end], GL_QUERY_RESULT, &end);
+        double &ms = frame_ms_[marker.pass];
+        ms = max(ms, 0.0) + (end - begin) / 1e6;
+    }
+
+    for (size_t i = 0; i < passes_.size(); ++i) {
+        if (frame_ms_[i] < 0.0) {
+            continue;
+        }
+        Pass &pass = passes_[i];
+        if (pass.history.size() < kHistory) {
+            pass.history.push_back(frame_ms_[i]);
+        } else {
+            pass.history[pass.next] = frame_ms_[i];
+        }
+        pass.next = (pass.next + 1) % kHistory;
+
+        if (csv_.is_open()) {
+            csv_ << frame.number << "," << pass.name << "," << frame_ms_[i] << "\n";
+        }
+    }
+}
+
+vector<GpuProfiler::PassStats> GpuProfiler::stats() const {
+    vector<PassStats> stats;
+    vector<double> sorted;
+    for (const Pass &pass : passes_) {
+        if (pass.history.empty()) {
+            continue;
+        }
+        sorted = pass.history;
+        sort(sorted.begin(), sorted.end());
+
+        PassStats pass_stats{pass.name, pass.depth, sorted.size(), sorted.front(), 0.0, 0.0};
+        for (double ms : sorted) {
+            pass_stats.avg_ms += ms;
+        }
+        pass_stats.avg_ms /= sorted.size();
+        size_t p99 = (size_t)ceil(0.99 * sorted.size()) - 1;
+        pass_stats.p99_ms = sorted[p99];
+        stats.push_back(pass_stats);
+    }
+    return stats;
+}
+
+void GpuProfiler::print(ostream &out) const {
+    // Formatted apart, so that the caller's stream keeps its flags
+    ostringstream report;
+    report << "GPU passes, last " << kHistory << " frames (min / avg / p99 ms):\n";
+    for (const PassStats &pass : stats()) {
+        report << "  " << left << setw(16) << string(2 * pass.depth, ' ') + pass.name << right << fixed
+               << setprecision(3) << setw(8) << pass.min_ms << setw(8) << pass.avg_ms << setw(8) << pass.p99_ms
+               << "\n";
+    }
+    if (dropped_frames_ > 0) {
+        report << "  " << dropped_frames_ << " frame(s) dropped, results not ready in time\n";
+    }
+    out << report.str() << flush;
+}
+
+string GpuProfiler::summary() const {
+    ostringstream out;
+    out << fixed << setprecision(2);
+    const char *separator = "";
+    for (const PassStats &pass : stats()) {
+        if (pass.depth == 0) {
+            out << separator << pass.name << " " << pass.avg_ms;
+            separator = ", ";
+        }
+    }
+    out << " ms";
+    return out.str();
+}
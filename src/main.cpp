@@ -1,5 +1,10 @@
 #include "scene_demo.h"
 #include "simple_renderer.h"
+#include "mesh_cache.h"
+#include "options.h"
+#include "program_cache.h"
+#include "render_stats.h"
+#include "trace.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,6 +18,25 @@ void error_callback(int error, const char* description) {
 }
 
 int main(int argc, char* argv[]) {
+    Options options;
+    if (!options.parse(argc, argv)) {
+        return 1;
+    }
+
+    MeshCache::set_enabled(options.mesh_cache);
+    MeshCache::set_directory(options.mesh_cache_dir);
+    ProgramCache::set_enabled(options.program_cache);
+    ProgramCache::set_directory(options.program_cache_dir);
+
+    string trace_file = options.trace_file;
+    if (!trace_file.empty()) {
+        Trace::start();
+        Trace::set_thread_name("main");
+    }
+    if (!options.frame_stats_file.empty() && !RenderStats::open_dump(options.frame_stats_file)) {
+        return 1;
+    }
+
     glfwSetErrorCallback(error_callback);
 
     if (!glfwInit()) {
@@ -26,22 +50,22 @@ int main(int argc, char* argv[]) {
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
     unique_ptr<Application> app;
-    if (argc > 1) {
+    if (!options.obj_files.empty()) {
         // OBJ files are provided, launch simple renderer
-        vector<string> obj_files;
-        obj_files.reserve(argc - 1);
-        for (int i = 1; i < argc; ++i) {
-            obj_files.emplace_back(argv[i]);
-        }
-        app = make_unique<SimpleRenderer>(std::move(obj_files));
+        app = make_unique<SimpleRenderer>(std::move(options));
     } else {
         // Otherwise, launch scene demo
-        app = make_unique<SceneDemo>();
+        app = make_unique<SceneDemo>(std::move(options));
     }
 
     int ret = app->exec();
     app.reset();
 
+    // After the application, which joins the threads of its scopes
+    if (!trace_file.empty() && Trace::write(trace_file)) {
+        cout << "Trace: " << Trace::num_events() << " event(s) written to " << trace_file << endl;
+    }
+
     glfwTerminate();
     return ret;
 }
@@ -1,14 +1,207 @@
 #include "mesh.h"
+#include "frustum.h"
+#include "geometry_heap.h"
+#include "gl_state.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "obj_reader.h"
+#include "render_stats.h"
+#include "trace.h"
 
+#include <glm/gtc/matrix_transform.hpp>
 #include <OpenMesh/Core/IO/MeshIO.hh>
 #include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string_view>
 
 using namespace std;
 
 using OpenMesh_TriMesh = OpenMesh::TriMesh_ArrayKernelT<>;
 
-bool BasicMesh::load(const char *filename) {
+namespace {
+
+struct CompactVertex {
+    uint16_t position[3];
+    uint16_t padding;
+    uint32_t normal;
+};
+static_assert(sizeof(CompactVertex) == 12);
+
+struct CompactPosition {
+    uint16_t position[3];
+    uint16_t padding;
+};
+
+// Per-instance vertex attributes; matrices take one location per column
+struct Instance {
+    glm::mat4 model;
+    glm::mat3 normal_matrix;
+    glm::vec4 color;
+};
+
+constexpr GLuint kInstanceModelLocation = 2;
+constexpr GLuint kInstanceNormalMatrixLocation = 6;
+constexpr GLuint kInstanceColorLocation = 9;
+
+uint16_t quantize_unorm16(float value) {
+    return (uint16_t)lroundf(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Packs a unit vector into the x, y and z fields of GL_INT_2_10_10_10_REV
+uint32_t pack_snorm10(glm::vec3 v) {
+    uint32_t packed = 0;
+    for (int i = 0; i < 3; ++i) {
+        int value = (int)lroundf(glm::clamp(v[i], -1.0f, 1.0f) * 511.0f);
+        packed |= ((uint32_t)value & 0x3ff) << (10 * i);
+    }
+    return packed;
+}
+
+glm::vec3 unpack_snorm10(uint32_t packed) {
+    glm::vec3 v;
+    for (int i = 0; i < 3; ++i) {
+        // Sign-extend the 10-bit field
+        int value = (int)((packed >> (10 * i)) & 0x3ff);
+        value = value >= 512 ? value - 1024 : value;
+        v[i] = glm::max(value / 511.0f, -1.0f);
+    }
+    return v;
+}
+
+float angle_degrees(glm::vec3 a, glm::vec3 b) {
+    float la = glm::length(a);
+    float lb = glm::length(b);
+    if (la == 0.0f || lb == 0.0f) {
+        return 0.0f;
+    }
+    return glm::degrees(acosf(glm::clamp(glm::dot(a, b) / (la * lb), -1.0f, 1.0f)));
+}
+
+} // namespace
+
+void print_vertex_format_stats(ostream &out, string_view name, const VertexFormatStats &stats) {
+    double saved = stats.float_bytes > 0 ? 100.0 * (1.0 - (double)stats.bytes / stats.float_bytes) : 0.0;
+
+    ostringstream line;
+    line << fixed << setprecision(1) << name << ": "
+         << stats.float_bytes / 1024.0 << " KB -> " << stats.bytes / 1024.0 << " KB ("
+         << saved << "% saved), max position error " << scientific << setprecision(2)
+         << stats.max_position_error << ", max normal error " << fixed << stats.max_normal_error
+         << " deg\n";
+    out << line.str();
+}
+
+static bool has_obj_extension(string_view filename) {
+    if (filename.size() < 4) {
+        return false;
+    }
+    string_view ext = filename.substr(filename.size() - 4);
+    return ext[0] == '.' &&
+        tolower(ext[1]) == 'o' && tolower(ext[2]) == 'b' && tolower(ext[3]) == 'j';
+}
+
+bool BasicMesh::load(const char *filename, const MeshLoadOptions &options) {
+    TRACE_SCOPE("load mesh");
+    uint32_t cache_flags = MeshCache::flags(options);
+
+    string cache_file;
+    if (MeshCache::enabled()) {
+        cache_file = MeshCache::cache_path(filename);
+        if (MeshCache::read(cache_file.c_str(), filename, cache_flags, *this)) {
+            return true;
+        }
+    }
+
+    error_code ec;
+    if (!filesystem::exists(filename, ec)) {
+        cerr << "ERROR::MESH::FILE_NOT_FOUND\nFILE: " << filename << endl;
+        return false;
+    }
+
+    bool loaded = has_obj_extension(filename)
+        ? load_obj(filename, options.num_threads) || load_openmesh(filename)
+        : load_openmesh(filename);
+    if (!loaded) {
+        return false;
+    }
+
+    if (options.lod_levels > 0) {
+        TRACE_SCOPE("build lods");
+        build_lods(options.lod_levels);
+
+        ostringstream report;
+        report << "Built " << num_lods() - 1 << " LOD(s) for " << filename << ':';
+        for (size_t level = 0; level < num_lods(); ++level) {
+            report << (level > 0 ? " -> " : " ") << lod(level).num_indices / 3;
+        }
+        report << " triangles\n";
+        cout << report.str() << flush;
+    }
+
+    if (options.optimize) {
+        TRACE_SCOPE("optimize mesh");
+        auto base = span<const unsigned int>(indices_).first(lod(0).num_indices);
+        auto before = analyze_vertex_cache(base, vertices_.size());
+        optimize();
+        base = span<const unsigned int>(indices_).first(lod(0).num_indices);
+        auto after = analyze_vertex_cache(base, vertices_.size());
+
+        // Compose the line first, meshes may be loaded concurrently
+        ostringstream report;
+        report.precision(3);
+        report << "Optimized " << filename << ": ACMR " << before.acmr << " -> " << after.acmr
+               << ", ATVR " << before.atvr << " -> " << after.atvr << '\n';
+        cout << report.str() << flush;
+    }
+
+    if (options.meshlets) {
+        TRACE_SCOPE("build meshlets");
+        build_meshlets();
+    }
+
+    if (MeshCache::enabled() && !MeshCache::write(cache_file.c_str(), filename, cache_flags, *this)) {
+        cerr << "WARNING::MESH::CACHE_WRITE_FAILED\nFILE: " << cache_file << endl;
+    }
+    return true;
+}
+
+bool BasicMesh::load_obj(const char *filename, unsigned int num_threads) {
+    unmap();
+    lods_.clear();
+    meshlets_.clear();
+
+    ObjReader reader(num_threads);
+    switch (reader.read(filename, vertices_, indices_)) {
+    case ObjReader::kOk:
+        update_bounds();
+        return true;
+
+    case ObjReader::kFileNotFound:
+        cerr << "ERROR::MESH::FILE_NOT_FOUND\nFILE: " << filename << endl;
+        return false;
+
+    case ObjReader::kParseError:
+        cerr << "WARNING::MESH::OBJ_READER_FAILED\n" << reader.error() << "\nFILE: " << filename << endl;
+        return false;
+    }
+
+    return false;
+}
+
+bool BasicMesh::load_openmesh(const char *filename) {
+    unmap();
+    lods_.clear();
+    meshlets_.clear();
+
     OpenMesh_TriMesh mesh;
 
     mesh.request_vertex_normals();
@@ -18,12 +211,16 @@ bool BasicMesh::load(const char *filename) {
     }
 
     OpenMesh::IO::Options opt;
-    if (!OpenMesh::IO::read_mesh(mesh, filename, opt)) {
-        cerr << "ERROR::MESH::FILE_NOT_FOUND\nFILE: " << filename << endl;
-        return false;
+    {
+        TRACE_SCOPE("parse mesh");
+        if (!OpenMesh::IO::read_mesh(mesh, filename, opt)) {
+            cerr << "ERROR::MESH::FILE_NOT_FOUND\nFILE: " << filename << endl;
+            return false;
+        }
     }
 
     if (!opt.check(OpenMesh::IO::Options::VertexNormal)) {
+        TRACE_SCOPE("generate normals");
         mesh.request_face_normals();
         mesh.update_normals();
         mesh.release_face_normals();
@@ -37,13 +234,6 @@ bool BasicMesh::load(const char *filename) {
         return glm::vec3(rhs[0], rhs[1], rhs[2]);
     };
 
-    auto mesh_point = [&](OpenMesh_TriMesh::VertexHandle vh) {
-        return mesh.point(vh);
-    };
-    centroid_ = to_vec3(mesh.vertices().avg(mesh_point));
-    min_ = to_vec3(mesh.vertices().min(mesh_point));
-    max_ = to_vec3(mesh.vertices().max(mesh_point));
-
     for (const auto &v : mesh.vertices()) {
         auto &vertex = vertices_[v.idx()];
         vertex.position = to_vec3(mesh.point(v));
@@ -57,42 +247,487 @@ bool BasicMesh::load(const char *filename) {
     }
 
     mesh.release_vertex_normals();
+
+    update_bounds();
     return true;
 }
 
-void BasicMesh::setup() {
+void BasicMesh::optimize() {
+    make_owned();
+
+    for (size_t level = 0; level < num_lods(); ++level) {
+        auto range = lod(level);
+        auto lod_indices = span<unsigned int>(indices_).subspan(range.first_index, range.num_indices);
+        optimize_vertex_cache(lod_indices, vertices_.size());
+        if (level == 0) {
+            optimize_overdraw(lod_indices, vertices_);
+        }
+    }
+
+    // Level 0 comes first in the index buffer, so it determines the order
+    optimize_vertex_fetch(vertices_, indices_);
+
+    // Reordering invalidated the meshlet ranges
+    if (!meshlets_.empty()) {
+        build_meshlets();
+    }
+}
+
+void BasicMesh::build_lods(unsigned int max_levels) {
+    make_owned();
+
+    auto base = span<const unsigned int>(indices_).first(lod(0).num_indices);
+    auto levels = build_lod_chain(vertices_, base, max_levels);
+
+    indices_.resize(base.size());
+    lods_.assign(1, Lod{0, indices_.size()});
+    for (auto &level : levels) {
+        lods_.push_back(Lod{indices_.size(), level.size()});
+        indices_.insert(indices_.end(), level.begin(), level.end());
+    }
+}
+
+void BasicMesh::build_meshlets() {
+    make_owned();
+
+    auto base = span<unsigned int>(indices_).first(lod(0).num_indices);
+    meshlets_ = ::build_meshlets(base, vertices_);
+}
+
+pair<glm::vec3, float> BasicMesh::bounding_sphere(const glm::mat4 &model) const {
+    float scale = glm::max(glm::length(glm::vec3(model[0])),
+                           glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    glm::vec3 center = glm::vec3(model * glm::vec4(0.5f * (min_ + max_), 1.0f));
+    return {center, 0.5f * glm::length(max_ - min_) * scale};
+}
+
+size_t BasicMesh::select_lod(const glm::mat4 &model, glm::vec3 eye, float pixel_scale, float bias) const {
+    // Target density of the selected level over the projected bounds
+    constexpr float kTrianglesPerPixel = 0.5f;
+
+    if (num_lods() == 1) {
+        return 0;
+    }
+
+    auto [center, radius] = bounding_sphere(model);
+    float distance = glm::length(center - eye);
+
+    // The viewpoint is inside the bounds; the mesh may cover the screen
+    if (distance <= radius) {
+        return 0;
+    }
+
+    float diameter = 2.0f * radius * pixel_scale / distance;
+    float budget = kTrianglesPerPixel * diameter * diameter * exp2f(-bias);
+
+    size_t level = 0;
+    while (level + 1 < num_lods() && lod(level).num_indices / 3 > budget) {
+        ++level;
+    }
+    return level;
+}
+
+void BasicMesh::make_owned() {
+    if (!mapping_) {
+        return;
+    }
+
+    vertices_.assign(mapped_vertices_.begin(), mapped_vertices_.end());
+    indices_.assign(mapped_indices_.begin(), mapped_indices_.end());
+    unmap();
+}
+
+void BasicMesh::unmap() {
+    mapping_.reset();
+    mapped_vertices_ = {};
+    mapped_indices_ = {};
+}
+
+void BasicMesh::update_bounds() {
+    if (vertices_.empty()) {
+        centroid_ = min_ = max_ = glm::vec3(0.0f);
+        return;
+    }
+
+    glm::dvec3 sum(0.0);
+    min_ = max_ = vertices_[0].position;
+    for (const auto &vertex : vertices_) {
+        sum += glm::dvec3(vertex.position);
+        min_ = glm::min(min_, vertex.position);
+        max_ = glm::max(max_, vertex.position);
+    }
+    centroid_ = glm::vec3(sum / (double)vertices_.size());
+}
+
+void BasicMesh::setup(VertexFormat format, GeometryHeap *heap) {
+    TRACE_SCOPE("upload mesh");
     cleanup();
 
+    auto vertices = this->vertices();
+    auto indices = this->indices();
+
+    format_stats_ = {};
+    format_stats_.float_bytes = vertices.size_bytes() + vertices.size() * sizeof(glm::vec3) + indices.size_bytes();
+    position_transform_ = glm::mat4(1.0f);
+
+    // Float vertices are used as stored, so only compact ones are encoded
+    vector<byte> compact_data, position_data;
+    if (format == VertexFormat::kCompact) {
+        encode_compact_vertices(compact_data, position_data);
+    } else {
+        encode_float_positions(position_data);
+    }
+    span<const byte> vertex_data = format == VertexFormat::kCompact ? span<const byte>(compact_data) : as_bytes(vertices);
+    format_stats_.bytes += vertex_data.size() + position_data.size();
+
+    bool short_indices = vertices.size() <= 65536;
+    vector<uint16_t> indices16;
+    if (short_indices) {
+        indices16.assign(indices.begin(), indices.end());
+        index_type_ = GL_UNSIGNED_SHORT;
+        format_stats_.bytes += indices16.size() * sizeof(uint16_t);
+    } else {
+        index_type_ = GL_UNSIGNED_INT;
+        format_stats_.bytes += indices.size_bytes();
+    }
+
+    if (heap && heap->format() == format && vertices.size() <= GeometryHeap::kMaxMeshVertices) {
+        heap_handle_ = heap->allocate(vertex_data, position_data, vertices.size(), indices16);
+        heap_ = heap;
+        return;
+    }
+
+    glGenVertexArrays(1, &vao_);
+    glGenVertexArrays(1, &depth_vao_);
+
+    // Mapped cache data goes straight from the page cache to the driver
+    GlState::bind_vertex_array(vao_);
     glGenBuffers(1, &vbo_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-    glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(Vertex), vertices_.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertex_data.size(), vertex_data.data(), GL_STATIC_DRAW);
+    RenderStats::count_buffer_upload(vertex_data.size());
+    set_vertex_attributes(format, false);
 
-    glGenVertexArrays(1, &vao_);
-    glBindVertexArray(vao_);
+    // Both vertex arrays share the index buffer
+    glGenBuffers(1, &ebo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+    if (short_indices) {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices16.size() * sizeof(uint16_t), indices16.data(), GL_STATIC_DRAW);
+        RenderStats::count_buffer_upload(indices16.size() * sizeof(uint16_t));
+    } else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size_bytes(), indices.data(), GL_STATIC_DRAW);
+        RenderStats::count_buffer_upload(indices.size_bytes());
+    }
+
+    GlState::bind_vertex_array(depth_vao_);
+    glGenBuffers(1, &position_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, position_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, position_data.size(), position_data.data(), GL_STATIC_DRAW);
+    RenderStats::count_buffer_upload(position_data.size());
+    set_vertex_attributes(format, true);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GlState::bind_vertex_array(0);
+}
+
+size_t vertex_size(VertexFormat format) {
+    return format == VertexFormat::kCompact ? sizeof(CompactVertex) : sizeof(BasicMesh::Vertex);
+}
+
+size_t position_size(VertexFormat format) {
+    return format == VertexFormat::kCompact ? sizeof(CompactPosition) : sizeof(glm::vec3);
+}
+
+void set_vertex_attributes(VertexFormat format, bool positions_only) {
+    using Vertex = BasicMesh::Vertex;
+
+    if (format == VertexFormat::kCompact) {
+        if (positions_only) {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactPosition), (void *)0);
+            glEnableVertexAttribArray(0);
+            return;
+        }
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (void *)offsetof(CompactVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (void *)offsetof(CompactVertex, normal));
+        glEnableVertexAttribArray(1);
+        return;
+    }
+
+    if (positions_only) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
+        glEnableVertexAttribArray(0);
+        return;
+    }
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
     glEnableVertexAttribArray(1);
+}
 
-    glGenBuffers(1, &ebo_);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(unsigned int), indices_.data(), GL_STATIC_DRAW);
+void BasicMesh::encode_float_positions(vector<byte> &position_data) const {
+    auto vertices = this->vertices();
+
+    position_data.resize(vertices.size() * sizeof(glm::vec3));
+    auto positions = reinterpret_cast<glm::vec3 *>(position_data.data());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        positions[i] = vertices[i].position;
+    }
+}
+
+void BasicMesh::encode_compact_vertices(vector<byte> &vertex_data, vector<byte> &position_data) {
+    auto vertices = this->vertices();
+
+    // Flat axes keep a unit extent so that the transform stays invertible
+    glm::vec3 extent = max_ - min_;
+    for (int i = 0; i < 3; ++i) {
+        extent[i] = extent[i] > 0.0f ? extent[i] : 1.0f;
+    }
+    position_transform_ = glm::scale(glm::translate(glm::mat4(1.0f), min_), extent);
+
+    vertex_data.resize(vertices.size() * sizeof(CompactVertex));
+    position_data.resize(vertices.size() * sizeof(CompactPosition));
+    auto compact = reinterpret_cast<CompactVertex *>(vertex_data.data());
+    auto positions = reinterpret_cast<CompactPosition *>(position_data.data());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const auto &vertex = vertices[i];
+        auto &packed = compact[i];
+
+        glm::vec3 normalized = (vertex.position - min_) / extent;
+        glm::vec3 decoded;
+        for (int j = 0; j < 3; ++j) {
+            packed.position[j] = quantize_unorm16(normalized[j]);
+            positions[i].position[j] = packed.position[j];
+            decoded[j] = min_[j] + packed.position[j] / 65535.0f * extent[j];
+        }
+        packed.padding = 0;
+        positions[i].padding = 0;
+        packed.normal = pack_snorm10(vertex.normal);
+
+        format_stats_.max_position_error = glm::max(format_stats_.max_position_error,
+                                                    glm::length(decoded - vertex.position));
+        format_stats_.max_normal_error = glm::max(format_stats_.max_normal_error,
+                                                  angle_degrees(unpack_snorm10(packed.normal), vertex.normal));
+    }
+}
+
+GLuint BasicMesh::vertex_array(bool depth) const {
+    GLuint vao = depth ? depth_vao_ : vao_;
+    if (vao == 0 && heap_) {
+        vao = depth ? heap_->depth_vao() : heap_->vao();
+    }
+    return vao;
+}
+
+GLint BasicMesh::base_vertex() const {
+    return heap_ ? (GLint)heap_->allocation(heap_handle_).first_vertex : 0;
+}
 
+const void *BasicMesh::index_offset(size_t first_index) const {
+    size_t index_size = index_type_ == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    if (heap_) {
+        first_index += heap_->allocation(heap_handle_).first_index;
+    }
+    return (const void *)(first_index * index_size);
+}
+
+void BasicMesh::draw(size_t lod) const {
+    auto range = this->lod(lod);
+
+    GlState::bind_vertex_array(vertex_array(false));
+    glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)range.num_indices, index_type_,
+                             index_offset(range.first_index), base_vertex());
+    RenderStats::count_draw(GL_TRIANGLES, range.num_indices);
+}
+
+void BasicMesh::draw_depth(size_t lod) const {
+    auto range = this->lod(lod);
+
+    GlState::bind_vertex_array(vertex_array(true));
+    glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)range.num_indices, index_type_,
+                             index_offset(range.first_index), base_vertex());
+    RenderStats::count_draw(GL_TRIANGLES, range.num_indices);
+}
+
+void BasicMesh::add_draws(DrawBatch &batch, size_t lod) const {
+    auto range = this->lod(lod);
+    batch.add(heap_handle_, range.first_index, range.num_indices);
+}
+
+void BasicMesh::set_instances(span<const glm::mat4> models, span<const glm::vec3> colors) {
+    vector<Instance> instances(models.size());
+    for (size_t i = 0; i < models.size(); ++i) {
+        instances[i].model = models[i];
+        instances[i].normal_matrix = glm::transpose(glm::inverse(glm::mat3(models[i])));
+        // An alpha of 0 keeps the material color
+        instances[i].color = i < colors.size() ? glm::vec4(colors[i], 1.0f) : glm::vec4(0.0f);
+    }
+
+    if (instance_vbo_ == 0) {
+        // Instance attributes cannot go on the heap's shared vertex arrays
+        if (heap_) {
+            glGenVertexArrays(1, &vao_);
+            glGenVertexArrays(1, &depth_vao_);
+            heap_->attach(vao_, false);
+            heap_->attach(depth_vao_, true);
+        }
+
+        glGenBuffers(1, &instance_vbo_);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+        for (GLuint vao : {vao_, depth_vao_}) {
+            GlState::bind_vertex_array(vao);
+            for (GLuint column = 0; column < 4; ++column) {
+                GLuint location = kInstanceModelLocation + column;
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                      (void *)(offsetof(Instance, model) + column * sizeof(glm::vec4)));
+                glEnableVertexAttribArray(location);
+                glVertexAttribDivisor(location, 1);
+            }
+            for (GLuint column = 0; column < 3; ++column) {
+                GLuint location = kInstanceNormalMatrixLocation + column;
+                glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                      (void *)(offsetof(Instance, normal_matrix) + column * sizeof(glm::vec3)));
+                glEnableVertexAttribArray(location);
+                glVertexAttribDivisor(location, 1);
+            }
+            glVertexAttribPointer(kInstanceColorLocation, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                                  (void *)offsetof(Instance, color));
+            glEnableVertexAttribArray(kInstanceColorLocation);
+            glVertexAttribDivisor(kInstanceColorLocation, 1);
+        }
+        GlState::bind_vertex_array(0);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+    }
+
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+    RenderStats::count_buffer_upload(instances.size() * sizeof(Instance));
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    num_instances_ = instances.size();
+}
+
+void BasicMesh::draw_instanced(size_t lod) const {
+    auto range = this->lod(lod);
+
+    GlState::bind_vertex_array(vertex_array(false));
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)range.num_indices, index_type_,
+                                      index_offset(range.first_index), (GLsizei)num_instances_, base_vertex());
+    RenderStats::count_draw(GL_TRIANGLES, range.num_indices, num_instances_);
+}
+
+void BasicMesh::draw_depth_instanced(size_t lod) const {
+    auto range = this->lod(lod);
+
+    GlState::bind_vertex_array(vertex_array(true));
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)range.num_indices, index_type_,
+                                      index_offset(range.first_index), (GLsizei)num_instances_, base_vertex());
+    RenderStats::count_draw(GL_TRIANGLES, range.num_indices, num_instances_);
+}
+
+void BasicMesh::draw_depth_repeated(GLsizei count, size_t lod) const {
+    auto range = this->lod(lod);
+
+    GlState::bind_vertex_array(vertex_array(true));
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)range.num_indices, index_type_,
+                                      index_offset(range.first_index), count, base_vertex());
+    RenderStats::count_draw(GL_TRIANGLES, range.num_indices, count);
 }
 
-void BasicMesh::draw() const {
-    glBindVertexArray(vao_);
-    glDrawElements(GL_TRIANGLES, indices_.size(), GL_UNSIGNED_INT, (void *)0);
-    glBindVertexArray(0);
+void BasicMesh::cull_meshlets(const glm::mat4 &model, const glm::mat4 &view_projection, glm::vec3 eye,
+                              MeshletStats &stats) const {
+    // Meshlet bounds are in model space, so cull there
+    Frustum frustum(view_projection * model);
+    glm::vec3 model_eye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+
+    visible_ranges_.clear();
+    for (const auto &meshlet : meshlets_) {
+        ++stats.tested;
+        if (!frustum.intersects_sphere(meshlet.center, meshlet.radius)) {
+            ++stats.frustum_culled;
+            continue;
+        }
+        if (meshlet_backfacing(meshlet, model_eye)) {
+            ++stats.backface_culled;
+            continue;
+        }
+        ++stats.drawn;
+
+        // Merge with the previous range when they are adjacent
+        auto *last = visible_ranges_.empty() ? nullptr : &visible_ranges_.back();
+        if (last && last->first_index + last->num_indices == meshlet.first_index) {
+            last->num_indices += meshlet.num_indices;
+        } else {
+            visible_ranges_.push_back(Lod{meshlet.first_index, meshlet.num_indices});
+        }
+    }
+}
+
+void BasicMesh::draw_culled(const glm::mat4 &model, const glm::mat4 &view_projection, glm::vec3 eye,
+                            MeshletStats &stats) const {
+    if (meshlets_.empty()) {
+        draw();
+        ++stats.draw_calls;
+        return;
+    }
+
+    cull_meshlets(model, view_projection, eye, stats);
+    if (visible_ranges_.empty()) {
+        return;
+    }
+
+    draw_counts_.clear();
+    draw_offsets_.clear();
+    size_t num_indices = 0;
+    for (const auto &range : visible_ranges_) {
+        draw_counts_.push_back((GLsizei)range.num_indices);
+        draw_offsets_.push_back(index_offset(range.first_index));
+        num_indices += range.num_indices;
+    }
+    draw_base_vertices_.assign(draw_counts_.size(), base_vertex());
+
+    GlState::bind_vertex_array(vertex_array(false));
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, draw_counts_.data(), index_type_, draw_offsets_.data(),
+                                  (GLsizei)draw_counts_.size(), draw_base_vertices_.data());
+    RenderStats::count_draw(GL_TRIANGLES, num_indices);
+    ++stats.draw_calls;
+}
+
+void BasicMesh::add_culled_draws(DrawBatch &batch, const glm::mat4 &model, const glm::mat4 &view_projection,
+                                 glm::vec3 eye, MeshletStats &stats) const {
+    if (meshlets_.empty()) {
+        add_draws(batch);
+        return;
+    }
+
+    cull_meshlets(model, view_projection, eye, stats);
+    for (const auto &range : visible_ranges_) {
+        batch.add(heap_handle_, range.first_index, range.num_indices);
+    }
 }
 
 void BasicMesh::cleanup() {
+    if (heap_) {
+        heap_->free(heap_handle_);
+        heap_ = nullptr;
+        heap_handle_ = 0;
+    }
+
+    // Meshes that were never set up may live without a GL context (e.g. in tools)
+    if (vao_ == 0) {
+        return;
+    }
+
     glDeleteBuffers(1, &vbo_);
+    glDeleteBuffers(1, &position_vbo_);
+    GlState::forget_vertex_array(vao_);
+    GlState::forget_vertex_array(depth_vao_);
     glDeleteVertexArrays(1, &vao_);
+    glDeleteVertexArrays(1, &depth_vao_);
     glDeleteBuffers(1, &ebo_);
-    vbo_ = vao_ = ebo_ = 0;
+    glDeleteBuffers(1, &instance_vbo_);
+    vbo_ = position_vbo_ = vao_ = depth_vao_ = ebo_ = instance_vbo_ = 0;
+    num_instances_ = 0;
 }
 
 BasicMesh::~BasicMesh() {
@@ -0,0 +1,287 @@
+#include "mesh_cache.h"
+#include "atomic_file.h"
+#include "mapped_file.h"
+#include "mesh.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'B', 'M', 'S', 'H'};
+
+// Section offsets are aligned so that mapped arrays are suitably aligned
+constexpr uint64_t kSectionAlignment = 64;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertex_size;
+    uint32_t index_size;
+
+    uint64_t num_vertices;
+    uint64_t num_indices;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint64_t num_lods;
+    uint64_t lod_offset;
+    uint64_t num_meshlets;
+    uint64_t meshlet_offset;
+
+    float centroid[3];
+    float min[3];
+    float max[3];
+    uint32_t flags;
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+};
+
+struct LodRecord {
+    uint64_t first_index;
+    uint64_t num_indices;
+};
+
+struct MeshletRecord {
+    uint64_t first_index;
+    uint64_t num_indices;
+    float center[3];
+    float radius;
+    float cone_axis[3];
+    float cone_cutoff;
+};
+
+uint64_t align_up(uint64_t value) {
+    return (value + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+}
+
+// Whether `count` records of `record_size` bytes at `offset` lie within the
+// file, without overflowing on a corrupt header
+bool section_fits(uint64_t offset, uint64_t count, size_t record_size, size_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / record_size;
+}
+
+uint64_t hash_bytes(const byte *data, size_t size) {
+    constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ull;
+    constexpr uint64_t kPrime = 0x100000001b3ull;
+
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * kMultiplier;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ (uint64_t)data[i]) * kPrime;
+    }
+    return hash;
+}
+
+bool hash_file(const char *filename, uint64_t &hash) {
+    auto file = MappedFile::open(filename);
+    if (!file) {
+        return false;
+    }
+    hash = hash_bytes(file->data(), file->size());
+    return true;
+}
+
+bool source_stat(const char *source, uint64_t &size, int64_t &mtime) {
+    error_code ec;
+    size = fs::file_size(source, ec);
+    if (ec) {
+        return false;
+    }
+    mtime = fs::last_write_time(source, ec).time_since_epoch().count();
+    return !ec;
+}
+
+void store_vec3(float dst[3], glm::vec3 v) {
+    dst[0] = v.x;
+    dst[1] = v.y;
+    dst[2] = v.z;
+}
+
+glm::vec3 load_vec3(const float src[3]) {
+    return glm::vec3(src[0], src[1], src[2]);
+}
+
+} // namespace
+
+uint32_t MeshCache::flags(const MeshLoadOptions &options) {
+    uint32_t flags = 0;
+    if (options.optimize) {
+        flags |= kOptimized;
+    }
+    if (options.meshlets) {
+        flags |= kMeshlets;
+    }
+    flags |= min(options.lod_levels, 255u) << kLodLevelsShift;
+    return flags;
+}
+
+string MeshCache::cache_path(const char *source) {
+    if (directory_.empty()) {
+        return string(source) + ".bmesh";
+    }
+
+    // Disambiguate sources with the same name by their absolute path
+    error_code ec;
+    fs::path absolute = fs::absolute(source, ec);
+    size_t path_hash = hash<string>()(absolute.generic_string());
+
+    ostringstream name;
+    name << fs::path(source).stem().string() << '-' << hex << path_hash << ".bmesh";
+    return (fs::path(directory_) / name.str()).string();
+}
+
+bool MeshCache::read(const char *cache_file, const char *source, uint32_t flags, BasicMesh &mesh) {
+    TRACE_SCOPE("read mesh cache");
+    auto file = MappedFile::open(cache_file);
+    if (!file || file->size() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, file->data(), sizeof(Header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion ||
+        header.flags != flags ||
+        header.vertex_size != sizeof(BasicMesh::Vertex) ||
+        header.index_size != sizeof(unsigned int)) {
+        return false;
+    }
+
+    if (!section_fits(header.vertex_offset, header.num_vertices, sizeof(BasicMesh::Vertex), file->size()) ||
+        !section_fits(header.index_offset, header.num_indices, sizeof(unsigned int), file->size()) ||
+        !section_fits(header.lod_offset, header.num_lods, sizeof(LodRecord), file->size()) ||
+        !section_fits(header.meshlet_offset, header.num_meshlets, sizeof(MeshletRecord), file->size()) ||
+        header.vertex_offset % kSectionAlignment != 0 ||
+        header.index_offset % kSectionAlignment != 0 ||
+        header.lod_offset % kSectionAlignment != 0 ||
+        header.meshlet_offset % kSectionAlignment != 0) {
+        return false;
+    }
+
+    // A cache without its source is a pre-baked asset and always valid.
+    // Otherwise compare size and time first, and only hash the source when
+    // the time changed but the size did not (e.g. after a fresh checkout).
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (source_stat(source, source_size, source_mtime)) {
+        if (source_size != header.source_size) {
+            return false;
+        }
+        if (source_mtime != header.source_mtime) {
+            uint64_t source_hash;
+            if (!hash_file(source, source_hash) || source_hash != header.source_hash) {
+                return false;
+            }
+        }
+    }
+
+    vector<BasicMesh::Lod> lods;
+    for (uint64_t i = 0; i < header.num_lods; ++i) {
+        LodRecord record;
+        memcpy(&record, file->data() + header.lod_offset + i * sizeof(LodRecord), sizeof(LodRecord));
+        if (record.first_index > header.num_indices ||
+            record.num_indices > header.num_indices - record.first_index) {
+            return false;
+        }
+        lods.push_back({record.first_index, record.num_indices});
+    }
+
+    vector<Meshlet> meshlets;
+    meshlets.reserve(header.num_meshlets);
+    for (uint64_t i = 0; i < header.num_meshlets; ++i) {
+        MeshletRecord record;
+        memcpy(&record, file->data() + header.meshlet_offset + i * sizeof(MeshletRecord), sizeof(MeshletRecord));
+        if (record.first_index > header.num_indices ||
+            record.num_indices > header.num_indices - record.first_index) {
+            return false;
+        }
+        meshlets.push_back({record.first_index, record.num_indices, load_vec3(record.center), record.radius,
+                            load_vec3(record.cone_axis), record.cone_cutoff});
+    }
+
+    auto vertices = reinterpret_cast<const BasicMesh::Vertex *>(file->data() + header.vertex_offset);
+    auto indices = reinterpret_cast<const unsigned int *>(file->data() + header.index_offset);
+
+    mesh.vertices_.clear();
+    mesh.indices_.clear();
+    mesh.mapped_vertices_ = span(vertices, header.num_vertices);
+    mesh.mapped_indices_ = span(indices, header.num_indices);
+    mesh.lods_ = std::move(lods);
+    mesh.meshlets_ = std::move(meshlets);
+    mesh.mapping_ = std::move(file);
+
+    mesh.centroid_ = load_vec3(header.centroid);
+    mesh.min_ = load_vec3(header.min);
+    mesh.max_ = load_vec3(header.max);
+    return true;
+}
+
+bool MeshCache::write(const char *cache_file, const char *source, uint32_t flags, const BasicMesh &mesh) {
+    TRACE_SCOPE("write mesh cache");
+    auto vertices = mesh.vertices();
+    auto indices = mesh.indices();
+
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.vertex_size = sizeof(BasicMesh::Vertex);
+    header.index_size = sizeof(unsigned int);
+    header.flags = flags;
+
+    header.num_vertices = vertices.size();
+    header.num_indices = indices.size();
+    header.vertex_offset = align_up(sizeof(Header));
+    header.index_offset = align_up(header.vertex_offset + vertices.size_bytes());
+    header.num_lods = mesh.lods_.size();
+    header.lod_offset = align_up(header.index_offset + indices.size_bytes());
+    header.num_meshlets = mesh.meshlets_.size();
+    header.meshlet_offset = align_up(header.lod_offset + header.num_lods * sizeof(LodRecord));
+
+    store_vec3(header.centroid, mesh.centroid());
+    store_vec3(header.min, mesh.min());
+    store_vec3(header.max, mesh.max());
+
+    if (!source_stat(source, header.source_size, header.source_mtime) ||
+        !hash_file(source, header.source_hash)) {
+        return false;
+    }
+
+    return write_file_atomically(cache_file, [&](ostream &out) {
+        const char padding[kSectionAlignment] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+        out.write(padding, header.vertex_offset - sizeof(Header));
+        out.write(reinterpret_cast<const char *>(vertices.data()), vertices.size_bytes());
+        out.write(padding, header.index_offset - header.vertex_offset - vertices.size_bytes());
+        out.write(reinterpret_cast<const char *>(indices.data()), indices.size_bytes());
+        out.write(padding, header.lod_offset - header.index_offset - indices.size_bytes());
+        for (const auto &lod : mesh.lods_) {
+            LodRecord record = {lod.first_index, lod.num_indices};
+            out.write(reinterpret_cast<const char *>(&record), sizeof(LodRecord));
+        }
+        out.write(padding, header.meshlet_offset - header.lod_offset - header.num_lods * sizeof(LodRecord));
+        for (const auto &meshlet : mesh.meshlets_) {
+            MeshletRecord record = {meshlet.first_index, meshlet.num_indices, {}, meshlet.radius, {}, meshlet.cone_cutoff};
+            store_vec3(record.center, meshlet.center);
+            store_vec3(record.cone_axis, meshlet.cone_axis);
+            out.write(reinterpret_cast<const char *>(&record), sizeof(MeshletRecord));
+        }
+        return true;
+    });
+}
@@ -0,0 +1,149 @@
+#include "mesh_loader.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+MeshLoader::MeshLoader(ThreadPool &pool, MeshLoadOptions options, GeometryHeap *heap)
+    : pool_(pool),
+      options_(options),
+      heap_(heap),
+      num_processed_(0),
+      all_loaded_(true),
+      start_time_(Clock::now()),
+      total_ms_(0.0),
+      num_outstanding_(0) {
+}
+
+MeshLoader::~MeshLoader() {
+    // Workers still reference the jobs and meshes
+    unique_lock lock(mutex_);
+    cv_.wait(lock, [this]() { return num_processed_ + completed_.size() == jobs_.size(); });
+}
+
+void MeshLoader::enqueue(string filename, BasicMesh &mesh) {
+    auto &job = *jobs_.emplace_back(make_unique<Job>());
+    job.filename = std::move(filename);
+    job.mesh = &mesh;
+
+    ++num_outstanding_;
+    pool_.submit([this, &job]() {
+        // Files loaded at the same time share the hardware threads
+        unsigned int hardware_threads = max(1u, thread::hardware_concurrency());
+        size_t concurrent = clamp<size_t>(num_outstanding_, 1, pool_.size());
+
+        MeshLoadOptions options = options_;
+        if (options.num_threads == 0) {
+            options.num_threads = max(1u, (unsigned int)(hardware_threads / concurrent));
+        }
+
+        auto start = Clock::now();
+        job.loaded = job.mesh->load(job.filename.c_str(), options);
+        job.load_ms = elapsed_ms(start);
+
+        // The loader may be destroyed as soon as the job is seen completed,
+        // so it is not touched after the lock is released
+        lock_guard lock(mutex_);
+        --num_outstanding_;
+        completed_.push_back(&job);
+        cv_.notify_all();
+    });
+}
+
+void MeshLoader::upload(Job &job) {
+    if (job.loaded) {
+        auto start = Clock::now();
+        job.mesh->setup(options_.vertex_format, heap_);
+        job.upload_ms = elapsed_ms(start);
+    } else {
+        all_loaded_ = false;
+    }
+}
+
+void MeshLoader::upload_ready() {
+    vector<Job *> completed;
+    {
+        lock_guard lock(mutex_);
+        completed.swap(completed_);
+        num_processed_ += completed.size();
+    }
+
+    for (Job *job : completed) {
+        upload(*job);
+    }
+}
+
+bool MeshLoader::finish() {
+    TRACE_SCOPE("finish loading meshes");
+    while (true) {
+        vector<Job *> completed;
+        {
+            unique_lock lock(mutex_);
+            cv_.wait(lock, [this]() { return !completed_.empty() || num_processed_ == jobs_.size(); });
+            if (completed_.empty()) {
+                break;
+            }
+            completed.swap(completed_);
+            num_processed_ += completed.size();
+        }
+
+        for (Job *job : completed) {
+            upload(*job);
+        }
+    }
+
+    total_ms_ = elapsed_ms(start_time_);
+    return all_loaded_;
+}
+
+void MeshLoader::print_report(ostream &out) const {
+    double load_ms = 0.0;
+    double upload_ms = 0.0;
+
+    // Formatted apart so that the caller's stream flags are left alone
+    ostringstream report;
+    report << left << setw(32) << "file"
+           << right << setw(12) << "vertices"
+           << setw(12) << "triangles"
+           << setw(10) << "load ms"
+           << setw(12) << "upload ms" << '\n';
+
+    for (const auto &job : jobs_) {
+        report << left << setw(32) << filesystem::path(job->filename).filename().string()
+               << right << setw(12) << job->mesh->num_vertices()
+               << setw(12) << job->mesh->num_triangles()
+               << fixed << setprecision(1)
+               << setw(10) << job->load_ms
+               << setw(12) << job->upload_ms
+               << (job->loaded ? "" : "  FAILED") << '\n';
+
+        load_ms += job->load_ms;
+        upload_ms += job->upload_ms;
+    }
+
+    if (options_.vertex_format != VertexFormat::kFloat) {
+        for (const auto &job : jobs_) {
+            if (job->loaded) {
+                print_vertex_format_stats(report, filesystem::path(job->filename).filename().string(),
+                                          job->mesh->format_stats());
+            }
+        }
+    }
+
+    report << "Loaded " << jobs_.size() << " mesh(es) in " << total_ms_ << " ms on "
+           << pool_.size() << " worker(s) (load " << load_ms << " ms, upload " << upload_ms << " ms)\n";
+    out << report.str() << flush;
+}
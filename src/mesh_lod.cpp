@@ -0,0 +1,103 @@
+#include "mesh_lod.h"
+
+#include <OpenMesh/Core/Mesh/TriMesh_ArrayKernelT.hh>
+#include <OpenMesh/Tools/Decimater/DecimaterT.hh>
+#include <OpenMesh/Tools/Decimater/ModQuadricT.hh>
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+using LodMesh = OpenMesh::TriMesh_ArrayKernelT<>;
+using Decimater = OpenMesh::Decimater::DecimaterT<LodMesh>;
+using QuadricHandle = OpenMesh::Decimater::ModQuadricT<LodMesh>::Handle;
+
+vector<vector<unsigned int>> build_lod_chain(span<const BasicMesh::Vertex> vertices, span<const unsigned int> indices,
+                                             unsigned int max_levels, size_t min_triangles) {
+    vector<vector<unsigned int>> levels;
+    if (max_levels == 0 || indices.size() / 3 < 2 * min_triangles) {
+        return levels;
+    }
+
+    // Weld vertices that only differ in their normal, so that the decimater
+    // sees one connected surface instead of patches bounded by seams. Each
+    // welded vertex maps back to the first original vertex at its position.
+    vector<unsigned int> order(vertices.size());
+    iota(order.begin(), order.end(), 0u);
+    auto position_less = [&](unsigned int lhs, unsigned int rhs) {
+        const glm::vec3 &a = vertices[lhs].position;
+        const glm::vec3 &b = vertices[rhs].position;
+        if (a.x != b.x) {
+            return a.x < b.x;
+        }
+        if (a.y != b.y) {
+            return a.y < b.y;
+        }
+        return a.z < b.z;
+    };
+    stable_sort(order.begin(), order.end(), position_less);
+
+    vector<unsigned int> welded(vertices.size());
+    vector<unsigned int> representative;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i == 0 || vertices[order[i]].position != vertices[order[i - 1]].position) {
+            representative.push_back(order[i]);
+        }
+        welded[order[i]] = (unsigned int)representative.size() - 1;
+    }
+
+    LodMesh mesh;
+    mesh.reserve(representative.size(), indices.size(), indices.size() / 3);
+
+    vector<LodMesh::VertexHandle> handles;
+    handles.reserve(representative.size());
+    for (unsigned int v : representative) {
+        const glm::vec3 &p = vertices[v].position;
+        handles.push_back(mesh.add_vertex(LodMesh::Point(p.x, p.y, p.z)));
+    }
+
+    // Degenerate and non-manifold faces are rejected and left out of the levels
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int a = welded[indices[i]];
+        unsigned int b = welded[indices[i + 1]];
+        unsigned int c = welded[indices[i + 2]];
+        if (a != b && b != c && c != a) {
+            mesh.add_face(handles[a], handles[b], handles[c]);
+        }
+    }
+
+    Decimater decimater(mesh);
+    QuadricHandle quadric;
+    decimater.add(quadric);
+    decimater.module(quadric).unset_max_err();
+    if (!decimater.initialize()) {
+        return levels;
+    }
+
+    size_t num_faces = indices.size() / 3;
+    while (levels.size() < max_levels && num_faces / 2 >= min_triangles) {
+        decimater.decimate_to_faces(0, num_faces / 2);
+
+        vector<unsigned int> level;
+        level.reserve(num_faces / 2 * 3);
+        for (const auto &f : mesh.faces()) {
+            if (mesh.status(f).deleted()) {
+                continue;
+            }
+            for (const auto &v : mesh.fv_range(f)) {
+                level.push_back(representative[v.idx()]);
+            }
+        }
+
+        // Stop when collapses are blocked (e.g. by boundaries or topology)
+        size_t level_faces = level.size() / 3;
+        if (level_faces == 0 || level_faces > num_faces * 9 / 10) {
+            break;
+        }
+
+        num_faces = level_faces;
+        levels.push_back(std::move(level));
+    }
+
+    return levels;
+}
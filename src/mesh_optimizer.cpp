@@ -0,0 +1,341 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// Tuning constants from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+constexpr int kCacheSize = 32;
+constexpr float kCacheDecayPower = 1.5f;
+constexpr float kLastTriangleScore = 0.75f;
+constexpr float kValenceBoostScale = 2.0f;
+constexpr float kValenceBoostPower = 0.5f;
+
+// Cache size used to find cluster boundaries for overdraw optimization
+constexpr unsigned int kClusterCacheSize = 16;
+
+float vertex_score(int cache_position, unsigned int remaining) {
+    if (remaining == 0) {
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            // The vertices of the last triangle get a fixed score, so that
+            // the same triangle is not favored over its neighbours
+            score = kLastTriangleScore;
+        } else {
+            float scaler = 1.0f / (kCacheSize - 3);
+            score = powf(1.0f - (cache_position - 3) * scaler, kCacheDecayPower);
+        }
+    }
+
+    // Favor vertices with few remaining triangles to finish them off
+    score += kValenceBoostScale * powf((float)remaining, -kValenceBoostPower);
+    return score;
+}
+
+} // namespace
+
+VertexCacheStats analyze_vertex_cache(span<const unsigned int> indices, size_t num_vertices, unsigned int cache_size) {
+    vector<unsigned int> timestamps(num_vertices, 0);
+    vector<bool> referenced(num_vertices, false);
+
+    // A vertex is cached if it was one of the last `cache_size` misses
+    unsigned int time = cache_size + 1;
+    size_t misses = 0;
+    size_t num_referenced = 0;
+    for (unsigned int index : indices) {
+        if (time - timestamps[index] > cache_size) {
+            timestamps[index] = time++;
+            ++misses;
+        }
+        if (!referenced[index]) {
+            referenced[index] = true;
+            ++num_referenced;
+        }
+    }
+
+    size_t num_faces = indices.size() / 3;
+    return {
+        num_faces > 0 ? (float)misses / num_faces : 0.0f,
+        num_referenced > 0 ? (float)misses / num_referenced : 0.0f,
+    };
+}
+
+void optimize_vertex_cache(span<unsigned int> indices, size_t num_vertices) {
+    size_t num_faces = indices.size() / 3;
+    if (num_faces == 0) {
+        return;
+    }
+
+    // Vertex to triangle adjacency; the first `remaining[v]` entries of each
+    // list are the triangles not yet emitted
+    vector<unsigned int> remaining(num_vertices, 0);
+    for (unsigned int index : indices) {
+        ++remaining[index];
+    }
+
+    vector<size_t> offsets(num_vertices + 1, 0);
+    for (size_t v = 0; v < num_vertices; ++v) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+
+    vector<unsigned int> adjacency(indices.size());
+    {
+        vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            adjacency[cursor[indices[i]]++] = (unsigned int)(i / 3);
+        }
+    }
+
+    vector<int> cache_position(num_vertices, -1);
+    vector<float> vertex_scores(num_vertices);
+    for (size_t v = 0; v < num_vertices; ++v) {
+        vertex_scores[v] = vertex_score(-1, remaining[v]);
+    }
+
+    vector<float> triangle_scores(num_faces);
+    for (size_t f = 0; f < num_faces; ++f) {
+        triangle_scores[f] = vertex_scores[indices[3 * f]] +
+            vertex_scores[indices[3 * f + 1]] + vertex_scores[indices[3 * f + 2]];
+    }
+
+    vector<bool> emitted(num_faces, false);
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    array<unsigned int, kCacheSize + 3> cache{};
+    array<unsigned int, kCacheSize + 3> new_cache{};
+    size_t cache_count = 0;
+
+    constexpr size_t kNone = numeric_limits<size_t>::max();
+    size_t best = max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+    size_t cursor = 0;
+
+    for (size_t count = 0; count < num_faces; ++count) {
+        if (best == kNone) {
+            // Nothing adjacent to the cache is left; continue in input order
+            while (emitted[cursor]) {
+                ++cursor;
+            }
+            best = cursor;
+        }
+
+        emitted[best] = true;
+        const unsigned int triangle[3] = {indices[3 * best], indices[3 * best + 1], indices[3 * best + 2]};
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // Remove the triangle from the adjacency of its vertices
+        for (unsigned int v : triangle) {
+            auto begin = adjacency.begin() + offsets[v];
+            auto end = begin + remaining[v];
+            auto it = find(begin, end, (unsigned int)best);
+            if (it != end) {
+                iter_swap(it, end - 1);
+                --remaining[v];
+            }
+        }
+
+        // Move the triangle's vertices to the front of the cache
+        size_t new_count = 0;
+        for (unsigned int v : triangle) {
+            new_cache[new_count++] = v;
+        }
+        for (size_t i = 0; i < cache_count; ++i) {
+            unsigned int v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                new_cache[new_count++] = v;
+            }
+        }
+
+        // Update scores of cached and evicted vertices and their triangles
+        for (size_t i = 0; i < new_count; ++i) {
+            unsigned int v = new_cache[i];
+            cache_position[v] = i < kCacheSize ? (int)i : -1;
+
+            float score = vertex_score(cache_position[v], remaining[v]);
+            float delta = score - vertex_scores[v];
+            vertex_scores[v] = score;
+
+            for (size_t j = offsets[v]; j < offsets[v] + remaining[v]; ++j) {
+                triangle_scores[adjacency[j]] += delta;
+            }
+        }
+
+        swap(cache, new_cache);
+        cache_count = min<size_t>(new_count, kCacheSize);
+
+        // Pick the best triangle that uses a cached vertex
+        best = kNone;
+        float best_score = -numeric_limits<float>::max();
+        for (size_t i = 0; i < cache_count; ++i) {
+            unsigned int v = cache[i];
+            for (size_t j = offsets[v]; j < offsets[v] + remaining[v]; ++j) {
+                unsigned int f = adjacency[j];
+                if (triangle_scores[f] > best_score) {
+                    best_score = triangle_scores[f];
+                    best = f;
+                }
+            }
+        }
+    }
+
+    copy(output.begin(), output.end(), indices.begin());
+}
+
+void optimize_overdraw(span<unsigned int> indices, span<const BasicMesh::Vertex> vertices, float threshold) {
+    size_t num_faces = indices.size() / 3;
+    if (num_faces == 0) {
+        return;
+    }
+
+    // Simulate the cache to find per-triangle misses
+    vector<unsigned int> misses(num_faces, 0);
+    {
+        vector<unsigned int> timestamps(vertices.size(), 0);
+        unsigned int time = kClusterCacheSize + 1;
+        for (size_t f = 0; f < num_faces; ++f) {
+            for (int i = 0; i < 3; ++i) {
+                unsigned int v = indices[3 * f + i];
+                if (time - timestamps[v] > kClusterCacheSize) {
+                    timestamps[v] = time++;
+                    ++misses[f];
+                }
+            }
+        }
+    }
+
+    // Hard boundaries are where the cache is flushed (all three vertices
+    // miss); these can be reordered without hurting cache efficiency
+    vector<size_t> hard_boundaries;
+    for (size_t f = 0; f < num_faces; ++f) {
+        if (f == 0 || misses[f] == 3) {
+            hard_boundaries.push_back(f);
+        }
+    }
+    hard_boundaries.push_back(num_faces);
+
+    // Soft boundaries split hard clusters further wherever the ACMR of the
+    // part so far, simulated with a cache that starts empty, is already
+    // within the threshold of the cluster's ACMR
+    vector<size_t> clusters;
+    vector<unsigned int> timestamps(vertices.size(), 0);
+    unsigned int time = kClusterCacheSize + 1;
+
+    for (size_t c = 0; c + 1 < hard_boundaries.size(); ++c) {
+        size_t begin = hard_boundaries[c];
+        size_t end = hard_boundaries[c + 1];
+
+        size_t cluster_misses = 0;
+        for (size_t f = begin; f < end; ++f) {
+            cluster_misses += misses[f];
+        }
+        float target = threshold * cluster_misses / (end - begin);
+
+        clusters.push_back(begin);
+        time += kClusterCacheSize + 1;
+        size_t running_misses = 0;
+        size_t running_faces = 0;
+        for (size_t f = begin; f + 1 < end; ++f) {
+            for (int i = 0; i < 3; ++i) {
+                unsigned int v = indices[3 * f + i];
+                if (time - timestamps[v] > kClusterCacheSize) {
+                    timestamps[v] = time++;
+                    ++running_misses;
+                }
+            }
+            ++running_faces;
+
+            if ((float)running_misses / running_faces <= target) {
+                clusters.push_back(f + 1);
+                time += kClusterCacheSize + 1;
+                running_misses = 0;
+                running_faces = 0;
+            }
+        }
+    }
+    clusters.push_back(num_faces);
+
+    // Area-weighted centroid and normal of each cluster and of the mesh
+    size_t num_clusters = clusters.size() - 1;
+    vector<glm::vec3> centroids(num_clusters, glm::vec3(0.0f));
+    vector<glm::vec3> normals(num_clusters, glm::vec3(0.0f));
+    vector<float> areas(num_clusters, 0.0f);
+    glm::vec3 mesh_centroid(0.0f);
+    float mesh_area = 0.0f;
+
+    for (size_t c = 0; c < num_clusters; ++c) {
+        for (size_t f = clusters[c]; f < clusters[c + 1]; ++f) {
+            const glm::vec3 &a = vertices[indices[3 * f]].position;
+            const glm::vec3 &b = vertices[indices[3 * f + 1]].position;
+            const glm::vec3 &p = vertices[indices[3 * f + 2]].position;
+
+            glm::vec3 n = glm::cross(b - a, p - a);
+            float area = glm::length(n);
+            centroids[c] += (a + b + p) * (area / 3.0f);
+            normals[c] += n;
+            areas[c] += area;
+        }
+        mesh_centroid += centroids[c];
+        mesh_area += areas[c];
+    }
+    if (mesh_area > 0.0f) {
+        mesh_centroid /= mesh_area;
+    }
+
+    vector<float> sort_keys(num_clusters, 0.0f);
+    for (size_t c = 0; c < num_clusters; ++c) {
+        float normal_length = glm::length(normals[c]);
+        if (areas[c] > 0.0f && normal_length > 0.0f) {
+            glm::vec3 centroid = centroids[c] / areas[c];
+            sort_keys[c] = glm::dot(centroid - mesh_centroid, normals[c] / normal_length);
+        }
+    }
+
+    // Outward-facing clusters occlude the rest, so draw them first
+    vector<size_t> order(num_clusters);
+    for (size_t c = 0; c < num_clusters; ++c) {
+        order[c] = c;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+        return sort_keys[lhs] > sort_keys[rhs];
+    });
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t c : order) {
+        output.insert(output.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+    }
+    copy(output.begin(), output.end(), indices.begin());
+}
+
+void optimize_vertex_fetch(vector<BasicMesh::Vertex> &vertices, span<unsigned int> indices) {
+    constexpr unsigned int kUnused = numeric_limits<unsigned int>::max();
+
+    vector<unsigned int> remap(vertices.size(), kUnused);
+    unsigned int next = 0;
+    for (unsigned int &index : indices) {
+        if (remap[index] == kUnused) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    for (auto &v : remap) {
+        if (v == kUnused) {
+            v = next++;
+        }
+    }
+
+    vector<BasicMesh::Vertex> result(vertices.size());
+    for (size_t v = 0; v < vertices.size(); ++v) {
+        result[remap[v]] = vertices[v];
+    }
+    vertices.swap(result);
+}
@@ -0,0 +1,206 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned int kNone = numeric_limits<unsigned int>::max();
+
+void compute_bounds(Meshlet &meshlet, span<const unsigned int> indices, span<const BasicMesh::Vertex> vertices) {
+    glm::vec3 min(numeric_limits<float>::max());
+    glm::vec3 max(numeric_limits<float>::lowest());
+    for (unsigned int index : indices) {
+        min = glm::min(min, vertices[index].position);
+        max = glm::max(max, vertices[index].position);
+    }
+
+    meshlet.center = 0.5f * (min + max);
+    meshlet.radius = 0.0f;
+    for (unsigned int index : indices) {
+        meshlet.radius = glm::max(meshlet.radius, glm::length(vertices[index].position - meshlet.center));
+    }
+
+    // The cone axis is the average face normal, and its spread the largest
+    // angle between the axis and any face normal
+    vector<glm::vec3> normals;
+    normals.reserve(indices.size() / 3);
+    glm::vec3 axis(0.0f);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const glm::vec3 &a = vertices[indices[i]].position;
+        const glm::vec3 &b = vertices[indices[i + 1]].position;
+        const glm::vec3 &c = vertices[indices[i + 2]].position;
+
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals.push_back(normal / length);
+            axis += normals.back();
+        }
+    }
+
+    float axis_length = glm::length(axis);
+    meshlet.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.cone_cutoff = 1.0f;
+    if (normals.empty() || axis_length == 0.0f) {
+        return;
+    }
+
+    float min_dot = 1.0f;
+    for (const auto &normal : normals) {
+        min_dot = glm::min(min_dot, glm::dot(normal, meshlet.cone_axis));
+    }
+
+    // Cones approaching a hemisphere are never back-facing as a whole
+    if (min_dot > 0.1f) {
+        meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+    }
+}
+
+} // namespace
+
+vector<Meshlet> build_meshlets(span<unsigned int> indices, span<const BasicMesh::Vertex> vertices,
+                               size_t max_vertices, size_t max_triangles) {
+    vector<Meshlet> meshlets;
+    size_t num_faces = indices.size() / 3;
+    if (num_faces == 0) {
+        return meshlets;
+    }
+
+    // Vertex to triangle adjacency
+    vector<size_t> offsets(vertices.size() + 1, 0);
+    for (unsigned int index : indices) {
+        ++offsets[index + 1];
+    }
+    for (size_t v = 0; v < vertices.size(); ++v) {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<unsigned int> adjacency(indices.size());
+    {
+        vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            adjacency[cursor[indices[i]]++] = (unsigned int)(i / 3);
+        }
+    }
+
+    vector<bool> emitted(num_faces, false);
+    // The meshlet each vertex was last added to
+    vector<unsigned int> vertex_meshlet(vertices.size(), kNone);
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    size_t seed = 0;
+    while (true) {
+        while (seed < num_faces && emitted[seed]) {
+            ++seed;
+        }
+        if (seed == num_faces) {
+            break;
+        }
+
+        unsigned int id = (unsigned int)meshlets.size();
+        Meshlet meshlet{};
+        meshlet.first_index = output.size();
+
+        vector<unsigned int> meshlet_vertices;
+        glm::vec3 position_sum(0.0f);
+        size_t num_triangles = 0;
+
+        auto triangle_center = [&](unsigned int f) {
+            return (vertices[indices[3 * f]].position + vertices[indices[3 * f + 1]].position +
+                    vertices[indices[3 * f + 2]].position) / 3.0f;
+        };
+
+        auto new_vertices = [&](unsigned int f) {
+            size_t count = 0;
+            for (int i = 0; i < 3; ++i) {
+                count += vertex_meshlet[indices[3 * f + i]] != id;
+            }
+            return count;
+        };
+
+        // Picks the unemitted neighbour of the given vertices that adds the
+        // fewest new vertices, and returns that count in `best_new`
+        auto best_neighbour = [&](span<const unsigned int> from, size_t &best_new) {
+            unsigned int best = kNone;
+            float best_distance = numeric_limits<float>::max();
+            best_new = 4;
+            glm::vec3 center = position_sum / (float)meshlet_vertices.size();
+            for (unsigned int v : from) {
+                for (size_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+                    unsigned int f = adjacency[j];
+                    if (emitted[f]) {
+                        continue;
+                    }
+                    // Ties go to the triangle closest to the meshlet center,
+                    // which keeps meshlets round instead of stringy
+                    size_t count = new_vertices(f);
+                    if (count > best_new) {
+                        continue;
+                    }
+                    float distance = glm::length(triangle_center(f) - center);
+                    if (count < best_new || distance < best_distance) {
+                        best = f;
+                        best_new = count;
+                        best_distance = distance;
+                    }
+                }
+            }
+            return best;
+        };
+
+        unsigned int current = (unsigned int)seed;
+        while (current != kNone) {
+            if (meshlet_vertices.size() + new_vertices(current) > max_vertices) {
+                break;
+            }
+
+            emitted[current] = true;
+            for (int i = 0; i < 3; ++i) {
+                unsigned int v = indices[3 * current + i];
+                output.push_back(v);
+                if (vertex_meshlet[v] != id) {
+                    vertex_meshlet[v] = id;
+                    meshlet_vertices.push_back(v);
+                    position_sum += vertices[v].position;
+                }
+            }
+            if (++num_triangles == max_triangles) {
+                break;
+            }
+
+            // Neighbours of the last triangle are cheap to search, but only
+            // ones that close a gap (at most one new vertex) keep the meshlet
+            // compact; otherwise search the whole meshlet boundary
+            const unsigned int last[3] = {indices[3 * current], indices[3 * current + 1], indices[3 * current + 2]};
+            size_t best_new;
+            current = best_neighbour(last, best_new);
+            if (best_new > 1) {
+                size_t meshlet_best_new;
+                unsigned int meshlet_best = best_neighbour(meshlet_vertices, meshlet_best_new);
+                if (meshlet_best_new < best_new) {
+                    current = meshlet_best;
+                }
+            }
+        }
+
+        meshlet.num_indices = output.size() - meshlet.first_index;
+        meshlets.push_back(meshlet);
+    }
+
+    copy(output.begin(), output.end(), indices.begin());
+
+    for (auto &meshlet : meshlets) {
+        compute_bounds(meshlet, indices.subspan(meshlet.first_index, meshlet.num_indices), vertices);
+    }
+    return meshlets;
+}
+
+bool meshlet_backfacing(const Meshlet &meshlet, glm::vec3 eye) {
+    glm::vec3 to_center = meshlet.center - eye;
+    return glm::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius;
+}
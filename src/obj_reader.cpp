@@ -0,0 +1,363 @@
+#include "obj_reader.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// Chunks smaller than this are not worth a thread of their own
+constexpr size_t kMinChunkSize = 1 << 20;
+
+struct Chunk {
+    const char *begin;
+    const char *end;
+
+    size_t num_positions = 0;
+    size_t num_normals = 0;
+    size_t position_offset = 0;
+    size_t normal_offset = 0;
+
+    vector<unsigned int> indices;
+    vector<pair<unsigned int, unsigned int>> normal_refs;
+
+    string error;
+};
+
+template <typename Func>
+void parallel_for(size_t count, Func &&func) {
+    vector<thread> threads;
+    threads.reserve(count > 0 ? count - 1 : 0);
+    for (size_t i = 1; i < count; ++i) {
+        threads.emplace_back(func, i);
+    }
+    if (count > 0) {
+        func(size_t(0));
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+inline const char *line_end(const char *p, const char *end) {
+    auto eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    return eol ? eol : end;
+}
+
+// Returns the record type at the start of a line: 'v', 'n' (vn), 'f' or 0
+inline char record_type(const char *p, const char *end) {
+    p = skip_spaces(p, end);
+    if (end - p < 2) {
+        return 0;
+    }
+    if (p[0] == 'v') {
+        if (is_space(p[1])) {
+            return 'v';
+        }
+        if (p[1] == 'n' && end - p >= 3 && is_space(p[2])) {
+            return 'n';
+        }
+    } else if (p[0] == 'f' && is_space(p[1])) {
+        return 'f';
+    }
+    return 0;
+}
+
+bool parse_float(const char *&p, const char *end, float &value) {
+    p = skip_spaces(p, end);
+    if (p < end && *p == '+') {
+        ++p;
+    }
+    auto [ptr, ec] = from_chars(p, end, value);
+    if (ec == errc::result_out_of_range) {
+        // Denormals and overflowing values are flushed to zero
+        value = 0.0f;
+    } else if (ec != errc()) {
+        return false;
+    }
+    p = ptr;
+    return true;
+}
+
+bool parse_vec3(const char *p, const char *end, glm::vec3 &value) {
+    return parse_float(p, end, value.x) && parse_float(p, end, value.y) && parse_float(p, end, value.z);
+}
+
+// Parses a 1-based (or negative, relative) OBJ index and converts it to a
+// 0-based absolute index, given the number of elements defined so far.
+bool parse_index(const char *&p, const char *end, size_t defined, size_t total, unsigned int &index) {
+    long long value;
+    auto [ptr, ec] = from_chars(p, end, value);
+    if (ec != errc() || value == 0) {
+        return false;
+    }
+    p = ptr;
+
+    long long resolved = value > 0 ? value - 1 : (long long)defined + value;
+    if (resolved < 0 || (size_t)resolved >= total) {
+        return false;
+    }
+    index = (unsigned int)resolved;
+    return true;
+}
+
+void count_records(Chunk &chunk) {
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *eol = line_end(p, chunk.end);
+        switch (record_type(p, eol)) {
+        case 'v':
+            ++chunk.num_positions;
+            break;
+        case 'n':
+            ++chunk.num_normals;
+            break;
+        }
+        p = eol < chunk.end ? eol + 1 : eol;
+    }
+}
+
+void parse_chunk(Chunk &chunk, BasicMesh::Vertex *vertices, glm::vec3 *normals,
+                 size_t total_positions, size_t total_normals) {
+    size_t num_positions = chunk.position_offset;
+    size_t num_normals = chunk.normal_offset;
+
+    struct Corner {
+        unsigned int position;
+        unsigned int normal;
+        bool has_normal;
+    };
+    vector<Corner> corners;
+
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *eol = line_end(p, chunk.end);
+        const char *line = p;
+        p = eol < chunk.end ? eol + 1 : eol;
+
+        char type = record_type(line, eol);
+        if (type == 0) {
+            continue;
+        }
+
+        const char *q = skip_spaces(line, eol) + (type == 'n' ? 2 : 1);
+
+        if (type == 'v') {
+            if (!parse_vec3(q, eol, vertices[num_positions++].position)) {
+                chunk.error.assign(line, eol);
+                return;
+            }
+            continue;
+        }
+
+        if (type == 'n') {
+            if (!parse_vec3(q, eol, normals[num_normals++])) {
+                chunk.error.assign(line, eol);
+                return;
+            }
+            continue;
+        }
+
+        corners.clear();
+        for (q = skip_spaces(q, eol); q < eol; q = skip_spaces(q, eol)) {
+            Corner corner{};
+            if (!parse_index(q, eol, num_positions, total_positions, corner.position)) {
+                chunk.error.assign(line, eol);
+                return;
+            }
+            if (q < eol && *q == '/') {
+                // Skip the texture coordinate index
+                ++q;
+                while (q < eol && *q != '/' && !is_space(*q)) {
+                    ++q;
+                }
+                if (q < eol && *q == '/') {
+                    ++q;
+                    if (!parse_index(q, eol, num_normals, total_normals, corner.normal)) {
+                        chunk.error.assign(line, eol);
+                        return;
+                    }
+                    corner.has_normal = true;
+                }
+            }
+            corners.push_back(corner);
+        }
+
+        if (corners.size() < 3) {
+            chunk.error.assign(line, eol);
+            return;
+        }
+
+        // Triangulate as a fan around the first corner
+        for (size_t i = 1; i + 1 < corners.size(); ++i) {
+            chunk.indices.push_back(corners[0].position);
+            chunk.indices.push_back(corners[i].position);
+            chunk.indices.push_back(corners[i + 1].position);
+        }
+        for (const auto &corner : corners) {
+            if (corner.has_normal) {
+                chunk.normal_refs.emplace_back(corner.position, corner.normal);
+            }
+        }
+    }
+}
+
+void compute_normals(vector<BasicMesh::Vertex> &vertices, const vector<unsigned int> &indices, size_t num_threads) {
+    TRACE_SCOPE("generate normals");
+    size_t num_faces = indices.size() / 3;
+    vector<glm::vec3> face_normals(num_faces);
+
+    parallel_for(num_threads, [&](size_t t) {
+        size_t begin = num_faces * t / num_threads;
+        size_t end = num_faces * (t + 1) / num_threads;
+        for (size_t f = begin; f < end; ++f) {
+            const glm::vec3 &a = vertices[indices[3 * f]].position;
+            const glm::vec3 &b = vertices[indices[3 * f + 1]].position;
+            const glm::vec3 &c = vertices[indices[3 * f + 2]].position;
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float len = glm::length(n);
+            face_normals[f] = len > 0.0f ? n / len : glm::vec3(0.0f);
+        }
+    });
+
+    for (auto &vertex : vertices) {
+        vertex.normal = glm::vec3(0.0f);
+    }
+    for (size_t f = 0; f < num_faces; ++f) {
+        for (int i = 0; i < 3; ++i) {
+            vertices[indices[3 * f + i]].normal += face_normals[f];
+        }
+    }
+
+    parallel_for(num_threads, [&](size_t t) {
+        size_t begin = vertices.size() * t / num_threads;
+        size_t end = vertices.size() * (t + 1) / num_threads;
+        for (size_t v = begin; v < end; ++v) {
+            float len = glm::length(vertices[v].normal);
+            if (len > 0.0f) {
+                vertices[v].normal /= len;
+            }
+        }
+    });
+}
+
+} // namespace
+
+ObjReader::ObjReader(unsigned int num_threads)
+    : num_threads_(num_threads) {
+    if (num_threads_ == 0) {
+        num_threads_ = max(1u, thread::hardware_concurrency());
+    }
+}
+
+ObjReader::Status ObjReader::read(const char *filename, vector<BasicMesh::Vertex> &vertices, vector<unsigned int> &indices) {
+    TRACE_SCOPE("parse obj");
+    error_.clear();
+
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        error_ = string("cannot open ") + filename;
+        return kFileNotFound;
+    }
+
+    file.seekg(0, ios::end);
+    size_t len = file.tellg();
+    file.seekg(0, ios::beg);
+
+    string data(len, '\0');
+    file.read(data.data(), len);
+    file.close();
+
+    // Split the file into line-aligned chunks
+    const char *begin = data.data();
+    const char *end = begin + data.size();
+
+    size_t num_chunks = clamp<size_t>(len / kMinChunkSize, 1, num_threads_);
+    vector<Chunk> chunks(num_chunks);
+    const char *p = begin;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        const char *split = i + 1 == num_chunks ? end : max(p, begin + len * (i + 1) / num_chunks);
+        if (split < end) {
+            split = line_end(split, end);
+            split = split < end ? split + 1 : end;
+        }
+        chunks[i].begin = p;
+        chunks[i].end = split;
+        p = split;
+    }
+
+    // Pass 1: count vertex records so that each chunk knows where to write
+    parallel_for(num_chunks, [&](size_t i) { count_records(chunks[i]); });
+
+    size_t total_positions = 0;
+    size_t total_normals = 0;
+    for (auto &chunk : chunks) {
+        chunk.position_offset = total_positions;
+        chunk.normal_offset = total_normals;
+        total_positions += chunk.num_positions;
+        total_normals += chunk.num_normals;
+    }
+
+    // Pass 2: parse records straight into the vertex array
+    vertices.resize(total_positions);
+    vector<glm::vec3> normals(total_normals);
+    parallel_for(num_chunks, [&](size_t i) {
+        parse_chunk(chunks[i], vertices.data(), normals.data(), total_positions, total_normals);
+    });
+
+    for (const auto &chunk : chunks) {
+        if (!chunk.error.empty()) {
+            error_ = "unsupported record: " + chunk.error;
+            vertices.clear();
+            indices.clear();
+            return kParseError;
+        }
+    }
+
+    // Concatenate the per-chunk triangle lists
+    vector<size_t> index_offsets(num_chunks + 1, 0);
+    for (size_t i = 0; i < num_chunks; ++i) {
+        index_offsets[i + 1] = index_offsets[i] + chunks[i].indices.size();
+    }
+    indices.resize(index_offsets[num_chunks]);
+    parallel_for(num_chunks, [&](size_t i) {
+        copy(chunks[i].indices.begin(), chunks[i].indices.end(), indices.begin() + index_offsets[i]);
+        vector<unsigned int>().swap(chunks[i].indices);
+    });
+
+    // Use the normals from the file where faces reference them, and generate
+    // the others from the geometry
+    vector<char> referenced(vertices.size(), 0);
+    size_t num_referenced = 0;
+    for (const auto &chunk : chunks) {
+        for (const auto &ref : chunk.normal_refs) {
+            num_referenced += !referenced[ref.first];
+            referenced[ref.first] = 1;
+        }
+    }
+
+    if (num_referenced < vertices.size()) {
+        compute_normals(vertices, indices, num_threads_);
+    }
+    for (const auto &chunk : chunks) {
+        for (const auto &[v, n] : chunk.normal_refs) {
+            vertices[v].normal = normals[n];
+        }
+    }
+
+    return kOk;
+}
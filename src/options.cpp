@@ -0,0 +1,232 @@
+#include "options.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <string_view>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned int kMaxUint = numeric_limits<unsigned int>::max();
+
+// Sets `number` to the whole number `text` if it is in [min, max].
+// Fractions and exponents are rejected rather than truncated. A null `text`
+// is a missing value, which has already been reported.
+template <typename T>
+bool parse_integer(string_view arg, const char *text, T min, T max, T &number) {
+    if (text == nullptr) {
+        return false;
+    }
+    const char *end = text + strlen(text);
+    T parsed = 0;
+    auto [ptr, ec] = from_chars(text, end, parsed);
+    if (ec != errc() || ptr != end || parsed < min || parsed > max) {
+        cerr << "Invalid value for " << arg << ": " << text << endl;
+        return false;
+    }
+    number = parsed;
+    return true;
+}
+
+// Sets `number` to the whole number `text` if it is one of `allowed`
+bool parse_integer(string_view arg, const char *text, initializer_list<int> allowed, int &number) {
+    int parsed;
+    if (!parse_integer(arg, text, numeric_limits<int>::min(), numeric_limits<int>::max(), parsed)) {
+        return false;
+    }
+    if (find(allowed.begin(), allowed.end(), parsed) == allowed.end()) {
+        cerr << "Invalid value for " << arg << ": " << text << endl;
+        return false;
+    }
+    number = parsed;
+    return true;
+}
+
+} // namespace
+
+bool Options::parse(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string_view arg = argv[i];
+
+        // Fetches the value of an option that takes an argument
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                cerr << "Missing value for " << arg << endl;
+                return nullptr;
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return false;
+        } else if (arg == "--optimize-meshes") {
+            optimize_meshes = true;
+        } else if (arg == "--meshlets") {
+            meshlets = true;
+        } else if (arg == "--geometry-heap") {
+            geometry_heap = true;
+        } else if (arg == "--compact-vertices") {
+            compact_vertices = true;
+        } else if (arg == "--no-instancing") {
+            instancing = false;
+        } else if (arg == "--gpu-profile") {
+            gpu_profile = true;
+        } else if (arg == "--gpu-profile-csv") {
+            const char *path = value();
+            if (path == nullptr) {
+                return false;
+            }
+            gpu_profile = true;
+            gpu_profile_csv = path;
+        } else if (arg == "--trace") {
+            const char *path = value();
+            if (path == nullptr) {
+                return false;
+            }
+            trace_file = path;
+        } else if (arg == "--frame-stats") {
+            frame_stats = true;
+        } else if (arg == "--frame-stats-json") {
+            const char *path = value();
+            if (path == nullptr) {
+                return false;
+            }
+            frame_stats_file = path;
+        } else if (arg == "--deferred") {
+            deferred = true;
+        } else if (arg == "--no-shadow-cache") {
+            shadow_cache = false;
+        } else if (arg == "--shadow-strategy") {
+            const char *name = value();
+            if (name == nullptr) {
+                return false;
+            }
+            auto strategy = parse_point_shadow_strategy(name);
+            if (!strategy) {
+                cerr << "Invalid value for " << arg << ": " << name << endl;
+                return false;
+            }
+            shadow_strategy = *strategy;
+        } else if (arg == "--shadow-lod-bias" || arg == "--gpu-profile-dump") {
+            const char *text = value();
+            if (text == nullptr) {
+                return false;
+            }
+            char *end;
+            float number = strtof(text, &end);
+            if (*end != '\0' || !(number >= 0.0f)) {
+                cerr << "Invalid value for " << arg << ": " << text << endl;
+                return false;
+            }
+            if (arg == "--gpu-profile-dump") {
+                gpu_profile = true;
+                gpu_profile_dump_interval = number;
+            } else {
+                shadow_lod_bias = number;
+            }
+        } else if (arg == "--lod-levels") {
+            if (!parse_integer(arg, value(), 0u, kMaxUint, lod_levels)) {
+                return false;
+            }
+        } else if (arg == "--stress") {
+            if (!parse_integer(arg, value(), 0u, kMaxUint, stress_instances)) {
+                return false;
+            }
+        } else if (arg == "--shadow-bench") {
+            if (!parse_integer(arg, value(), 0u, kMaxUint, shadow_bench_frames)) {
+                return false;
+            }
+        } else if (arg == "--lights") {
+            if (!parse_integer(arg, value(), 0u, kMaxLights, lights)) {
+                return false;
+            }
+        } else if (arg == "--shadow-budget") {
+            if (!parse_integer(arg, value(), 1u, kMaxUint, shadow_budget)) {
+                return false;
+            }
+        } else if (arg == "--shadow-size") {
+            if (!parse_integer(arg, value(), 1, numeric_limits<int>::max(), shadow_size)) {
+                return false;
+            }
+        } else if (arg == "--lighting-bench") {
+            if (!parse_integer(arg, value(), 0u, kMaxUint, lighting_bench_frames)) {
+                return false;
+            }
+        } else if (arg == "--shadow-pcf") {
+            if (!parse_integer(arg, value(), {1, 4, 20}, shadow_pcf_taps)) {
+                return false;
+            }
+        } else if (arg == "--shadow-depth-bits") {
+            if (!parse_integer(arg, value(), {16, 24, 32}, shadow_depth_bits)) {
+                return false;
+            }
+        } else if (arg == "--no-mesh-cache") {
+            mesh_cache = false;
+        } else if (arg == "--mesh-cache-dir") {
+            const char *dir = value();
+            if (dir == nullptr) {
+                return false;
+            }
+            mesh_cache_dir = dir;
+        } else if (arg == "--no-program-cache") {
+            program_cache = false;
+        } else if (arg == "--program-cache-dir") {
+            const char *dir = value();
+            if (dir == nullptr) {
+                return false;
+            }
+            program_cache_dir = dir;
+        } else if (arg.starts_with("--")) {
+            cerr << "Unknown option " << arg << endl;
+            print_usage(argv[0]);
+            return false;
+        } else {
+            obj_files.emplace_back(arg);
+        }
+    }
+
+    return true;
+}
+
+void Options::print_usage(const char *program) {
+    cerr << "Usage: " << program << " [options] [model ...]\n"
+         << "\n"
+         << "Without models, the demo scene is shown.\n"
+         << "\n"
+         << "Options:\n"
+         << "  --no-mesh-cache         Do not read or write binary mesh cache files\n"
+         << "  --mesh-cache-dir DIR    Keep mesh cache files in DIR instead of next to the models\n"
+         << "  --no-program-cache      Do not read or write linked shader program binaries\n"
+         << "  --program-cache-dir DIR Keep program binaries in DIR (default shader_cache)\n"
+         << "  --optimize-meshes       Reorder meshes for vertex cache and overdraw efficiency\n"
+         << "  --compact-vertices      Upload quantized 16-bit positions and 10-bit normals\n"
+         << "  --lod-levels N          Generate up to N decimated levels of detail per mesh\n"
+         << "  --shadow-lod-bias X     Use levels of detail X steps coarser for shadows (default 1)\n"
+         << "  --meshlets              Split meshes into meshlets and cull them on the CPU\n"
+         << "  --geometry-heap         Place meshes in shared buffers and draw them with multi-draw calls\n"
+         << "  --stress N              Place N faces in the demo scene\n"
+         << "  --no-instancing         Draw the faces of --stress one by one instead of instanced\n"
+         << "  --shadow-strategy S     Render the shadow map with gs, six-pass or layered (default gs)\n"
+         << "  --no-shadow-cache       Redraw static shadow casters with the dynamic ones\n"
+         << "  --shadow-bench N        Time N frames of each shadow strategy, print the results and exit\n"
+         << "  --lights N              Add N point lights (up to 4096), shaded with clustered forward lighting\n"
+         << "  --shadow-budget N       Give up to N lights shadow maps, the nearest first (default 1)\n"
+         << "  --shadow-size N         Use N x N shadow map faces (default 2048)\n"
+         << "  --shadow-pcf N          Filter shadows with 1, 4 or 20 taps of 2x2 PCF (default 1)\n"
+         << "  --shadow-depth-bits N   Store shadow depth in 16, 24 or 32 bits (default 24)\n"
+         << "  --deferred              Start with deferred shading instead of Phong\n"
+         << "  --lighting-bench N      Time N frames of forward and deferred shading with 1, 16 and 256 lights\n"
+         << "  --gpu-profile           Time the render passes on the GPU and show them in the title\n"
+         << "  --gpu-profile-dump S    Also print pass time statistics every S seconds\n"
+         << "  --gpu-profile-csv FILE  Also write every frame's pass times to FILE\n"
+         << "  --trace FILE            Write CPU timings of startup and frames to FILE as Chrome trace JSON\n"
+         << "  --frame-stats           Show draws, binds and uploads of the last frame in the title\n"
+         << "  --frame-stats-json FILE Write every frame's draws, binds and uploads to FILE as JSON lines\n";
+}
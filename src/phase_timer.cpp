@@ -0,0 +1,31 @@
+#include "phase_timer.h"
+
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+
+PhaseTimer::PhaseTimer()
+    : start_(Clock::now()), last_(start_) {
+}
+
+void PhaseTimer::lap(string name) {
+    auto now = Clock::now();
+    phases_.emplace_back(std::move(name), chrono::duration<double, milli>(now - last_).count());
+    last_ = now;
+}
+
+double PhaseTimer::total_ms() const {
+    return chrono::duration<double, milli>(last_ - start_).count();
+}
+
+void PhaseTimer::print(ostream &out, string_view title) const {
+    ostringstream line;
+    line << fixed << setprecision(1) << title << ": ";
+    for (const auto &[name, ms] : phases_) {
+        line << name << ' ' << ms << " ms, ";
+    }
+    line << "total " << total_ms() << " ms\n";
+    out << line.str();
+}
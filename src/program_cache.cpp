@@ -0,0 +1,145 @@
+#include "program_cache.h"
+#include "atomic_file.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'P', 'B', 'I', 'N'};
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binary_format;
+    uint32_t binary_size;
+};
+
+string gl_string(GLenum name) {
+    auto value = reinterpret_cast<const char *>(glGetString(name));
+    return value ? value : "";
+}
+
+} // namespace
+
+ProgramCache::KeyBuilder::KeyBuilder() : hash_(0xcbf29ce484222325ull) {
+    // A binary is only valid for the driver that produced it
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        string value = gl_string(name);
+        add_bytes(value.data(), value.size() + 1);
+    }
+    add_bytes(&kVersion, sizeof(kVersion));
+}
+
+void ProgramCache::KeyBuilder::add(GLenum type, string_view source) {
+    uint64_t size = source.size();
+    add_bytes(&type, sizeof(type));
+    add_bytes(&size, sizeof(size));
+    add_bytes(source.data(), source.size());
+}
+
+void ProgramCache::KeyBuilder::add_bytes(const void *data, size_t size) {
+    // FNV-1a
+    constexpr uint64_t kPrime = 0x100000001b3ull;
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash_ = (hash_ ^ bytes[i]) * kPrime;
+    }
+}
+
+bool ProgramCache::supported() {
+    if (supported_ < 0) {
+        // Contexts without ARB_get_program_binary leave the count at 0
+        GLint num_formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+        supported_ = num_formats > 0;
+    }
+    return supported_ > 0;
+}
+
+void ProgramCache::print_report(ostream &out) {
+    if (enabled_ && supported_ > 0) {
+        out << "Program cache: " << num_hits_ << " hit(s), " << num_misses_ << " miss(es) in "
+            << directory_ << endl;
+    }
+}
+
+string ProgramCache::cache_path(uint64_t key) {
+    ostringstream name;
+    name << hex << key << ".pbin";
+    return (fs::path(directory_) / name.str()).string();
+}
+
+bool ProgramCache::read(uint64_t key, GLuint program) {
+    string path = cache_path(key);
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) {
+        ++num_misses_;
+        return false;
+    }
+
+    Header header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(Header));
+    if (!in ||
+        memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion ||
+        header.key != key) {
+        ++num_misses_;
+        return false;
+    }
+
+    vector<char> binary(header.binary_size);
+    in.read(binary.data(), binary.size());
+    if (!in) {
+        ++num_misses_;
+        return false;
+    }
+
+    glProgramBinary(program, header.binary_format, binary.data(), (GLsizei)binary.size());
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        // E.g. a driver update that kept the version string
+        cerr << "WARNING::SHADER::PROGRAM::BINARY_REJECTED\nFILE: " << path << endl;
+        ++num_misses_;
+        return false;
+    }
+
+    ++num_hits_;
+    return true;
+}
+
+bool ProgramCache::write(uint64_t key, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return false;
+    }
+
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.key = key;
+    header.binary_format = format;
+    header.binary_size = (uint32_t)length;
+
+    return write_file_atomically(cache_path(key), [&](ostream &out) {
+        out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+        out.write(binary.data(), length);
+        return true;
+    });
+}
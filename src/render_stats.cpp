@@ -0,0 +1,61 @@
+#include "render_stats.h"
+
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// E.g. 950, 12.3k or 4.56M
+string abbreviate(size_t value) {
+    ostringstream out;
+    out.precision(3);
+    if (value >= 1000000) {
+        out << value / 1e6 << 'M';
+    } else if (value >= 1000) {
+        out << value / 1e3 << 'k';
+    } else {
+        out << value;
+    }
+    return out.str();
+}
+
+} // namespace
+
+void RenderStats::end_frame() {
+    last_ = current_;
+    ++frame_;
+
+    if (dump_.is_open()) {
+        dump_ << "{\"frame\":" << frame_
+              << ",\"draw_calls\":" << last_.draw_calls
+              << ",\"triangles\":" << last_.triangles
+              << ",\"vertices\":" << last_.vertices
+              << ",\"state_calls\":" << last_.state_calls
+              << ",\"state_calls_avoided\":" << last_.state_calls_avoided
+              << ",\"program_binds\":" << last_.program_binds
+              << ",\"vertex_array_binds\":" << last_.vertex_array_binds
+              << ",\"texture_binds\":" << last_.texture_binds
+              << ",\"uniform_uploads\":" << last_.uniform_uploads
+              << ",\"uniform_uploads_skipped\":" << last_.uniform_uploads_skipped
+              << ",\"buffer_bytes\":" << last_.buffer_bytes << "}\n";
+    }
+}
+
+bool RenderStats::open_dump(const string &path) {
+    dump_.open(path);
+    if (!dump_.is_open()) {
+        cerr << "ERROR::RENDER_STATS::FILE_NOT_WRITABLE\nFILE: " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+string RenderStats::summary() {
+    return to_string(last_.draw_calls) + " draws, " + abbreviate(last_.triangles) + " triangles, " +
+        abbreviate(last_.vertices) + " vertices, " + to_string(last_.program_binds) + "/" +
+        to_string(last_.vertex_array_binds) + "/" + to_string(last_.texture_binds) +
+        " program/VAO/texture binds, " + to_string(last_.uniform_uploads) + " uniforms, " +
+        abbreviate(last_.buffer_bytes) + "B uploaded";
+}
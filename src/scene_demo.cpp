@@ -1,24 +1,51 @@
 #include "scene_demo.h"
 #include "mesh.h"
+#include "mesh_loader.h"
+#include "phase_timer.h"
+#include "program_cache.h"
+#include "render_stats.h"
 #include "shader.h"
 #include "shadow.h"
+#include "thread_pool.h"
+#include "trace.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <numeric>
 
 using namespace std;
 
-SceneDemo::SceneDemo()
+// Reaches the whole scene, so the main light barely fades
+static constexpr float kMainLightRadius = 2048.0f;
+
+SceneDemo::SceneDemo(Options options)
     : Application(1280, 720, "Scene Demo"),
+      options_(std::move(options)),
       camera_(),
       controller_(camera_, 100.0f, 0.03f),
+      title_time_(0.0f),
+      profile_dump_time_(0.0f),
+      face_object_(0),
+      plane_object_(0),
+      light_cube_object_(0),
+      face_model_(1.0f),
+      plane_model_(1.0f),
+      first_instance_object_(0),
+      shadow_strategy_(options_.shadow_strategy),
+      lighting_bench_step_(0),
+      active_lights_(0),
       wireframe_(false),
       animating_(true),
       pointer_locked_(true),
-      shader_type_(ShaderType::kPhong),
+      shader_type_(options_.deferred ? ShaderType::kDeferred : ShaderType::kPhong),
       blinn_(true),
       shadows_(true) {
     // Capture cursor
@@ -32,17 +59,65 @@ int SceneDemo::init() {
     // Turn on vsync
     glfwSwapInterval(1);
 
-    glEnable(GL_DEPTH_TEST);
     glEnable(GL_FRAMEBUFFER_SRGB);
+    ShaderProgram::enable_parallel_compile((GLADloadproc)glfwGetProcAddress);
 
-    if (!load_meshes()) {
+    if (shadow_strategy_ == PointShadowStrategy::kLayered && !PointShadowMap::layered_supported()) {
+        cerr << "WARNING::SHADOW::LAYERED_UNSUPPORTED\nNeither GL_ARB_shader_viewport_layer_array nor "
+                "GL_AMD_vertex_shader_layer is available; using six-pass" << endl;
+        shadow_strategy_ = PointShadowStrategy::kSixPass;
+    }
+    if (options_.shadow_bench_frames > 0) {
+        shadow_strategy_ = PointShadowStrategy::kGeometryShader;
+    }
+    if (options_.lighting_bench_frames > 0) {
+        options_.lights = max(options_.lights, kLightingBenchCounts[size(kLightingBenchCounts) - 1] - 1);
+    }
+    // More slots than lights would never be used
+    options_.shadow_budget = (unsigned int)min<size_t>(options_.shadow_budget, (size_t)options_.lights + 1);
+    if (options_.shadow_budget > 1 && !PointShadowMap::array_supported()) {
+        cerr << "WARNING::SHADOW::CUBE_MAP_ARRAY_UNSUPPORTED\nGL_ARB_texture_cube_map_array is not available; "
+                "only the main light casts shadows" << endl;
+        options_.shadow_budget = 1;
+    }
+
+    // Submit all compiles while the workers parse, and only wait for them
+    // once the meshes are uploaded
+    PhaseTimer timer;
+    ThreadPool pool;
+    auto loader = start_loading_meshes(pool);
+    timer.lap("queue meshes");
+    if (!submit_shaders()) {
+        return 1;
+    }
+    timer.lap("submit shaders");
+    if (!finish_loading_meshes(*loader)) {
         return 1;
     }
-    if (!load_shaders()) {
+    timer.lap("load meshes");
+
+    size_t num_ready = count_if(shaders_.begin(), shaders_.end(), [](auto *shader) { return shader->is_ready(); }) +
+        phong_variants_->num_ready();
+    if (!finish_shaders()) {
         return 1;
     }
+    timer.lap("finish shaders");
+
     init_shadow_map();
     init_scene();
+    timer.lap("init scene");
+
+    if (options_.gpu_profile) {
+        gpu_profiler_ = make_unique<GpuProfiler>();
+        if (!options_.gpu_profile_csv.empty() && !gpu_profiler_->open_csv(options_.gpu_profile_csv)) {
+            return 1;
+        }
+    }
+
+    timer.print(cout, "Init");
+    if (ShaderProgram::parallel_compile()) {
+        cout << num_ready << "/" << shaders_.size() + phong_variants_->num_variants() << " programs were ready after loading meshes" << endl;
+    }
 
     return 0;
 }
@@ -53,35 +128,122 @@ int SceneDemo::init() {
         return false; \
     }
 
-bool SceneDemo::load_meshes() {
+unique_ptr<MeshLoader> SceneDemo::start_loading_meshes(ThreadPool &pool) {
+    MeshLoadOptions load_options;
+    load_options.optimize = options_.optimize_meshes;
+    load_options.lod_levels = options_.lod_levels;
+    load_options.meshlets = options_.meshlets;
+    if (options_.compact_vertices) {
+        load_options.vertex_format = VertexFormat::kCompact;
+    }
+
+    if (options_.geometry_heap) {
+        geometry_heap_ = make_unique<GeometryHeap>(load_options.vertex_format);
+    }
+
+    auto loader = make_unique<MeshLoader>(pool, load_options, geometry_heap_.get());
+
     mesh_ = make_unique<BasicMesh>();
-    TRY(mesh_->load("models/face.obj"));
-    mesh_->setup();
+    loader->enqueue("models/face.obj", *mesh_);
 
     cube_mesh_ = make_unique<BasicMesh>();
-    TRY(cube_mesh_->load("models/cube.obj"));
-    cube_mesh_->setup();
+    loader->enqueue("models/cube.obj", *cube_mesh_);
 
     plane_mesh_ = make_unique<BasicMesh>();
-    TRY(plane_mesh_->load("models/plane.obj"));
-    plane_mesh_->setup();
+    loader->enqueue("models/plane.obj", *plane_mesh_);
+
+    return loader;
+}
+
+bool SceneDemo::finish_loading_meshes(MeshLoader &loader) {
+    bool loaded = loader.finish();
+    loader.print_report(cout);
+    if (geometry_heap_) {
+        print_geometry_heap_stats(cout, geometry_heap_->stats());
+    }
+    TRY(loaded);
+
+    return true;
+}
+
+bool SceneDemo::submit_shaders() {
+    auto submit = [this](unique_ptr<ShaderProgram> &shader) -> ShaderProgram & {
+        shader = make_unique<ShaderProgram>();
+        shaders_.push_back(shader.get());
+        return *shader;
+    };
+
+    auto submit_shadow = [&](unique_ptr<ShaderProgram> &shader, PointShadowStrategy strategy, const char *defines) {
+        if (strategy == PointShadowStrategy::kGeometryShader) {
+            return submit(shader).submit_vgf("shader/point_shadow", defines);
+        }
+        return submit(shader).submit({
+            {GL_VERTEX_SHADER, "shader/point_shadow_face.vs"},
+            {GL_FRAGMENT_SHADER, "shader/point_shadow.fs"}
+        }, defines);
+    };
+
+    TRY(submit(light_cube_shader_).submit_vf("shader/simple"));
+
+    // All strategies are built, so that they can be switched at run time
+    using enum PointShadowStrategy;
+    TRY(submit_shadow(point_shadow_shaders_[(int)kGeometryShader], kGeometryShader, ""));
+    TRY(submit_shadow(point_shadow_shaders_[(int)kSixPass], kSixPass, ""));
+    if (PointShadowMap::layered_supported()) {
+        TRY(submit_shadow(point_shadow_shaders_[(int)kLayered], kLayered, "#define LAYERED\n"));
+    }
+
+    // Instance IDs select the faces of the layered strategy, so it draws
+    // instances with the geometry shader
+    if (options_.stress_instances > 0 && options_.instancing) {
+        const char *defines = "#define INSTANCED\n";
+        TRY(submit_shadow(point_shadow_instanced_shaders_[(int)kGeometryShader], kGeometryShader, defines));
+        TRY(submit_shadow(point_shadow_instanced_shaders_[(int)kSixPass], kSixPass, defines));
+    }
+
+    // Only the variant of the first frame is built up front; the others are
+    // compiled when the flags first ask for them
+    phong_variants_ = make_lit_variants("shader/phong");
+    gouraud_variants_ = make_lit_variants("shader/gouraud");
+    phong_variants_->prepare(lit_features(options_.stress_instances > 0 && options_.instancing));
+    deferred_ = make_unique<DeferredRenderer>();
+    if (shader_type_ == ShaderType::kDeferred || options_.lighting_bench_frames > 0) {
+        deferred_->prepare(lit_features(options_.stress_instances > 0 && options_.instancing));
+    }
 
     return true;
 }
 
-bool SceneDemo::load_shaders() {
-    // Load shader programs
-    phong_shader_ = make_unique<ShaderProgram>();
-    TRY(phong_shader_->build_from_vf("shader/phong"));
+bool SceneDemo::finish_shaders() {
+    for (ShaderProgram *shader : shaders_) {
+        TRY(shader->finish());
+        TRY(bind_uniform_blocks(*shader));
+    }
+    TRY(phong_variants_->get(lit_features(options_.stress_instances > 0 && options_.instancing)));
+
+    for (int i = 0; i < kNumPointShadowStrategies; ++i) {
+        if (point_shadow_shaders_[i]) {
+            point_shadow_uniforms_[i] = PointShadowUniforms(*point_shadow_shaders_[i]);
+            point_shadow_pipelines_[i] = make_unique<PipelineState>(*point_shadow_shaders_[i]);
+        }
+        if (point_shadow_instanced_shaders_[i]) {
+            point_shadow_instanced_uniforms_[i] = PointShadowUniforms(*point_shadow_instanced_shaders_[i]);
+            point_shadow_instanced_pipelines_[i] = make_unique<PipelineState>(*point_shadow_instanced_shaders_[i]);
+        }
+    }
 
-    gouraud_shader_ = make_unique<ShaderProgram>();
-    TRY(gouraud_shader_->build_from_vf("shader/gouraud"));
+    for (bool wireframe : {false, true}) {
+        RasterState raster;
+        raster.polygon_mode = wireframe ? GL_LINE : GL_FILL;
+        lit_rasters_[wireframe] = raster;
+        light_cube_pipelines_[wireframe] = make_unique<PipelineState>(*light_cube_shader_, raster);
+    }
 
-    light_cube_shader_ = make_unique<ShaderProgram>();
-    TRY(light_cube_shader_->build_from_vf("shader/simple"));
+    frame_uniforms_ = make_unique<UniformBuffer>(sizeof(FrameBlock), kFrameBinding);
+    lighting_uniforms_ = make_unique<UniformBuffer>(sizeof(LightingBlock), kLightingBinding);
+    object_uniforms_ = make_unique<ObjectUniformBuffer>(sizeof(ObjectBlock), kObjectBinding);
 
-    point_shadow_shader_ = make_unique<ShaderProgram>();
-    TRY(point_shadow_shader_->build_from_vgf("shader/point_shadow"));
+    ProgramCache::print_report(cout);
 
     return true;
 }
@@ -89,7 +251,13 @@ bool SceneDemo::load_shaders() {
 #undef TRY
 
 void SceneDemo::init_shadow_map() {
-    shadow_map_ = make_unique<PointShadowMap>(2048, 2048, 1.0f, 1024.0f);
+    shadow_map_ = make_unique<PointShadowMap>(options_.shadow_size, options_.shadow_size, 1.0f, 1024.0f,
+                                              (int)options_.shadow_budget, options_.shadow_cache,
+                                              options_.shadow_depth_bits);
+    cout << "Shadow map: " << options_.shadow_budget << " x 6 faces of " << options_.shadow_size << "x"
+         << options_.shadow_size << ", " << options_.shadow_depth_bits << "-bit depth, "
+         << shadow_map_->memory_size() / (1024 * 1024) << " MiB" << endl;
+    shadow_slots_.resize(options_.shadow_budget);
 }
 
 void SceneDemo::init_scene() {
@@ -100,121 +268,697 @@ void SceneDemo::init_scene() {
     light_color_ = glm::vec3(1.0f, 1.0f, 1.0f);
 
     angle_ = 0.0f;
+
+    if (options_.stress_instances > 0) {
+        init_instances(options_.stress_instances);
+    }
+    if (options_.lights > 0) {
+        init_lights(options_.lights);
+    }
+    if (options_.lighting_bench_frames > 0) {
+        start_lighting_bench_step(0);
+    }
+}
+
+void SceneDemo::init_instances(unsigned int count) {
+    // A square grid centered on the origin, spaced by the face's footprint
+    glm::vec3 extent = mesh_->max() - mesh_->min();
+    float spacing = 1.2f * glm::max(extent.x, extent.z);
+    unsigned int columns = (unsigned int)ceil(sqrt((double)count));
+    float offset = 0.5f * (columns - 1) * spacing;
+
+    instance_models_.resize(count);
+    instance_colors_.resize(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        glm::vec3 position((i % columns) * spacing - offset, 0.0f, (i / columns) * spacing - offset);
+        instance_models_[i] = glm::translate(glm::mat4(1.0f), position);
+
+        // Hues in golden ratio steps, so that neighbours differ
+        float hue = fmodf(i * 0.618034f, 1.0f);
+        for (int c = 0; c < 3; ++c) {
+            instance_colors_[i][c] = 0.5f + 0.5f * cosf(6.283185f * (hue + c / 3.0f));
+        }
+    }
+
+    if (options_.instancing) {
+        mesh_->set_instances(instance_models_, instance_colors_);
+    }
+}
+
+void SceneDemo::init_lights(unsigned int count) {
+    clustered_lighting_ = make_unique<ClusteredLighting>();
+
+    // Index 0 is the main light, set every frame
+    lights_.resize((size_t)count + 1);
+    active_lights_ = lights_.size();
+    light_origins_.resize(lights_.size());
+    light_speeds_.resize(lights_.size());
+    for (unsigned int i = 1; i <= count; ++i) {
+        // Spread evenly over the ground by golden angle steps
+        float distance = 280.0f * sqrtf((i - 0.5f) / count);
+        float angle = i * 2.399963f;
+        float height = 15.0f + 40.0f * fmodf(i * 0.618034f, 1.0f);
+        light_origins_[i] = glm::vec3(distance * cosf(angle), height, distance * sinf(angle));
+        light_speeds_[i] = (i % 2 ? 1.0f : -1.0f) * (0.5f + fmodf(i * 0.381966f, 1.0f));
+
+        PointLight &light = lights_[i];
+        light.radius = 40.0f + 60.0f * fmodf(i * 0.754878f, 1.0f);
+        float hue = fmodf(i * 0.618034f, 1.0f);
+        for (int c = 0; c < 3; ++c) {
+            light.color[c] = 0.5f + 0.5f * cosf(6.283185f * (hue + c / 3.0f));
+        }
+    }
 }
 
 int SceneDemo::render() {
+    if (gpu_profiler_) {
+        gpu_profiler_->begin_frame();
+    }
+
     if (animating_) {
         angle_ += 45.0f * delta_time_;
     }
 
-    // 1. Render shadow map
-    shadow_map_->bind();
-
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    float fov = glm::radians(45.0f);
+    float aspect = (float)width_ / height_;
+    float near = 0.1f;
+    float far = 1000.0f;
+    glm::mat4 projection = glm::perspective(fov, aspect, near, far);
 
-    point_shadow_shader_->use();
+    glm::mat4 view = camera_.view_matrix();
 
-    point_shadow_shader_->set_vec3("lightPos", light_pos_);
-    point_shadow_shader_->set_float("far", shadow_map_->far());
-    for (int i = 0; i < 6; i++) {
-        string name = "shadowMatrices[" + to_string(i) + "]";
-        point_shadow_shader_->set_mat4(name.c_str(), shadow_map_->shadow_matrix(i));
+    update_uniforms(projection, view);
+    {
+        TRACE_SCOPE("update lights");
+        update_lights();
+        if (clustered_lighting_) {
+            clustered_lighting_->update(span(lights_).first(active_lights_), view, projection, near, far, width_,
+                                        height_);
+        }
     }
 
-    render_pass(*point_shadow_shader_, true);
+    // 1. Render shadow map
+    {
+        TRACE_SCOPE("shadow");
+        GpuProfiler::Scope scope(gpu_profiler_.get(), "shadow");
+        if (options_.shadow_bench_frames > 0) {
+            render_shadow_bench();
+        } else {
+            update_shadow_map();
+        }
+    }
 
     // 2. Render scene
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, width_, height_);
+    GlState::bind_framebuffer(0);
+    GlState::viewport(0, 0, width_, height_);
     glClearColor(0.05f, 0.08f, 0.12f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    if (wireframe_) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    GlState::bind_texture(shadow_map_->texture_target(), shadow_map_->depth_cubemap(), kShadowUnit);
+    if (clustered_lighting_) {
+        clustered_lighting_->bind();
     }
 
-    float fov = glm::radians(45.0f);
-    float aspect = (float)width_ / height_;
-    glm::mat4 projection = glm::perspective(fov, aspect, 0.1f, 1000.0f);
+    // Only the scene pass differs between forward and deferred shading, so
+    // the lighting benchmark times just that
+    chrono::steady_clock::time_point start;
+    if (options_.lighting_bench_frames > 0) {
+        glFinish();
+        start = chrono::steady_clock::now();
+    }
 
-    glm::mat4 view = camera_.view_matrix();
+    meshlet_stats_ = {};
+    PassView pass{camera_.position(), 0.5f * projection[1][1] * height_, projection * view};
+    {
+        TRACE_SCOPE("scene");
+        GpuProfiler::Scope scope(gpu_profiler_.get(), "scene");
+        if (shader_type_ == ShaderType::kDeferred) {
+            {
+                GpuProfiler::Scope geometry_scope(gpu_profiler_.get(), "geometry");
+                deferred_->begin_geometry_pass(width_, height_);
+                render_pass(pass);
+            }
+            GpuProfiler::Scope lighting_scope(gpu_profiler_.get(), "lighting");
+            deferred_->light(lit_features(false), 0);
+        } else {
+            render_pass(pass);
+        }
+    }
+
+    if (options_.lighting_bench_frames > 0) {
+        glFinish();
+        record_lighting_bench(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+
+    {
+        GpuProfiler::Scope scope(gpu_profiler_.get(), "light cube");
+        GlState::bind(*light_cube_pipelines_[wireframe_]);
+
+        object_uniforms_->bind(light_cube_object_);
+        cube_mesh_->draw();
+    }
 
-    const ShaderProgram &shader = shader_type_ == ShaderType::kPhong ? *phong_shader_ : *gouraud_shader_;
+    if (gpu_profiler_) {
+        TRACE_SCOPE("collect gpu timings");
+        gpu_profiler_->end_frame();
+        float interval = options_.gpu_profile_dump_interval;
+        if (interval > 0.0f && time_ - profile_dump_time_ >= interval) {
+            profile_dump_time_ = time_;
+            gpu_profiler_->print(cout);
+        }
+    }
 
-    shader.use();
+    update_title();
+
+    return 0;
+}
+
+void SceneDemo::update_title() {
+    if (time_ - title_time_ < 0.5f) {
+        return;
+    }
+    title_time_ = time_;
 
-    shader.set_mat4("projection", projection);
-    shader.set_mat4("view", view);
-    shader.set_vec3("viewPos", camera_.position());
+    const FrameStats &frame_stats = RenderStats::last();
+    string title = "Scene Demo - state calls: " + to_string(frame_stats.state_calls) + " issued, " +
+        to_string(frame_stats.state_calls_avoided) + " avoided";
+    if (options_.stress_instances > 0) {
+        title += ", " + to_string(instance_models_.size()) + (options_.instancing ? " instanced" : " separate") + " faces";
+    }
+    if (clustered_lighting_) {
+        const ClusterStats &light_stats = clustered_lighting_->stats();
+        title += ", lights: " + to_string(light_stats.visible_lights) + "/" + to_string(light_stats.lights) +
+            " visible, " + to_string(light_stats.max_cluster_lights) + " max per cluster";
+    }
+    if (shadows_) {
+        title += string(", shadows: ") + point_shadow_strategy_name(shadow_strategy_) + ", " +
+            to_string(options_.shadow_pcf_taps) + " taps, " +
+            to_string(shadow_stats_.faces_updated) + "/" + to_string(6 * shadow_stats_.slots_used) +
+            " faces updated, " + to_string(shadow_stats_.static_slots_updated) + " static, " +
+            to_string(shadow_stats_.draw_calls) + " draws, " + to_string(shadow_stats_.far_culled) + " far culled";
+    }
+    if (gpu_profiler_) {
+        title += ", gpu: " + gpu_profiler_->summary();
+    }
+    if (options_.frame_stats) {
+        title += ", frame: " + RenderStats::summary();
+    }
+    if (options_.meshlets) {
+        title += ", meshlets: " + to_string(meshlet_stats_.drawn) + "/" +
+            to_string(meshlet_stats_.tested) + " drawn, " + to_string(meshlet_stats_.frustum_culled) +
+            " frustum culled, " + to_string(meshlet_stats_.backface_culled) + " backface culled";
+    }
+    glfwSetWindowTitle(window_, title.c_str());
+}
 
-    shader.set_vec3("lightPos", light_pos_);
-    shader.set_vec3("light.ambient", 0.05f * light_color_);
-    shader.set_vec3("light.diffuse", 0.85f * light_color_);
-    shader.set_vec3("light.specular", light_color_);
-    shader.set_bool("light.blinn", blinn_);
+void SceneDemo::update_uniforms(const glm::mat4 &projection, const glm::mat4 &view) {
+    FrameBlock frame{};
+    frame.projection = projection;
+    frame.view = view;
+    frame.view_pos = camera_.position();
+    frame.inverse_view_projection = glm::inverse(projection * view);
+    frame_uniforms_->update(frame);
+
+    LightingBlock lighting{};
+    lighting.ambient = 0.05f * light_color_;
+    lighting.diffuse = 0.85f * light_color_;
+    lighting.specular = light_color_;
+    lighting.light_pos = light_pos_;
+    lighting.far = shadow_map_->far();
+    lighting.near = shadow_map_->near();
+    lighting.shadow_texel_size = 2.0f / shadow_map_->width();
+    lighting_uniforms_->update(lighting);
+
+    object_uniforms_->clear();
+
+    face_model_ = glm::mat4(1.0f);
+    face_model_ = glm::rotate(face_model_, glm::radians(angle_), glm::vec3(0.0f, 1.0f, 0.0f));
+    face_model_ = glm::translate(face_model_, -glm::vec3(300.0f, 50.0f, 0.0f));
+
+    ObjectBlock face = object_block(face_model_, mesh_->position_transform());
+    glm::vec3 object_color(0.90f, 0.50f, 0.35f);
+    face.ambient = object_color;
+    face.diffuse = object_color;
+    face.specular = glm::vec3(0.5f);
+    face.shininess = 16.0f;
+    face_object_ = object_uniforms_->add(face);
+
+    // Without instancing, every face of the stress mode has its own block
+    if (!options_.instancing) {
+        first_instance_object_ = object_uniforms_->size();
+        for (size_t i = 0; i < instance_models_.size(); ++i) {
+            ObjectBlock instance = object_block(instance_models_[i] * face_model_, mesh_->position_transform());
+            instance.ambient = instance_colors_[i];
+            instance.diffuse = instance_colors_[i];
+            instance.specular = face.specular;
+            instance.shininess = face.shininess;
+            object_uniforms_->add(instance);
+        }
+    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, shadow_map_->depth_cubemap());
-    shader.set_bool("shadows", shadows_);
-    shader.set_int("depthCubemap", 0);
-    shader.set_float("far", shadow_map_->far());
+    plane_model_ = glm::mat4(1.0f);
+    plane_model_ = glm::scale(plane_model_, glm::vec3(600.0f, 1.0f, 600.0f));
+    plane_model_ = glm::translate(plane_model_, glm::vec3(0.0f, 0.0f, 0.0f));
 
-    render_pass(shader, false);
+    ObjectBlock plane = object_block(plane_model_, plane_mesh_->position_transform());
+    glm::vec3 plane_color(0.80f, 0.82f, 0.85f);
+    plane.ambient = plane_color;
+    plane.diffuse = 0.5f * plane_color;
+    plane.specular = glm::vec3(0.5f);
+    plane.shininess = 16.0f;
+    plane_object_ = object_uniforms_->add(plane);
 
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(model, light_pos_);
     model = glm::scale(model, glm::vec3(5.0f));
 
-    light_cube_shader_->use();
+    ObjectBlock light_cube = object_block(model, cube_mesh_->position_transform());
+    light_cube.diffuse = light_color_;
+    light_cube_object_ = object_uniforms_->add(light_cube);
 
-    light_cube_shader_->set_mat4("projection", projection);
-    light_cube_shader_->set_mat4("view", view);
-    light_cube_shader_->set_mat4("model", model);
-    light_cube_shader_->set_vec3("objectColor", light_color_);
+    object_uniforms_->upload();
+}
+
+uint32_t SceneDemo::lit_features(bool instanced) const {
+    uint32_t features = 0;
+    if (blinn_) {
+        features |= kBlinnFeature;
+    }
+    if (shadows_) {
+        features |= kShadowsFeature;
+    }
+    if (instanced) {
+        features |= kInstancedFeature;
+    }
+    if (options_.lights > 0) {
+        features |= kClusteredFeature;
+    }
+    if (shadows_ && options_.shadow_budget > 1) {
+        features |= kShadowArrayFeature;
+    }
+    if (shadows_) {
+        features |= pcf_feature(options_.shadow_pcf_taps);
+    }
+    return features;
+}
 
-    cube_mesh_->draw();
+bool SceneDemo::bind_lit_pipeline(bool instanced) {
+    if (shader_type_ == ShaderType::kDeferred) {
+        return deferred_->bind_geometry_pipeline(instanced, lit_rasters_[wireframe_]);
+    }
 
-    return 0;
+    ShaderVariants &variants = shader_type_ == ShaderType::kPhong ? *phong_variants_ : *gouraud_variants_;
+    const ShaderProgram *program = variants.get(lit_features(instanced));
+    if (!program) {
+        return false;
+    }
+    GlState::bind(PipelineState(*program, lit_rasters_[wireframe_]));
+    return true;
 }
 
-void SceneDemo::render_pass(const ShaderProgram &shader, bool shadow_pass) {
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::rotate(model, glm::radians(angle_), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::translate(model, -glm::vec3(300.0f, 50.0f, 0.0f));
+void SceneDemo::render_pass(const PassView &view) {
+    bool instanced = options_.stress_instances > 0 && options_.instancing;
+    if (instanced && bind_lit_pipeline(true)) {
+        object_uniforms_->bind(face_object_);
 
-    shader.set_mat4("model", model);
+        // All instances share the finest level of detail
+        mesh_->draw_instanced();
+    }
 
-    if (!shadow_pass) {
-        shader.set_mat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model))));
+    if (!bind_lit_pipeline(false)) {
+        return;
+    }
 
-        glm::vec3 object_color(0.90f, 0.50f, 0.35f);
-        shader.set_vec3("material.ambient", object_color);
-        shader.set_vec3("material.diffuse", object_color);
-        shader.set_vec3("material.specular", glm::vec3(0.5f));
-        shader.set_float("material.shininess", 16.0f);
+    if (!instanced) {
+        draw_faces(view);
     }
 
-    mesh_->draw();
+    object_uniforms_->bind(plane_object_);
+    plane_mesh_->draw();
+}
+
+void SceneDemo::draw_faces(const PassView &view) {
+    auto draw = [&](const glm::mat4 &model) {
+        size_t lod = mesh_->select_lod(model, view.eye, view.pixel_scale);
+        if (lod == 0 && view.view_projection) {
+            mesh_->draw_culled(model, *view.view_projection, view.eye, meshlet_stats_);
+        } else {
+            mesh_->draw(lod);
+        }
+    };
+
+    if (instance_models_.empty()) {
+        object_uniforms_->bind(face_object_);
+        draw(face_model_);
+        return;
+    }
 
-    model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(600.0f, 1.0f, 600.0f));
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
+    for (size_t i = 0; i < instance_models_.size(); ++i) {
+        object_uniforms_->bind(first_instance_object_ + i);
+        draw(instance_models_[i] * face_model_);
+    }
+}
 
-    shader.set_mat4("model", model);
+void SceneDemo::update_lights() {
+    // The main light always has slot 0
+    shadow_slots_[0].light = 0;
+    if (!clustered_lighting_) {
+        return;
+    }
 
-    if (!shadow_pass) {
-        shader.set_mat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model))));
+    lights_[0] = {light_pos_, kMainLightRadius, 0.85f * light_color_, 0};
+    for (size_t i = 1; i < active_lights_; ++i) {
+        glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle_ * light_speeds_[i]),
+                                         glm::vec3(0.0f, 1.0f, 0.0f));
+        lights_[i].position = glm::vec3(rotation * glm::vec4(light_origins_[i], 1.0f));
+        lights_[i].shadow_slot = -1;
+    }
 
-        glm::vec3 plane_color(0.80f, 0.82f, 0.85f);
-        shader.set_vec3("material.ambient", plane_color);
-        shader.set_vec3("material.diffuse", 0.5f * plane_color);
-        shader.set_vec3("material.specular", glm::vec3(0.5f));
-        shader.set_float("material.shininess", 16.0f);
+    // The other slots go to the lights nearest to the camera
+    size_t num_shadowed = min(shadow_slots_.size() - 1, active_lights_ - 1);
+    nearest_lights_.resize(active_lights_ - 1);
+    iota(nearest_lights_.begin(), nearest_lights_.end(), 1);
+    glm::vec3 eye = camera_.position();
+    partial_sort(nearest_lights_.begin(), nearest_lights_.begin() + num_shadowed, nearest_lights_.end(),
+                 [&](int a, int b) {
+                     glm::vec3 to_a = lights_[a].position - eye;
+                     glm::vec3 to_b = lights_[b].position - eye;
+                     return glm::dot(to_a, to_a) < glm::dot(to_b, to_b);
+                 });
+    nearest_lights_.resize(num_shadowed);
+
+    // Lights that stay among the nearest keep their slot, and with it their
+    // cached map
+    for (size_t i = 1; i < shadow_slots_.size(); ++i) {
+        ShadowSlot &slot = shadow_slots_[i];
+        bool kept = slot.light >= 0 &&
+            find(nearest_lights_.begin(), nearest_lights_.end(), slot.light) != nearest_lights_.end();
+        if (kept) {
+            lights_[slot.light].shadow_slot = (int)i;
+        } else {
+            slot.light = -1;
+        }
+    }
+    size_t free_slot = 1;
+    for (int light : nearest_lights_) {
+        if (lights_[light].shadow_slot >= 0) {
+            continue;
+        }
+        while (shadow_slots_[free_slot].light >= 0) {
+            ++free_slot;
+        }
+        shadow_slots_[free_slot].light = light;
+        shadow_slots_[free_slot].valid = false;
+        lights_[light].shadow_slot = (int)free_slot;
     }
+}
 
-    plane_mesh_->draw();
+void SceneDemo::collect_shadow_casters(const glm::vec3 &light_pos) {
+    static_casters_.clear();
+    dynamic_casters_.clear();
+
+    auto add = [&](vector<ShadowCaster> &casters, const BasicMesh &mesh, size_t object, const glm::mat4 &model,
+                   size_t lod) {
+        auto [center, radius] = mesh.bounding_sphere(model);
+        uint32_t faces = shadow_map_->face_mask(center - light_pos, radius);
+        if (faces == 0) {
+            ++shadow_stats_.far_culled;
+            return;
+        }
+        casters.push_back({&mesh, object, model, lod, faces, false});
+    };
+
+    // Cube faces have a 90 degree field of view, so projection[1][1] is 1,
+    // and shadows tolerate coarser geometry than the shaded view
+    float pixel_scale = 0.5f * shadow_map_->height();
+    auto add_face = [&](size_t object, const glm::mat4 &model) {
+        size_t lod = mesh_->select_lod(model, light_pos, pixel_scale, options_.shadow_lod_bias);
+        add(dynamic_casters_, *mesh_, object, model, lod);
+    };
+
+    // The faces turn, while the ground never moves
+    if (instance_models_.empty()) {
+        add_face(face_object_, face_model_);
+    } else if (!options_.instancing) {
+        for (size_t i = 0; i < instance_models_.size(); ++i) {
+            add_face(first_instance_object_ + i, instance_models_[i] * face_model_);
+        }
+    } else {
+        // Instanced faces are drawn in one call, on every face
+        dynamic_casters_.push_back({mesh_.get(), face_object_, face_model_, 0, kAllCubeFaces, true});
+    }
+    add(static_casters_, *plane_mesh_, plane_object_, plane_model_, 0);
+}
+
+void SceneDemo::update_shadow_map() {
+    shadow_stats_ = {};
+
+    // The lit variants without SHADOWS do not sample the map, so it may go
+    // stale until shadows are enabled again
+    if (!shadows_) {
+        return;
+    }
+
+    for (int i = 0; i < (int)shadow_slots_.size(); ++i) {
+        if (shadow_slots_[i].light >= 0) {
+            update_shadow_slot(i);
+            ++shadow_stats_.slots_used;
+        }
+    }
+}
+
+void SceneDemo::update_shadow_slot(int slot) {
+    using enum PointShadowTarget;
+
+    ShadowSlot &state = shadow_slots_[slot];
+    glm::vec3 light_pos = lights_.empty() ? light_pos_ : lights_[state.light].position;
+
+    collect_shadow_casters(light_pos);
+
+    bool static_changed = !state.valid || light_pos != state.light_pos ||
+        static_casters_ != state.static_casters;
+    bool dynamic_changed = static_changed || dynamic_casters_ != state.dynamic_casters;
+
+    if (!shadow_map_->cached()) {
+        if (dynamic_changed) {
+            shadow_map_->clear(slot);
+            draw_shadow_casters(static_casters_, slot, light_pos, kAllCubeFaces, kShadow);
+            draw_shadow_casters(dynamic_casters_, slot, light_pos, kAllCubeFaces, kShadow);
+            shadow_stats_.faces_updated += 6;
+        }
+    } else {
+        uint32_t faces = 0;
+        if (static_changed) {
+            shadow_map_->clear(slot, kStatic);
+            draw_shadow_casters(static_casters_, slot, light_pos, kAllCubeFaces, kStatic);
+            ++shadow_stats_.static_slots_updated;
+            faces = kAllCubeFaces;
+        } else if (dynamic_changed) {
+            // Faces that showed the dynamic casters before, and those that
+            // show them now; the others are already up to date
+            for (const ShadowCaster &caster : state.dynamic_casters) {
+                faces |= caster.faces;
+            }
+            for (const ShadowCaster &caster : dynamic_casters_) {
+                faces |= caster.faces;
+            }
+        }
+
+        if (faces != 0) {
+            shadow_map_->copy_static_faces(slot, faces);
+            draw_shadow_casters(dynamic_casters_, slot, light_pos, faces, kShadow);
+            shadow_stats_.faces_updated += popcount(faces);
+        }
+    }
+
+    state.valid = true;
+    state.light_pos = light_pos;
+    state.static_casters = static_casters_;
+    state.dynamic_casters = dynamic_casters_;
+}
+
+void SceneDemo::draw_shadow_casters(span<const ShadowCaster> casters, int slot, const glm::vec3 &light_pos,
+                                    uint32_t faces, PointShadowTarget target) {
+    using enum PointShadowStrategy;
+
+    // Binds the program for casters with or without instancing, on first use.
+    // Instanced casters use the geometry shader unless drawing face by face,
+    // since the layered strategy selects faces by instance ID.
+    const ShaderProgram *shader = nullptr;
+    const PointShadowUniforms *uniforms = nullptr;
+    auto bind = [&](bool instanced) {
+        int strategy = (int)shadow_strategy_;
+        if (instanced && shadow_strategy_ != kSixPass) {
+            strategy = (int)kGeometryShader;
+        }
+        const auto &pipelines = instanced ? point_shadow_instanced_pipelines_ : point_shadow_pipelines_;
+        GlState::bind(*pipelines[strategy]);
+        shader = &pipelines[strategy]->program();
+        uniforms = instanced ? &point_shadow_instanced_uniforms_[strategy] : &point_shadow_uniforms_[strategy];
+        shader->set(uniforms->light_pos, light_pos);
+        shader->set(uniforms->layer, 6 * slot);
+    };
+
+    auto draw = [&](const ShadowCaster &caster, GLsizei num_faces) {
+        object_uniforms_->bind(caster.object);
+        if (caster.instanced) {
+            caster.mesh->draw_depth_instanced(caster.lod);
+        } else if (shadow_strategy_ == kLayered) {
+            caster.mesh->draw_depth_repeated(num_faces, caster.lod);
+        } else {
+            caster.mesh->draw_depth(caster.lod);
+        }
+        ++shadow_stats_.draw_calls;
+    };
+
+    if (shadow_strategy_ == kSixPass) {
+        for (int face = 0; face < 6; ++face) {
+            if (!(faces & (1u << face))) {
+                continue;
+            }
+            shadow_map_->bind_face(slot, face, target);
+
+            for (bool instanced : {true, false}) {
+                shader = nullptr;
+                for (const ShadowCaster &caster : casters) {
+                    if (caster.instanced != instanced || !(caster.faces & (1u << face))) {
+                        continue;
+                    }
+                    if (!shader) {
+                        bind(instanced);
+                        shader->set(uniforms->shadow_matrix, shadow_map_->shadow_matrix(face));
+                    }
+                    draw(caster, 1);
+                }
+            }
+        }
+        return;
+    }
+
+    shadow_map_->bind(target);
+    for (bool instanced : {true, false}) {
+        shader = nullptr;
+        for (const ShadowCaster &caster : casters) {
+            if (caster.instanced != instanced) {
+                continue;
+            }
+            if (!shader) {
+                bind(instanced);
+                for (int i = 0; i < 6; ++i) {
+                    shader->set(uniforms->shadow_matrices[i], shadow_map_->shadow_matrix(i));
+                }
+            }
+            if (shadow_strategy_ != kLayered || instanced) {
+                draw(caster, 1);
+                continue;
+            }
+
+            // One instance per face to update that the caster touches
+            GLsizei num_faces = 0;
+            for (int face = 0; face < 6; ++face) {
+                if (caster.faces & faces & (1u << face)) {
+                    shader->set(uniforms->faces[num_faces++], face);
+                }
+            }
+            draw(caster, num_faces);
+        }
+    }
+}
+
+PointShadowStrategy SceneDemo::next_shadow_strategy(PointShadowStrategy strategy) const {
+    int next = ((int)strategy + 1) % kNumPointShadowStrategies;
+    if (!point_shadow_shaders_[next]) {
+        next = (next + 1) % kNumPointShadowStrategies;
+    }
+    return (PointShadowStrategy)next;
+}
+
+void SceneDemo::render_shadow_bench() {
+    // Frames that only warm up caches and the driver
+    constexpr unsigned int kWarmupFrames = 5;
+
+    // Every frame redraws all faces and casters, static ones included
+    for (ShadowSlot &slot : shadow_slots_) {
+        slot.valid = false;
+    }
+
+    glFinish();
+    auto start = chrono::steady_clock::now();
+    update_shadow_map();
+    glFinish();
+    auto end = chrono::steady_clock::now();
+
+    ShadowBenchResult &result = shadow_bench_[(int)shadow_strategy_];
+    if (result.warmup_frames < kWarmupFrames) {
+        ++result.warmup_frames;
+        return;
+    }
+    result.ms += chrono::duration<double, milli>(end - start).count();
+    result.draw_calls += shadow_stats_.draw_calls;
+    if (++result.frames < options_.shadow_bench_frames) {
+        return;
+    }
+
+    PointShadowStrategy next = next_shadow_strategy(shadow_strategy_);
+    if (next != PointShadowStrategy::kGeometryShader) {
+        shadow_strategy_ = next;
+        return;
+    }
+
+    cout << "Shadow map, " << options_.shadow_bench_frames << " frames per strategy:\n";
+    for (int i = 0; i < kNumPointShadowStrategies; ++i) {
+        const ShadowBenchResult &strategy = shadow_bench_[i];
+        if (strategy.frames == 0) {
+            continue;
+        }
+        cout << "  " << left << setw(10) << point_shadow_strategy_name((PointShadowStrategy)i) << right
+             << fixed << setprecision(3) << setw(8) << strategy.ms / strategy.frames << " ms, "
+             << setprecision(1) << setw(6) << (double)strategy.draw_calls / strategy.frames << " draws\n";
+    }
+    cout << flush;
+    glfwSetWindowShouldClose(window_, GLFW_TRUE);
+}
+
+void SceneDemo::start_lighting_bench_step(int step) {
+    lighting_bench_step_ = step;
+    active_lights_ = kLightingBenchCounts[step / 2];
+    shader_type_ = step % 2 ? ShaderType::kDeferred : ShaderType::kPhong;
+}
+
+void SceneDemo::record_lighting_bench(double ms) {
+    // Frames that only warm up caches and the driver, and build the
+    // variants of the step
+    constexpr unsigned int kWarmupFrames = 5;
+
+    LightingBenchResult &result = lighting_bench_[lighting_bench_step_];
+    if (result.warmup_frames < kWarmupFrames) {
+        ++result.warmup_frames;
+        return;
+    }
+    result.ms += ms;
+    if (++result.frames < options_.lighting_bench_frames) {
+        return;
+    }
+
+    if (lighting_bench_step_ + 1 < kNumLightingBenchSteps) {
+        start_lighting_bench_step(lighting_bench_step_ + 1);
+        return;
+    }
+
+    const GBuffer &gbuffer = deferred_->gbuffer();
+    cout << "Scene pass, " << options_.lighting_bench_frames << " frames per configuration, "
+         << gbuffer.width() << "x" << gbuffer.height() << " G-buffer of "
+         << fixed << setprecision(1)
+         << (double)gbuffer.width() * gbuffer.height() * GBuffer::kBytesPerPixel / (1024 * 1024) << " MiB:\n";
+    for (int i = 0; i < kNumLightingBenchSteps; i += 2) {
+        const LightingBenchResult &forward = lighting_bench_[i];
+        const LightingBenchResult &deferred = lighting_bench_[i + 1];
+        cout << "  " << setw(4) << kLightingBenchCounts[i / 2] << " lights: forward " << setprecision(3)
+             << setw(8) << forward.ms / forward.frames << " ms, deferred " << setw(8)
+             << deferred.ms / deferred.frames << " ms\n";
+    }
+    cout << flush;
+    glfwSetWindowShouldClose(window_, GLFW_TRUE);
 }
 
 void SceneDemo::process_input() {
@@ -276,12 +1020,17 @@ void SceneDemo::key_callback(int key, int scancode, int action, int mods) {
         wireframe_ = !wireframe_;
     }
 
-    // 1, 2 - switch shader
-    if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
-        shader_type_ = ShaderType::kPhong;
-    }
-    if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
-        shader_type_ = ShaderType::kGouraud;
+    // 1, 2, 7 - switch shader, unless benchmarking them
+    if (options_.lighting_bench_frames == 0) {
+        if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
+            shader_type_ = ShaderType::kPhong;
+        }
+        if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
+            shader_type_ = ShaderType::kGouraud;
+        }
+        if (key == GLFW_KEY_7 && action == GLFW_PRESS) {
+            shader_type_ = ShaderType::kDeferred;
+        }
     }
 
     // 3, 4 - switch lighting model
@@ -297,6 +1046,16 @@ void SceneDemo::key_callback(int key, int scancode, int action, int mods) {
         shadows_ = !shadows_;
     }
 
+    // 6 - switch shadow strategy, unless benchmarking them
+    if (key == GLFW_KEY_6 && action == GLFW_PRESS && options_.shadow_bench_frames == 0) {
+        shadow_strategy_ = next_shadow_strategy(shadow_strategy_);
+    }
+
+    // 8 - cycle through 1, 4 and 20 shadow taps
+    if (key == GLFW_KEY_8 && action == GLFW_PRESS) {
+        options_.shadow_pcf_taps = options_.shadow_pcf_taps == 1 ? 4 : options_.shadow_pcf_taps == 4 ? 20 : 1;
+    }
+
     // P - pause animation
     if (key == GLFW_KEY_P && action == GLFW_PRESS) {
         animating_ = !animating_;
@@ -1,7 +1,14 @@
 #include "shader.h"
+#include "gl_state.h"
+#include "program_cache.h"
+#include "render_stats.h"
+#include "trace.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -17,9 +24,16 @@ Shader::~Shader() {
 }
 
 bool Shader::compile(const char *source) {
+    submit(source);
+    return check();
+}
+
+void Shader::submit(const char *source) {
     glShaderSource(id_, 1, &source, nullptr);
     glCompileShader(id_);
+}
 
+bool Shader::check() const {
     int success;
     glGetShaderiv(id_, GL_COMPILE_STATUS, &success);
     if (!success) {
@@ -34,7 +48,22 @@ bool Shader::compile(const char *source) {
     return success;
 }
 
-bool Shader::compile_from(const char *filename) {
+bool Shader::compile_from(const char *filename, string_view defines) {
+    string source;
+    if (!read_source(filename, defines, source)) {
+        return false;
+    }
+
+    bool ret = compile(source.c_str());
+    if (!ret) {
+        cerr << "FILE: " << filename << endl;
+    }
+    return ret;
+}
+
+namespace {
+
+bool read_file(const string &filename, string &text) {
     ifstream file(filename);
     if (!file.is_open()) {
         cerr << "ERROR::SHADER::FILE_NOT_FOUND\nFILE: " << filename << endl;
@@ -45,22 +74,107 @@ bool Shader::compile_from(const char *filename) {
     size_t len = file.tellg();
     file.seekg(0, ios::beg);
 
-    string source(len, '\0');
-    file.read(source.data(), len);
-    file.close();
+    text.assign(len, '\0');
+    file.read(text.data(), len);
+    return true;
+}
 
-    bool ret = compile(source.c_str());
-    if (!ret) {
-        cerr << "FILE: " << filename << endl;
+} // namespace
+
+bool Shader::read_source(const char *filename, string_view defines, string &source) {
+    if (!read_file(filename, source)) {
+        return false;
     }
-    return ret;
+
+    // Included files are not searched for includes themselves
+    constexpr string_view kInclude = "#include \"";
+    for (size_t pos = source.find(kInclude); pos != string::npos; pos = source.find(kInclude, pos)) {
+        if (pos > 0 && source[pos - 1] != '\n') {
+            pos += kInclude.size();
+            continue;
+        }
+
+        size_t line_end = min(source.find('\n', pos), source.size());
+        size_t name_begin = pos + kInclude.size();
+        size_t name_end = source.find('"', name_begin);
+        if (name_end == string::npos || name_end > line_end) {
+            cerr << "ERROR::SHADER::INVALID_INCLUDE\nFILE: " << filename << endl;
+            return false;
+        }
+
+        auto path = filesystem::path(filename).parent_path() / source.substr(name_begin, name_end - name_begin);
+        string included;
+        if (!read_file(path.string(), included)) {
+            return false;
+        }
+        source.replace(pos, line_end - pos, included);
+        pos += included.size();
+    }
+
+    if (!defines.empty()) {
+        size_t line_end = source.starts_with("#version") ? source.find('\n') : string::npos;
+        size_t pos = line_end == string::npos ? 0 : line_end + 1;
+        source.insert(pos, defines);
+    }
+    return true;
+}
+
+// GL_KHR_parallel_shader_compile; the ARB version uses the same values
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Sampler types beyond GL 3.3 (ARB_texture_cube_map_array)
+#ifndef GL_SAMPLER_CUBE_MAP_ARRAY
+#define GL_SAMPLER_CUBE_MAP_ARRAY 0x900C
+#endif
+#ifndef GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY
+#define GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY 0x900F
+#endif
+
+namespace {
+
+bool is_sampler_type(GLenum type) {
+    return (type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_RECT_SHADOW) ||
+        (type >= GL_SAMPLER_1D_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_BUFFER) ||
+        (type >= GL_SAMPLER_CUBE_MAP_ARRAY && type <= GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY) ||
+        (type >= GL_SAMPLER_2D_MULTISAMPLE && type <= GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY);
 }
 
-ShaderProgram::ShaderProgram() {
+// GL type of the uniforms that a handle type can set
+template <typename T>
+bool matches_type(GLenum type);
+
+template <>
+bool matches_type<bool>(GLenum type) { return type == GL_BOOL; }
+
+template <>
+bool matches_type<int>(GLenum type) { return type == GL_INT || is_sampler_type(type); }
+
+template <>
+bool matches_type<float>(GLenum type) { return type == GL_FLOAT; }
+
+template <>
+bool matches_type<glm::vec3>(GLenum type) { return type == GL_FLOAT_VEC3; }
+
+template <>
+bool matches_type<glm::mat3>(GLenum type) { return type == GL_FLOAT_MAT3; }
+
+template <>
+bool matches_type<glm::mat4>(GLenum type) { return type == GL_FLOAT_MAT4; }
+
+} // namespace
+
+ShaderProgram::ShaderProgram()
+    : cache_key_(0), loaded_from_cache_(false) {
     id_ = glCreateProgram();
 }
 
 ShaderProgram::~ShaderProgram() {
+    GlState::forget_program(id_);
     glDeleteProgram(id_);
 }
 
@@ -70,7 +184,10 @@ void ShaderProgram::attach_shader(const Shader &shader) {
 
 bool ShaderProgram::link() {
     glLinkProgram(id_);
+    return check_link();
+}
 
+bool ShaderProgram::check_link() {
     int success;
     glGetProgramiv(id_, GL_LINK_STATUS, &success);
     if (!success) {
@@ -80,66 +197,367 @@ bool ShaderProgram::link() {
         string info_log(len, '\0');
         glGetProgramInfoLog(id_, len, nullptr, info_log.data());
         cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << info_log << endl;
+        return false;
     }
 
-    return success;
+    reflect_uniforms();
+    return true;
+}
+
+void ShaderProgram::reflect_uniforms() {
+    uniforms_.clear();
+    uniform_slots_.clear();
+
+    int num_uniforms = 0;
+    int max_length = 0;
+    glGetProgramiv(id_, GL_ACTIVE_UNIFORMS, &num_uniforms);
+    glGetProgramiv(id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+    string name(max_length, '\0');
+    for (int i = 0; i < num_uniforms; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(id_, i, max_length, &length, &size, &type, name.data());
+        string base(name.data(), length);
+
+        // Arrays are reported once as "name[0]"; register every element
+        bool is_array = base.size() > 3 && base.ends_with("[0]");
+        if (is_array) {
+            base.resize(base.size() - 3);
+        }
+
+        for (int element = 0; element < size; ++element) {
+            string element_name = is_array ? base + "[" + to_string(element) + "]" : base;
+
+            // Uniforms in blocks have no location
+            GLint location = glGetUniformLocation(id_, element_name.c_str());
+            if (location < 0) {
+                continue;
+            }
+
+            int slot = (int)uniforms_.size();
+            uniforms_.push_back({location, type, false, {}});
+            if (is_array && element == 0) {
+                uniform_slots_.emplace(base, slot);
+            }
+            uniform_slots_.emplace(std::move(element_name), slot);
+        }
+    }
+}
+
+int ShaderProgram::find_slot(string_view name) const {
+    auto it = uniform_slots_.find(name);
+    return it != uniform_slots_.end() ? it->second : -1;
+}
+
+template <typename T>
+Uniform<T> ShaderProgram::uniform(string_view name) const {
+    int slot = find_slot(name);
+    if (slot < 0) {
+        return Uniform<T>();
+    }
+    if (!matches_type<T>(uniforms_[slot].type)) {
+        cerr << "WARNING::SHADER::PROGRAM::UNIFORM_TYPE_MISMATCH\nUNIFORM: " << name << endl;
+        return Uniform<T>();
+    }
+    return Uniform<T>(slot);
+}
+
+template Uniform<bool> ShaderProgram::uniform(string_view name) const;
+template Uniform<int> ShaderProgram::uniform(string_view name) const;
+template Uniform<float> ShaderProgram::uniform(string_view name) const;
+template Uniform<glm::vec3> ShaderProgram::uniform(string_view name) const;
+template Uniform<glm::mat3> ShaderProgram::uniform(string_view name) const;
+template Uniform<glm::mat4> ShaderProgram::uniform(string_view name) const;
+
+bool ShaderProgram::update_value(int slot, const void *data, size_t size) const {
+    auto &uniform = uniforms_[slot];
+    if (uniform.has_value && memcmp(uniform.value.data(), data, size) == 0) {
+        RenderStats::count_uniform_upload_skipped();
+        return false;
+    }
+
+    memcpy(uniform.value.data(), data, size);
+    uniform.has_value = true;
+    RenderStats::count_uniform_upload();
+    return true;
+}
+
+void ShaderProgram::set(Uniform<bool> uniform, bool value) const {
+    set(Uniform<int>(uniform.slot_), (int)value);
+}
+
+void ShaderProgram::set(Uniform<int> uniform, int value) const {
+    if (uniform.valid() && update_value(uniform.slot_, &value, sizeof(value))) {
+        glUniform1i(uniforms_[uniform.slot_].location, value);
+    }
+}
+
+void ShaderProgram::set(Uniform<float> uniform, float value) const {
+    if (uniform.valid() && update_value(uniform.slot_, &value, sizeof(value))) {
+        glUniform1f(uniforms_[uniform.slot_].location, value);
+    }
+}
+
+void ShaderProgram::set(Uniform<glm::vec3> uniform, glm::vec3 value) const {
+    if (uniform.valid() && update_value(uniform.slot_, glm::value_ptr(value), sizeof(value))) {
+        glUniform3f(uniforms_[uniform.slot_].location, value.x, value.y, value.z);
+    }
+}
+
+void ShaderProgram::set(Uniform<glm::mat3> uniform, const glm::mat3 &value) const {
+    if (uniform.valid() && update_value(uniform.slot_, glm::value_ptr(value), sizeof(value))) {
+        glUniformMatrix3fv(uniforms_[uniform.slot_].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
 }
 
-bool ShaderProgram::build_from(initializer_list<pair<GLenum, const char *>> shaders) {
+void ShaderProgram::set(Uniform<glm::mat4> uniform, const glm::mat4 &value) const {
+    if (uniform.valid() && update_value(uniform.slot_, glm::value_ptr(value), sizeof(value))) {
+        glUniformMatrix4fv(uniforms_[uniform.slot_].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+}
+
+bool ShaderProgram::build_from(initializer_list<pair<GLenum, const char *>> shaders, string_view defines) {
+    return submit(shaders, defines) && finish();
+}
+
+bool ShaderProgram::submit(initializer_list<pair<GLenum, const char *>> shaders, string_view defines) {
+    return submit(span(shaders.begin(), shaders.size()), defines);
+}
+
+bool ShaderProgram::submit(span<const pair<GLenum, const char *>> shaders, string_view defines) {
+    TRACE_SCOPE("submit program");
+    vector<string> sources;
+    sources.reserve(shaders.size());
+    ProgramCache::KeyBuilder key;
     for (const auto &[type, filename] : shaders) {
-        Shader shader(type);
-        if (!shader.compile_from(filename)) {
+        if (!Shader::read_source(filename, defines, sources.emplace_back())) {
             return false;
         }
-        attach_shader(shader);
+        key.add(type, sources.back());
+    }
+
+    cache_key_ = key.key();
+    bool cached = ProgramCache::enabled() && ProgramCache::supported();
+    loaded_from_cache_ = cached && ProgramCache::read(cache_key_, id_);
+    if (loaded_from_cache_) {
+        return true;
+    }
+
+    size_t i = 0;
+    for (const auto &[type, filename] : shaders) {
+        auto &shader = pending_shaders_.emplace_back(make_unique<Shader>(type));
+        shader->submit(sources[i++].c_str());
+        attach_shader(*shader);
+        pending_files_.emplace_back(filename);
+    }
+
+    if (cached) {
+        glProgramParameteri(id_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(id_);
+    return true;
+}
+
+bool ShaderProgram::finish() {
+    TRACE_SCOPE("finish program");
+    if (loaded_from_cache_) {
+        loaded_from_cache_ = false;
+        reflect_uniforms();
+        return true;
+    }
+
+    // Report compile errors first; the link log only repeats them
+    bool compiled = true;
+    int success;
+    glGetProgramiv(id_, GL_LINK_STATUS, &success);
+    for (size_t i = 0; i < pending_shaders_.size() && !success; ++i) {
+        if (!pending_shaders_[i]->check()) {
+            cerr << "FILE: " << pending_files_[i] << endl;
+            compiled = false;
+        }
+    }
+    pending_shaders_.clear();
+    pending_files_.clear();
+
+    if (!compiled || !check_link()) {
+        return false;
     }
 
-    return link();
+    if (ProgramCache::enabled() && ProgramCache::supported() && !ProgramCache::write(cache_key_, id_)) {
+        cerr << "WARNING::SHADER::PROGRAM::CACHE_WRITE_FAILED\nFILE: " << ProgramCache::cache_path(cache_key_) << endl;
+    }
+    return true;
 }
 
-bool ShaderProgram::build_from_vf(const char *prefix) {
+bool ShaderProgram::is_ready() const {
+    if (!parallel_compile_ || loaded_from_cache_) {
+        return true;
+    }
+
+    int completed = GL_TRUE;
+    glGetProgramiv(id_, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed == GL_TRUE;
+}
+
+bool ShaderProgram::enable_parallel_compile(GLADloadproc load) {
+    using MaxShaderCompilerThreads = void (*)(GLuint);
+
+    static const pair<const char *, const char *> extensions[] = {
+        {"GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR"},
+        {"GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB"},
+    };
+
+    for (const auto &[extension, function] : extensions) {
+        if (!has_gl_extension(extension)) {
+            continue;
+        }
+
+        // Not every glad build generates the extension, so load it here
+        auto max_threads = reinterpret_cast<MaxShaderCompilerThreads>(load(function));
+        if (max_threads != nullptr) {
+            // Let the driver choose the number of threads
+            max_threads(0xffffffffu);
+            parallel_compile_ = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ShaderProgram::build_from_vf(const char *prefix, string_view defines) {
     return build_from({
         {GL_VERTEX_SHADER, (string(prefix) + ".vs").c_str()},
         {GL_FRAGMENT_SHADER, (string(prefix) + ".fs").c_str()}
-    });
+    }, defines);
 }
 
-bool ShaderProgram::build_from_vgf(const char *prefix) {
+bool ShaderProgram::build_from_vgf(const char *prefix, string_view defines) {
     return build_from({
         {GL_VERTEX_SHADER, (string(prefix) + ".vs").c_str()},
         {GL_GEOMETRY_SHADER, (string(prefix) + ".gs").c_str()},
         {GL_FRAGMENT_SHADER, (string(prefix) + ".fs").c_str()}
-    });
+    }, defines);
+}
+
+bool ShaderProgram::submit_vf(const char *prefix, string_view defines) {
+    return submit({
+        {GL_VERTEX_SHADER, (string(prefix) + ".vs").c_str()},
+        {GL_FRAGMENT_SHADER, (string(prefix) + ".fs").c_str()}
+    }, defines);
+}
+
+bool ShaderProgram::submit_vgf(const char *prefix, string_view defines) {
+    return submit({
+        {GL_VERTEX_SHADER, (string(prefix) + ".vs").c_str()},
+        {GL_GEOMETRY_SHADER, (string(prefix) + ".gs").c_str()},
+        {GL_FRAGMENT_SHADER, (string(prefix) + ".fs").c_str()}
+    }, defines);
 }
 
 void ShaderProgram::use() const {
-    glUseProgram(id_);
+    GlState::use_program(id_);
+}
+
+size_t ShaderProgram::bind_uniform_block(const char *name, GLuint binding) const {
+    GLuint index = glGetUniformBlockIndex(id_, name);
+    if (index == GL_INVALID_INDEX) {
+        return 0;
+    }
+
+    GLint size = 0;
+    glGetActiveUniformBlockiv(id_, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+    glUniformBlockBinding(id_, index, binding);
+    return (size_t)size;
 }
 
 int ShaderProgram::uniform_location(const char *name) const {
-    return glGetUniformLocation(id_, name);
+    int slot = find_slot(name);
+    return slot >= 0 ? uniforms_[slot].location : -1;
 }
 
+// The name-based setters skip the type check, as glUniform* by location did
+
 void ShaderProgram::set_bool(const char *name, bool value) const {
-    glUniform1i(uniform_location(name), value);
+    set(Uniform<int>(find_slot(name)), (int)value);
 }
 
 void ShaderProgram::set_int(const char *name, int value) const {
-    glUniform1i(uniform_location(name), value);
+    set(Uniform<int>(find_slot(name)), value);
 }
 
 void ShaderProgram::set_float(const char *name, float value) const {
-    glUniform1f(uniform_location(name), value);
+    set(Uniform<float>(find_slot(name)), value);
 }
 
 void ShaderProgram::set_vec3(const char *name, glm::vec3 value) const {
-    glUniform3f(uniform_location(name), value.x, value.y, value.z);
+    set(Uniform<glm::vec3>(find_slot(name)), value);
 }
 
 void ShaderProgram::set_mat3(const char *name, const glm::mat3 &value) const {
-    glUniformMatrix3fv(uniform_location(name), 1, GL_FALSE, glm::value_ptr(value));
+    set(Uniform<glm::mat3>(find_slot(name)), value);
 }
 
 void ShaderProgram::set_mat4(const char *name, const glm::mat4 &value) const {
-    glUniformMatrix4fv(uniform_location(name), 1, GL_FALSE, glm::value_ptr(value));
+    set(Uniform<glm::mat4>(find_slot(name)), value);
+}
+
+ShaderVariants::ShaderVariants(vector<pair<GLenum, string>> shaders, vector<string> feature_names, Setup setup)
+    : shaders_(std::move(shaders)), feature_names_(std::move(feature_names)), setup_(std::move(setup)) {
+}
+
+string ShaderVariants::defines(uint32_t features) const {
+    string defines;
+    for (size_t i = 0; i < feature_names_.size(); ++i) {
+        if (features & (1u << i)) {
+            defines += "#define " + feature_names_[i] + "\n";
+        }
+    }
+    return defines;
+}
+
+ShaderVariants::Variant &ShaderVariants::submit(uint32_t features) {
+    auto [it, inserted] = variants_.try_emplace(features);
+    Variant &variant = it->second;
+    if (!inserted) {
+        return variant;
+    }
+
+    vector<pair<GLenum, const char *>> shaders;
+    for (const auto &[type, filename] : shaders_) {
+        shaders.emplace_back(type, filename.c_str());
+    }
+
+    variant.program = make_unique<ShaderProgram>();
+    if (!variant.program->submit(shaders, defines(features))) {
+        variant.finished = true;
+        variant.failed = true;
+    }
+    return variant;
+}
+
+void ShaderVariants::prepare(uint32_t features) {
+    submit(features);
+}
+
+const ShaderProgram *ShaderVariants::get(uint32_t features) {
+    Variant &variant = submit(features);
+    if (!variant.finished) {
+        variant.finished = true;
+        variant.failed = !variant.program->finish() || (setup_ && !setup_(*variant.program));
+        if (variant.failed) {
+            cerr << "ERROR::SHADER::VARIANT_FAILED\nFILE: " << shaders_.front().second
+                 << "\nDEFINES:\n" << defines(features) << endl;
+        }
+    }
+    return variant.failed ? nullptr : variant.program.get();
+}
+
+size_t ShaderVariants::num_ready() const {
+    size_t num_ready = 0;
+    for (const auto &[features, variant] : variants_) {
+        num_ready += variant.finished || variant.program->is_ready();
+    }
+    return num_ready;
 }
@@ -0,0 +1,84 @@
+#include "shader_uniforms.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+bool bind_block(const ShaderProgram &shader, const char *name, GLuint binding, size_t expected_size) {
+    size_t size = shader.bind_uniform_block(name, binding);
+    // Drivers may or may not round the size of the last member up to a vec4
+    if (size > expected_size) {
+        cerr << "ERROR::SHADER::PROGRAM::UNIFORM_BLOCK_SIZE\nBLOCK: " << name << " is " << size
+             << " bytes, expected at most " << expected_size << endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool bind_uniform_blocks(const ShaderProgram &shader) {
+    return bind_block(shader, "Frame", kFrameBinding, sizeof(FrameBlock)) &&
+        bind_block(shader, "Lighting", kLightingBinding, sizeof(LightingBlock)) &&
+        bind_block(shader, "Object", kObjectBinding, sizeof(ObjectBlock)) &&
+        bind_block(shader, "Clusters", kClustersBinding, sizeof(ClustersBlock));
+}
+
+unique_ptr<ShaderVariants> make_lit_variants(const char *prefix) {
+    string path = prefix;
+    return make_lit_variants(path + ".vs", path + ".fs");
+}
+
+unique_ptr<ShaderVariants> make_lit_variants(string vertex_path, string fragment_path) {
+    auto setup = [](const ShaderProgram &shader) {
+        if (!bind_uniform_blocks(shader)) {
+            return false;
+        }
+        shader.use();
+        shader.set_int("depthCubemap", kShadowUnit);
+        shader.set_int("lightData", kLightDataUnit);
+        shader.set_int("clusterLights", kClusterLightsUnit);
+        shader.set_int("lightIndices", kLightIndicesUnit);
+        shader.set_int("gDepth", kGBufferDepthUnit);
+        shader.set_int("gNormal", kGBufferNormalUnit);
+        shader.set_int("gDiffuse", kGBufferDiffuseUnit);
+        shader.set_int("gAmbient", kGBufferAmbientUnit);
+        return true;
+    };
+    return make_unique<ShaderVariants>(
+        vector<pair<GLenum, string>>{{GL_VERTEX_SHADER, std::move(vertex_path)},
+                                     {GL_FRAGMENT_SHADER, std::move(fragment_path)}},
+        vector<string>{"BLINN", "SHADOWS", "INSTANCED", "CLUSTERED", "SHADOW_ARRAY", "PCF4", "PCF20"}, setup);
+}
+
+uint32_t pcf_feature(int taps) {
+    switch (taps) {
+        case 4:
+            return kPcf4Feature;
+        case 20:
+            return kPcf20Feature;
+        default:
+            return 0;
+    }
+}
+
+ObjectBlock object_block(const glm::mat4 &model, const glm::mat4 &position_transform) {
+    ObjectBlock block{};
+    block.model = model * position_transform;
+    block.normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+    return block;
+}
+
+PointShadowUniforms::PointShadowUniforms(const ShaderProgram &shader) {
+    for (int i = 0; i < 6; ++i) {
+        shadow_matrices[i] = shader.uniform<glm::mat4>("shadowMatrices[" + to_string(i) + "]");
+        faces[i] = shader.uniform<int>("faces[" + to_string(i) + "]");
+    }
+    shadow_matrix = shader.uniform<glm::mat4>("shadowMatrix");
+    light_pos = shader.uniform<glm::vec3>("lightPos");
+    layer = shader.uniform<int>("layer");
+}
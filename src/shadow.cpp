@@ -1,7 +1,17 @@
 #include "shadow.h"
+#include "gl_state.h"
+#include "trace.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 
+using namespace std;
+
+#ifndef GL_TEXTURE_CUBE_MAP_ARRAY
+#define GL_TEXTURE_CUBE_MAP_ARRAY 0x9009
+#endif
+
+static const char *const kStrategyNames[kNumPointShadowStrategies] = {"gs", "six-pass", "layered"};
+
 static const glm::vec3 kCubemapDirections[6] = {
     {1.0f, 0.0f, 0.0f},
     {-1.0f, 0.0f, 0.0f},
@@ -19,58 +29,195 @@ static const glm::vec3 kCubemapUps[6] = {
     {0.0f, -1.0f, 0.0f},
 };
 
-PointShadowMap::PointShadowMap(int width, int height, float near, float far)
+const char *point_shadow_strategy_name(PointShadowStrategy strategy) {
+    return kStrategyNames[(int)strategy];
+}
+
+optional<PointShadowStrategy> parse_point_shadow_strategy(string_view name) {
+    for (int i = 0; i < kNumPointShadowStrategies; ++i) {
+        if (name == kStrategyNames[i]) {
+            return (PointShadowStrategy)i;
+        }
+    }
+    return nullopt;
+}
+
+PointShadowMap::PointShadowMap(int width, int height, float near, float far, int slots, bool cached,
+                               int depth_bits)
     : width_(width),
       height_(height),
+      slots_(slots),
+      depth_bits_(depth_bits),
       near_(near),
       far_(far),
-      fbo_(),
-      depth_cubemap_() {
-    // Create a framebuffer object and a depth cubemap texture
-    glGenFramebuffers(1, &fbo_);
-    glGenTextures(1, &depth_cubemap_);
+      textures_(),
+      fbos_() {
+    TRACE_SCOPE("allocate shadow map");
+    create_texture((int)PointShadowTarget::kShadow);
+    if (cached) {
+        create_texture((int)PointShadowTarget::kStatic);
+    }
+
+    // Calculate shadow matrices
+    float aspect = (float)width_ / height_;
+    glm::mat4 proj = glm::perspective(glm::radians(90.0f), aspect, near_, far_);
 
-    // Initialize the depth cubemap texture
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depth_cubemap_);
     for (int i = 0; i < 6; ++i) {
-        glTexImage2D(
-            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
-            width_, height_, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr
+        shadow_matrices_[i] = proj * glm::lookAt(
+            glm::vec3(0.0f), kCubemapDirections[i], kCubemapUps[i]
         );
+        face_frustums_.emplace_back(shadow_matrices_[i]);
+    }
+}
+
+PointShadowMap::~PointShadowMap() {
+    for (int target = 0; target < 2; ++target) {
+        if (textures_[target] == 0) {
+            continue;
+        }
+        GlState::forget_framebuffer(fbos_[target]);
+        for (GLuint face_fbo : face_fbos_[target]) {
+            GlState::forget_framebuffer(face_fbo);
+        }
+        GlState::forget_texture(textures_[target]);
+        glDeleteFramebuffers(1, &fbos_[target]);
+        glDeleteFramebuffers((GLsizei)face_fbos_[target].size(), face_fbos_[target].data());
+        glDeleteTextures(1, &textures_[target]);
+    }
+}
+
+size_t PointShadowMap::memory_size() const {
+    // 24-bit depth is stored in 32 bits
+    size_t texel_size = depth_bits_ == 16 ? 2 : 4;
+    return (cached() ? 2 : 1) * (size_t)width_ * height_ * 6 * slots_ * texel_size;
+}
+
+GLenum PointShadowMap::texture_target() const {
+    return slots_ > 1 ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP;
+}
+
+void PointShadowMap::create_texture(int target) {
+    GLuint &texture = textures_[target];
+    GLenum texture_target = this->texture_target();
+    auto &face_fbos = face_fbos_[target];
+
+    // Create a framebuffer object and a depth cubemap texture
+    glGenFramebuffers(1, &fbos_[target]);
+    face_fbos.resize(6 * slots_);
+    glGenFramebuffers((GLsizei)face_fbos.size(), face_fbos.data());
+    glGenTextures(1, &texture);
+
+    GLenum internal_format = GL_DEPTH_COMPONENT24;
+    if (depth_bits_ == 16) {
+        internal_format = GL_DEPTH_COMPONENT16;
+    } else if (depth_bits_ == 32) {
+        internal_format = GL_DEPTH_COMPONENT32F;
+    }
+
+    // Initialize the depth cubemap texture
+    GlState::bind_texture(texture_target, texture);
+    if (slots_ > 1) {
+        glTexImage3D(texture_target, 0, internal_format, width_, height_, 6 * slots_, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    } else {
+        for (int i = 0; i < 6; ++i) {
+            glTexImage2D(
+                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format,
+                width_, height_, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr
+            );
+        }
     }
 
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    // Set texture parameters. Lookups compare against the depth, and
+    // linear filtering blends the results of the 2x2 texels around them.
+    glTexParameteri(texture_target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(texture_target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(texture_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(texture_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(texture_target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(texture_target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(texture_target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
     // Attach the depth cubemap texture to the framebuffer object
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_cubemap_, 0);
+    GlState::bind_framebuffer(fbos_[target]);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Calculate shadow matrices
-    float aspect = (float)width_ / height_;
-    glm::mat4 proj = glm::perspective(glm::radians(90.0f), aspect, near_, far_);
+    // And each face to a framebuffer of its own, for rendering face by face
+    for (int i = 0; i < 6 * slots_; ++i) {
+        GlState::bind_framebuffer(face_fbos[i]);
+        if (slots_ > 1) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+        } else {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                   texture, 0);
+        }
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    GlState::bind_framebuffer(0);
+}
+
+void PointShadowMap::bind(PointShadowTarget target) const {
+    GlState::bind_framebuffer(fbos_[(int)target]);
+    GlState::viewport(0, 0, width_, height_);
+}
+
+void PointShadowMap::bind_face(int slot, int face, PointShadowTarget target) const {
+    GlState::bind_framebuffer(face_fbos_[(int)target][6 * slot + face]);
+    GlState::viewport(0, 0, width_, height_);
+}
+
+void PointShadowMap::clear(int slot, PointShadowTarget target) const {
+    if (slots_ == 1) {
+        bind(target);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return;
+    }
 
+    // The layered framebuffer would clear every slot
     for (int i = 0; i < 6; ++i) {
-        shadow_matrices_[i] = proj * glm::lookAt(
-            glm::vec3(0.0f), kCubemapDirections[i], kCubemapUps[i]
-        );
+        bind_face(slot, i, target);
+        glClear(GL_DEPTH_BUFFER_BIT);
     }
 }
 
-PointShadowMap::~PointShadowMap() {
-    glDeleteFramebuffers(1, &fbo_);
-    glDeleteTextures(1, &depth_cubemap_);
+void PointShadowMap::copy_static_faces(int slot, uint32_t faces) const {
+    for (int i = 0; i < 6; ++i) {
+        if (!(faces & (1u << i))) {
+            continue;
+        }
+
+        GlState::blit_framebuffer(face_fbos_[(int)PointShadowTarget::kStatic][6 * slot + i],
+                                  face_fbos_[(int)PointShadowTarget::kShadow][6 * slot + i], width_, height_,
+                                  GL_DEPTH_BUFFER_BIT);
+    }
 }
 
-void PointShadowMap::bind() const {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
-    glViewport(0, 0, width_, height_);
-    glClear(GL_DEPTH_BUFFER_BIT);
+bool PointShadowMap::layered_supported() {
+    static const bool supported = has_gl_extension("GL_ARB_shader_viewport_layer_array") ||
+        has_gl_extension("GL_AMD_vertex_shader_layer");
+    return supported;
+}
+
+bool PointShadowMap::array_supported() {
+    static const bool supported = has_gl_extension("GL_ARB_texture_cube_map_array");
+    return supported;
+}
+
+uint32_t PointShadowMap::face_mask(glm::vec3 center, float radius) const {
+    // The faces reach far_ along their axis, so the map ends at a cube
+    glm::vec3 distances = glm::abs(center) - radius;
+    if (glm::max(distances.x, glm::max(distances.y, distances.z)) > far_) {
+        return 0;
+    }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 6; ++i) {
+        if (face_frustums_[i].intersects_sphere(center, radius)) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
 }
@@ -1,4 +1,6 @@
 #include "shape.h"
+#include "gl_state.h"
+#include "render_stats.h"
 
 CircleMesh::CircleMesh(int segments)
     : vertices_(segments), vbo_(), vao_() {
@@ -10,23 +12,25 @@ CircleMesh::CircleMesh(int segments)
     glGenBuffers(1, &vbo_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
     glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(Vertex), vertices_.data(), GL_STATIC_DRAW);
+    RenderStats::count_buffer_upload(vertices_.size() * sizeof(Vertex));
 
     glGenVertexArrays(1, &vao_);
-    glBindVertexArray(vao_);
+    GlState::bind_vertex_array(vao_);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
     glEnableVertexAttribArray(0);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GlState::bind_vertex_array(0);
 }
 
 CircleMesh::~CircleMesh() {
     glDeleteBuffers(1, &vbo_);
+    GlState::forget_vertex_array(vao_);
     glDeleteVertexArrays(1, &vao_);
 }
 
 void CircleMesh::draw() const {
-    glBindVertexArray(vao_);
+    GlState::bind_vertex_array(vao_);
     glDrawArrays(GL_LINE_LOOP, 0, vertices_.size());
-    glBindVertexArray(0);
+    RenderStats::count_draw(GL_LINE_LOOP, vertices_.size());
 }
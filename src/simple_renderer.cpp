@@ -1,25 +1,35 @@
 #include "simple_renderer.h"
 #include "mesh.h"
+#include "mesh_loader.h"
+#include "phase_timer.h"
 #include "shape.h"
+#include "program_cache.h"
+#include "render_stats.h"
 #include "shader.h"
+#include "thread_pool.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <cstring>
 
 using namespace std;
 
-SimpleRenderer::SimpleRenderer(vector<string> obj_files)
+SimpleRenderer::SimpleRenderer(Options options)
     : Application(1280, 720, "Simple Renderer"),
       camera_(),
       controller_(camera_, 0.125f, 1.1f),
-      obj_files_(std::move(obj_files)),
+      options_(std::move(options)),
+      num_draw_calls_(0),
+      title_time_(0.0f),
       wireframe_(false),
       trackball_(true),
-      shader_type_(ShaderType::kPhong),
+      exploded_(false),
+      shader_type_(options_.deferred ? ShaderType::kDeferred : ShaderType::kPhong),
       blinn_(true) {
 }
 
@@ -30,16 +40,37 @@ int SimpleRenderer::init() {
     // Turn on vsync
     glfwSwapInterval(1);
 
-    glEnable(GL_DEPTH_TEST);
     glEnable(GL_FRAMEBUFFER_SRGB);
-
-    if (!load_meshes()) {
+    ShaderProgram::enable_parallel_compile((GLADloadproc)glfwGetProcAddress);
+
+    // Submit all compiles while the workers parse, and only wait for them
+    // once the meshes are uploaded
+    PhaseTimer timer;
+    ThreadPool pool;
+    auto loader = start_loading_meshes(pool);
+    timer.lap("queue meshes");
+    if (!loader || !submit_shaders()) {
         return 1;
     }
-    if (!load_shaders()) {
+    timer.lap("submit shaders");
+    if (!finish_loading_meshes(*loader)) {
         return 1;
     }
+    timer.lap("load meshes");
+
+    size_t num_ready = phong_variants_->num_ready() + circle_shader_->is_ready();
+    if (!finish_shaders()) {
+        return 1;
+    }
+    timer.lap("finish shaders");
+
     init_scene();
+    timer.lap("init scene");
+
+    timer.print(cout, "Init");
+    if (ShaderProgram::parallel_compile()) {
+        cout << num_ready << "/" << phong_variants_->num_variants() + 1 << " programs were ready after loading meshes" << endl;
+    }
 
     return 0;
 }
@@ -50,33 +81,84 @@ int SimpleRenderer::init() {
         return false; \
     }
 
-bool SimpleRenderer::load_meshes() {
-    if (obj_files_.empty()) {
+unique_ptr<MeshLoader> SimpleRenderer::start_loading_meshes(ThreadPool &pool) {
+    if (options_.obj_files.empty()) {
         cerr << "No OBJ files specified" << endl;
-        return false;
+        return nullptr;
     }
 
-    meshes_.reserve(obj_files_.size());
-    for (const auto &obj_file : obj_files_) {
-        auto mesh = make_unique<BasicMesh>();
-        TRY(mesh->load(obj_file.c_str()));
-        mesh->setup();
-        meshes_.push_back(std::move(mesh));
+    // Parse all files on worker threads and upload them as they complete
+    MeshLoadOptions load_options;
+    load_options.optimize = options_.optimize_meshes;
+    load_options.lod_levels = options_.lod_levels;
+    load_options.meshlets = options_.meshlets;
+    if (options_.compact_vertices) {
+        load_options.vertex_format = VertexFormat::kCompact;
+    }
+
+    if (options_.geometry_heap) {
+        geometry_heap_ = make_unique<GeometryHeap>(load_options.vertex_format);
+        draw_batch_ = make_unique<DrawBatch>(*geometry_heap_);
+    }
+
+    auto loader = make_unique<MeshLoader>(pool, load_options, geometry_heap_.get());
+
+    meshes_.reserve(options_.obj_files.size());
+    for (const auto &obj_file : options_.obj_files) {
+        meshes_.push_back(make_unique<BasicMesh>());
+        loader->enqueue(obj_file, *meshes_.back());
     }
 
     circle_mesh_ = make_unique<CircleMesh>(64);
-    return true;
+
+    return loader;
 }
 
-bool SimpleRenderer::load_shaders() {
-    phong_shader_ = make_unique<ShaderProgram>();
-    TRY(phong_shader_->build_from_vf("shader/phong"));
+bool SimpleRenderer::finish_loading_meshes(MeshLoader &loader) {
+    bool loaded = loader.finish();
+    loader.print_report(cout);
+    if (geometry_heap_) {
+        print_geometry_heap_stats(cout, geometry_heap_->stats());
+    }
+    TRY(loaded);
 
-    gouraud_shader_ = make_unique<ShaderProgram>();
-    TRY(gouraud_shader_->build_from_vf("shader/gouraud"));
+    return true;
+}
+
+bool SimpleRenderer::submit_shaders() {
+    // Variants are built as the flags first ask for them; only the one of
+    // the first frame is submitted here. There are no shadows.
+    phong_variants_ = make_lit_variants("shader/phong");
+    gouraud_variants_ = make_lit_variants("shader/gouraud");
+    phong_variants_->prepare(lit_features());
+    deferred_ = make_unique<DeferredRenderer>();
+    if (shader_type_ == ShaderType::kDeferred) {
+        deferred_->prepare(lit_features());
+    }
 
     circle_shader_ = make_unique<ShaderProgram>();
-    TRY(circle_shader_->build_from_vf("shader/simple"));
+    TRY(circle_shader_->submit_vf("shader/simple"));
+
+    return true;
+}
+
+bool SimpleRenderer::finish_shaders() {
+    TRY(phong_variants_->get(lit_features()));
+    TRY(circle_shader_->finish());
+    TRY(bind_uniform_blocks(*circle_shader_));
+
+    for (bool wireframe : {false, true}) {
+        RasterState raster;
+        raster.polygon_mode = wireframe ? GL_LINE : GL_FILL;
+        lit_rasters_[wireframe] = raster;
+    }
+    circle_pipeline_ = make_unique<PipelineState>(*circle_shader_);
+
+    frame_uniforms_ = make_unique<UniformBuffer>(sizeof(FrameBlock), kFrameBinding);
+    lighting_uniforms_ = make_unique<UniformBuffer>(sizeof(LightingBlock), kLightingBinding);
+    object_uniforms_ = make_unique<ObjectUniformBuffer>(sizeof(ObjectBlock), kObjectBinding);
+
+    ProgramCache::print_report(cout);
 
     return true;
 }
@@ -92,9 +174,20 @@ void SimpleRenderer::init_scene() {
         max = glm::max(max, mesh->max());
     }
 
+    scene_center_ = 0.5f * (min + max);
+
+    // Build the culling hierarchy over the mesh bounds
+    vector<Aabb> boxes;
+    boxes.reserve(meshes_.size());
+    for (const auto &mesh : meshes_) {
+        boxes.push_back({mesh->min(), mesh->max()});
+    }
+    model_matrices_.assign(meshes_.size(), glm::mat4(1.0f));
+    bvh_.build(boxes);
+
     // Initialize camera
     controller_.set_view(45.0f, height_);
-    controller_.set_target(0.5f * (min + max));
+    controller_.set_target(scene_center_);
     controller_.set_distance(1.5f * glm::length(max - min));
     controller_.set_yaw(0.0f);
     controller_.set_pitch(0.0f);
@@ -103,84 +196,246 @@ void SimpleRenderer::init_scene() {
     // Initialize light
     light_pos_ = camera_.position();
     light_color_ = glm::vec3(1.0f);
+
+    if (options_.lights > 0) {
+        init_lights(options_.lights, min, max);
+    }
+}
+
+void SimpleRenderer::init_lights(unsigned int count, const glm::vec3 &min, const glm::vec3 &max) {
+    clustered_lighting_ = make_unique<ClusteredLighting>();
+
+    // Index 0 is the camera light, set every frame. The others are placed
+    // by a 3D golden ratio sequence, which spreads them evenly.
+    lights_.resize((size_t)count + 1);
+    const glm::vec3 steps(0.819173f, 0.671044f, 0.549700f);
+    float radius = 0.15f * glm::length(max - min);
+    for (unsigned int i = 1; i <= count; ++i) {
+        PointLight &light = lights_[i];
+        glm::vec3 t = glm::fract(0.5f + (float)i * steps);
+        light.position = min + t * (max - min);
+        light.radius = radius;
+        float hue = fmodf(i * 0.618034f, 1.0f);
+        for (int c = 0; c < 3; ++c) {
+            light.color[c] = 0.5f + 0.5f * cosf(6.283185f * (hue + c / 3.0f));
+        }
+    }
+}
+
+uint32_t SimpleRenderer::lit_features() const {
+    // There are no shadows
+    uint32_t features = blinn_ ? kBlinnFeature : 0u;
+    if (options_.lights > 0) {
+        features |= kClusteredFeature;
+    }
+    return features;
 }
 
 int SimpleRenderer::render() {
-    glViewport(0, 0, width_, height_);
+    GlState::viewport(0, 0, width_, height_);
     glClearColor(0.05f, 0.08f, 0.12f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    if (wireframe_) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    }
-
     light_pos_ = camera_.position();
 
     float fov = glm::radians(45.0f);
     float aspect = (float)width_ / height_;
-    glm::mat4 projection = glm::perspective(fov, aspect, 0.1f, 10000.0f);
+    float near = 0.1f;
+    float far = 10000.0f;
+    glm::mat4 projection = glm::perspective(fov, aspect, near, far);
 
     glm::mat4 view = camera_.view_matrix();
 
-    const ShaderProgram &shader = shader_type_ == ShaderType::kPhong ? *phong_shader_ : *gouraud_shader_;
+    FrameBlock frame{};
+    frame.projection = projection;
+    frame.view = view;
+    frame.view_pos = camera_.position();
+    frame.inverse_view_projection = glm::inverse(projection * view);
+    frame_uniforms_->update(frame);
+
+    LightingBlock lighting{};
+    lighting.ambient = 0.05f * light_color_;
+    lighting.diffuse = 0.75f * light_color_;
+    lighting.specular = 0.4f * light_color_;
+    lighting.light_pos = light_pos_;
+    lighting_uniforms_->update(lighting);
+
+    if (clustered_lighting_) {
+        lights_[0] = {light_pos_, far, lighting.diffuse, -1};
+        clustered_lighting_->update(lights_, view, projection, near, far, width_, height_);
+        clustered_lighting_->bind();
+    }
+
+    float pixel_scale = 0.5f * projection[1][1] * height_;
+    glm::mat4 view_projection = projection * view;
+    meshlet_stats_ = {};
+
+    // Skip meshes whose bounds are outside the view
+    visible_meshes_.clear();
+    bvh_.cull(Frustum(view_projection), visible_meshes_);
+
+    // Object blocks of the visible meshes come first, in draw order, then
+    // those of the trackball circles
+    object_uniforms_->clear();
+    mesh_objects_.clear();
+    ObjectBlock previous;
+    bool previous_in_heap = false;
+    for (unsigned int index : visible_meshes_) {
+        ObjectBlock object = object_block(model_matrices_[index], meshes_[index]->position_transform());
+        glm::vec3 object_color(0.75f, 0.75f, 0.75f);
+        object.ambient = object_color;
+        object.diffuse = object_color;
+        object.specular = glm::vec3(1.0f);
+        object.shininess = 16.0f;
+
+        bool in_heap = meshes_[index]->heap() != nullptr;
+        bool shared = in_heap && previous_in_heap && memcmp(&object, &previous, sizeof(ObjectBlock)) == 0;
+        mesh_objects_.push_back(shared ? mesh_objects_.back() : object_uniforms_->add(object));
+        previous = object;
+        previous_in_heap = in_heap;
+    }
 
-    shader.use();
+    if (trackball_) {
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, controller_.target());
+        model = glm::scale(model, 0.3f * glm::vec3(controller_.distance()));
 
-    shader.set_mat4("projection", projection);
-    shader.set_mat4("view", view);
-    shader.set_vec3("viewPos", camera_.position());
+        // yz-, xz- and xy-plane
+        const pair<glm::mat4, glm::vec3> circles[] = {
+            {glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)), glm::vec3(1.0f, 0.0f, 0.0f)},
+            {model, glm::vec3(0.0f, 1.0f, 0.0f)},
+            {glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(0.0f, 0.0f, 1.0f)},
+        };
+        for (const auto &[circle_model, color] : circles) {
+            ObjectBlock circle = object_block(circle_model, glm::mat4(1.0f));
+            circle.diffuse = color;
+            object_uniforms_->add(circle);
+        }
+    }
 
-    shader.set_vec3("lightPos", light_pos_);
-    shader.set_vec3("light.ambient", 0.05f * light_color_);
-    shader.set_vec3("light.diffuse", 0.75f * light_color_);
-    shader.set_vec3("light.specular", 0.4f * light_color_);
-    shader.set_bool("light.blinn", blinn_);
-    shader.set_bool("shadows", false);
+    object_uniforms_->upload();
 
-    for (auto &mesh : meshes_) {
-        glm::mat4 model = glm::mat4(1.0f);
-        shader.set_mat4("model", model);
-        shader.set_mat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model))));
+    bool bound = false;
+    if (shader_type_ == ShaderType::kDeferred) {
+        deferred_->begin_geometry_pass(width_, height_);
+        bound = deferred_->bind_geometry_pipeline(false, lit_rasters_[wireframe_]);
+    } else {
+        ShaderVariants &variants = shader_type_ == ShaderType::kPhong ? *phong_variants_ : *gouraud_variants_;
+        const ShaderProgram *program = variants.get(lit_features());
+        if (program) {
+            GlState::bind(PipelineState(*program, lit_rasters_[wireframe_]));
+            bound = true;
+        }
+    }
 
-        glm::vec3 object_color(0.75f, 0.75f, 0.75f);
-        shader.set_vec3("material.ambient", object_color);
-        shader.set_vec3("material.diffuse", object_color);
-        shader.set_vec3("material.specular", glm::vec3(1.0f));
-        shader.set_float("material.shininess", 16.0f);
+    // Heap meshes accumulate into a batch until the object block changes
+    num_draw_calls_ = 0;
+    size_t batch_object = 0;
+    auto submit_batch = [&]() {
+        if (draw_batch_ && !draw_batch_->empty()) {
+            object_uniforms_->bind(batch_object);
+            draw_batch_->submit();
+            draw_batch_->clear();
+            ++num_draw_calls_;
+        }
+    };
+
+    // The meshes are skipped if the variant failed to build
+    for (size_t i = 0; bound && i < visible_meshes_.size(); ++i) {
+        const auto &mesh = meshes_[visible_meshes_[i]];
+        const glm::mat4 &model = model_matrices_[visible_meshes_[i]];
+        size_t object = mesh_objects_[i];
+        size_t lod = mesh->select_lod(model, camera_.position(), pixel_scale);
+
+        if (mesh->heap()) {
+            if (object != batch_object) {
+                submit_batch();
+                batch_object = object;
+            }
+            if (lod == 0) {
+                mesh->add_culled_draws(*draw_batch_, model, view_projection, camera_.position(), meshlet_stats_);
+            } else {
+                mesh->add_draws(*draw_batch_, lod);
+            }
+            continue;
+        }
+
+        submit_batch();
+        object_uniforms_->bind(object);
+        if (lod == 0) {
+            mesh->draw_culled(model, view_projection, camera_.position(), meshlet_stats_);
+        } else {
+            mesh->draw(lod);
+        }
+        ++num_draw_calls_;
+    }
+    submit_batch();
 
-        mesh->draw();
+    if (shader_type_ == ShaderType::kDeferred) {
+        deferred_->light(lit_features(), 0);
     }
 
     // Draw trackball
     if (trackball_) {
-        circle_shader_->use();
+        GlState::bind(*circle_pipeline_);
+
+        size_t object = object_uniforms_->size() - 3;
+        for (int i = 0; i < 3; ++i) {
+            object_uniforms_->bind(object++);
+            circle_mesh_->draw();
+            ++num_draw_calls_;
+        }
+    }
 
-        circle_shader_->set_mat4("projection", projection);
-        circle_shader_->set_mat4("view", view);
+    update_title();
 
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, controller_.target());
-        model = glm::scale(model, 0.3f * glm::vec3(controller_.distance()));
+    return 0;
+}
 
-        // yz-plane
-        circle_shader_->set_mat4("model", glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
-        circle_shader_->set_vec3("objectColor", glm::vec3(1.0f, 0.0f, 0.0f));
-        circle_mesh_->draw();
+void SimpleRenderer::update_title() {
+    if (time_ - title_time_ < 0.5f) {
+        return;
+    }
+    title_time_ = time_;
+
+    const FrameStats &frame_stats = RenderStats::last();
+    string title = "Simple Renderer - " + to_string(visible_meshes_.size()) + "/" +
+        to_string(meshes_.size()) + " meshes visible, " + to_string(num_draw_calls_) +
+        " draw calls, state calls: " + to_string(frame_stats.state_calls) +
+        " issued, " + to_string(frame_stats.state_calls_avoided) + " avoided";
+    if (clustered_lighting_) {
+        const ClusterStats &light_stats = clustered_lighting_->stats();
+        title += ", lights: " + to_string(light_stats.visible_lights) + "/" + to_string(light_stats.lights) +
+            " visible, " + to_string(light_stats.max_cluster_lights) + " max per cluster";
+    }
+    if (options_.frame_stats) {
+        title += ", frame: " + RenderStats::summary();
+    }
+    if (options_.meshlets) {
+        title += ", meshlets: " + to_string(meshlet_stats_.drawn) + "/" +
+            to_string(meshlet_stats_.tested) + " drawn, " + to_string(meshlet_stats_.frustum_culled) +
+            " frustum culled, " + to_string(meshlet_stats_.backface_culled) + " backface culled";
+    }
+    glfwSetWindowTitle(window_, title.c_str());
+}
 
-        // xz-plane
-        circle_shader_->set_mat4("model", model);
-        circle_shader_->set_vec3("objectColor", glm::vec3(0.0f, 1.0f, 0.0f));
-        circle_mesh_->draw();
+void SimpleRenderer::set_model_matrix(size_t mesh, const glm::mat4 &model) {
+    model_matrices_[mesh] = model;
+    bvh_.update(mesh, Aabb{meshes_[mesh]->min(), meshes_[mesh]->max()}.transformed(model));
+}
 
-        // xy-plane
-        circle_shader_->set_mat4("model", glm::rotate(model, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-        circle_shader_->set_vec3("objectColor", glm::vec3(0.0f, 0.0f, 1.0f));
-        circle_mesh_->draw();
+void SimpleRenderer::set_exploded(bool exploded) {
+    exploded_ = exploded;
+
+    // Move every part away from the scene center by half its offset
+    for (size_t i = 0; i < meshes_.size(); ++i) {
+        glm::mat4 model(1.0f);
+        if (exploded_) {
+            glm::vec3 center = 0.5f * (meshes_[i]->min() + meshes_[i]->max());
+            model = glm::translate(model, 0.5f * (center - scene_center_));
+        }
+        set_model_matrix(i, model);
     }
-
-    return 0;
 }
 
 void SimpleRenderer::process_input() {
@@ -221,13 +476,16 @@ void SimpleRenderer::key_callback(int key, int scancode, int action, int mods) {
         wireframe_ = !wireframe_;
     }
 
-    // 1, 2 - switch shader
+    // 1, 2, 7 - switch shader
     if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
         shader_type_ = ShaderType::kPhong;
     }
     if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
         shader_type_ = ShaderType::kGouraud;
     }
+    if (key == GLFW_KEY_7 && action == GLFW_PRESS) {
+        shader_type_ = ShaderType::kDeferred;
+    }
 
     // 3, 4 - switch lighting model
     if (key == GLFW_KEY_3 && action == GLFW_PRESS) {
@@ -241,6 +499,11 @@ void SimpleRenderer::key_callback(int key, int scancode, int action, int mods) {
     if (key == GLFW_KEY_T && action == GLFW_PRESS) {
         trackball_ = !trackball_;
     }
+
+    // E - toggle exploded view
+    if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+        set_exploded(!exploded_);
+    }
 }
 
 void SimpleRenderer::scroll_callback(double xoffset, double yoffset) {
@@ -0,0 +1,56 @@
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+    : stopping_(false) {
+    if (num_threads == 0) {
+        num_threads = max(1u, thread::hardware_concurrency());
+    }
+
+    threads_.reserve(num_threads);
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        threads_.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto &t : threads_) {
+        t.join();
+    }
+}
+
+void ThreadPool::enqueue(function<void()> task) {
+    {
+        lock_guard lock(mutex_);
+        tasks_.push(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void ThreadPool::worker() {
+    Trace::set_thread_name("worker");
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            // Drain the queue before stopping
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
@@ -0,0 +1,134 @@
+#include "trace.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+void write_string(ostream &out, const char *text) {
+    out << '"';
+    for (const char *c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+Trace::ThreadBuffer::~ThreadBuffer() {
+    for (Chunk *chunk = head; chunk != nullptr;) {
+        Chunk *next = chunk->next.load(memory_order_relaxed);
+        delete chunk;
+        chunk = next;
+    }
+}
+
+void Trace::start() {
+    epoch_ = Clock::now();
+    enabled_.store(true, memory_order_release);
+}
+
+void Trace::set_thread_name(const char *name) {
+    // Registers no buffer while tracing is off
+    if (!enabled()) {
+        return;
+    }
+    thread_buffer().name.store(name, memory_order_release);
+}
+
+Trace::ThreadBuffer &Trace::thread_buffer() {
+    thread_local ThreadBuffer *buffer = nullptr;
+    if (buffer == nullptr) {
+        lock_guard lock(mutex_);
+        buffer = buffers_.emplace_back(make_unique<ThreadBuffer>()).get();
+        buffer->id = (uint32_t)buffers_.size();
+    }
+    return *buffer;
+}
+
+void Trace::record(const char *name, int64_t start, int64_t end) {
+    ThreadBuffer &buffer = thread_buffer();
+
+    Chunk *chunk = buffer.tail;
+    size_t count = chunk != nullptr ? chunk->count.load(memory_order_relaxed) : Chunk::kSize;
+    if (count == Chunk::kSize) {
+        auto *next = new Chunk;
+        if (chunk != nullptr) {
+            chunk->next.store(next, memory_order_release);
+        } else {
+            // Only written under the lock, which write() takes too
+            lock_guard lock(mutex_);
+            buffer.head = next;
+        }
+        buffer.tail = chunk = next;
+        count = 0;
+    }
+
+    chunk->events[count] = {name, start, end - start};
+    chunk->count.store(count + 1, memory_order_release);
+}
+
+size_t Trace::num_events() {
+    lock_guard lock(mutex_);
+    size_t total = 0;
+    for (const auto &buffer : buffers_) {
+        for (Chunk *chunk = buffer->head; chunk != nullptr; chunk = chunk->next.load(memory_order_acquire)) {
+            total += chunk->count.load(memory_order_acquire);
+        }
+    }
+    return total;
+}
+
+bool Trace::write(const string &path) {
+    ofstream out(path);
+    if (!out.is_open()) {
+        cerr << "ERROR::TRACE::FILE_NOT_WRITABLE\nFILE: " << path << endl;
+        return false;
+    }
+
+    // Timestamps are in microseconds
+    out << fixed << setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    lock_guard lock(mutex_);
+    bool first = true;
+    auto separate = [&]() {
+        out << (first ? "\n" : ",\n");
+        first = false;
+    };
+
+    for (const auto &buffer : buffers_) {
+        if (const char *name = buffer->name.load(memory_order_acquire)) {
+            separate();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"args\":{\"name\":";
+            write_string(out, name);
+            out << "}}";
+        }
+
+        for (Chunk *chunk = buffer->head; chunk != nullptr; chunk = chunk->next.load(memory_order_acquire)) {
+            size_t count = chunk->count.load(memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                const Event &event = chunk->events[i];
+                separate();
+                out << "{\"name\":";
+                write_string(out, event.name);
+                out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                    << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << '}';
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out) {
+        cerr << "ERROR::TRACE::WRITE_FAILED\nFILE: " << path << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,119 @@
+#include "uniform_buffer.h"
+#include "gl_state.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+UniformBuffer::UniformBuffer(size_t size, GLuint binding)
+    : binding_(binding), size_(size) {
+    glGenBuffers(1, &id_);
+    glBindBuffer(GL_UNIFORM_BUFFER, id_);
+    glBufferData(GL_UNIFORM_BUFFER, size_, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding_, id_);
+}
+
+UniformBuffer::~UniformBuffer() {
+    glDeleteBuffers(1, &id_);
+}
+
+void UniformBuffer::update(const void *data) {
+    glBindBuffer(GL_UNIFORM_BUFFER, id_);
+    glBufferData(GL_UNIFORM_BUFFER, size_, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size_, data);
+    RenderStats::count_buffer_upload(size_);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+ObjectUniformBuffer::ObjectUniformBuffer(size_t block_size, GLuint binding)
+    : binding_(binding), block_size_(block_size), capacity_(0), num_blocks_(0) {
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment <= 0) {
+        alignment = 256;
+    }
+    stride_ = (block_size_ + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &id_);
+}
+
+ObjectUniformBuffer::~ObjectUniformBuffer() {
+    glDeleteBuffers(1, &id_);
+}
+
+void ObjectUniformBuffer::clear() {
+    num_blocks_ = 0;
+}
+
+size_t ObjectUniformBuffer::add(const void *block) {
+    size_t index = num_blocks_++;
+    if (data_.size() < num_blocks_ * stride_) {
+        data_.resize(num_blocks_ * stride_);
+    }
+    memcpy(data_.data() + index * stride_, block, block_size_);
+    return index;
+}
+
+void ObjectUniformBuffer::upload() {
+    if (num_blocks_ == 0) {
+        return;
+    }
+
+    size_t size = num_blocks_ * stride_;
+    glBindBuffer(GL_UNIFORM_BUFFER, id_);
+    if (size > capacity_) {
+        capacity_ = data_.size();
+    }
+    glBufferData(GL_UNIFORM_BUFFER, capacity_, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data_.data());
+    RenderStats::count_buffer_upload(size);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ObjectUniformBuffer::bind(size_t index) const {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding_, id_, index * stride_, block_size_);
+}
+
+TextureBuffer::TextureBuffer(GLenum format)
+    : capacity_(0) {
+    glGenBuffers(1, &buffer_);
+    glGenTextures(1, &texture_);
+
+    // A buffer texture needs a buffer with a data store
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    capacity_ = 16;
+
+    GlState::bind_texture(GL_TEXTURE_BUFFER, texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer_);
+}
+
+TextureBuffer::~TextureBuffer() {
+    GlState::forget_texture(texture_);
+    glDeleteTextures(1, &texture_);
+    glDeleteBuffers(1, &buffer_);
+}
+
+void TextureBuffer::update(const void *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    if (size > capacity_) {
+        capacity_ = max(size, 2 * capacity_);
+    }
+    glBufferData(GL_TEXTURE_BUFFER, capacity_, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    RenderStats::count_buffer_upload(size);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void TextureBuffer::bind(GLuint unit) const {
+    GlState::bind_texture(GL_TEXTURE_BUFFER, texture_, unit);
+}
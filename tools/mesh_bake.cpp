@@ -0,0 +1,83 @@
+// Pre-bakes binary mesh cache files so that the renderer maps them on its
+// first launch instead of parsing the models.
+//
+// Usage: mesh_bake [--mesh-cache-dir DIR] [--optimize-meshes] [--lod-levels N] [-o OUTPUT] model ...
+//
+// By default each cache file is written where the renderer looks for it:
+// next to the model, or into the directory given by --mesh-cache-dir. With
+// -o, a single model is baked to an explicit path. Pass the same
+// --optimize-meshes and --lod-levels settings as the renderer, or the cache
+// will not match.
+
+#include "mesh.h"
+#include "mesh_cache.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+static void print_usage(const char *program) {
+    cerr << "Usage: " << program << " [--mesh-cache-dir DIR] [--optimize-meshes] [--lod-levels N] [-o OUTPUT] model ..." << endl;
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> inputs;
+    string output;
+    string cache_dir;
+    MeshLoadOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        string_view arg = argv[i];
+        if (arg == "--optimize-meshes") {
+            options.optimize = true;
+        } else if (arg == "--lod-levels" && i + 1 < argc) {
+            options.lod_levels = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        } else if ((arg == "-o" || arg == "--mesh-cache-dir") && i + 1 < argc) {
+            (arg == "-o" ? output : cache_dir) = argv[++i];
+        } else if (arg.starts_with("-")) {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            inputs.emplace_back(arg);
+        }
+    }
+
+    if (inputs.empty() || (!output.empty() && inputs.size() != 1)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Always parse the sources, then write the cache explicitly
+    MeshCache::set_enabled(false);
+    MeshCache::set_directory(cache_dir);
+
+    int ret = 0;
+    for (const auto &input : inputs) {
+        auto start = chrono::steady_clock::now();
+
+        BasicMesh mesh;
+        if (!mesh.load(input.c_str(), options)) {
+            ret = 1;
+            continue;
+        }
+
+        string cache_file = output.empty() ? MeshCache::cache_path(input.c_str()) : output;
+        if (!MeshCache::write(cache_file.c_str(), input.c_str(), MeshCache::flags(options), mesh)) {
+            cerr << "Failed to write " << cache_file << endl;
+            ret = 1;
+            continue;
+        }
+
+        auto end = chrono::steady_clock::now();
+        cout << input << " -> " << cache_file << " ("
+             << mesh.num_vertices() << " vertices, " << mesh.num_triangles() << " triangles, "
+             << chrono::duration<double, milli>(end - start).count() << " ms)" << endl;
+    }
+
+    return ret;
+}
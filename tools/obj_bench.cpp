@@ -0,0 +1,121 @@
+// Compares load times of the native OBJ reader against the OpenMesh reader.
+//
+// Usage: obj_bench [file.obj ...]
+//
+// Without arguments, models/face.obj and a set of synthetic grid meshes of
+// increasing size are measured.
+
+#include "mesh.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+// Writes an n x n height field, optionally with per-vertex normals
+static string write_grid(int n, bool normals) {
+    fs::path path = fs::temp_directory_path() /
+        ("obj_bench_" + to_string(n) + (normals ? "_vn" : "") + ".obj");
+    if (fs::exists(path)) {
+        return path.string();
+    }
+
+    ofstream file(path);
+    file << setprecision(9);
+    for (int i = 0; i <= n; ++i) {
+        for (int j = 0; j <= n; ++j) {
+            float x = (float)i / n, z = (float)j / n;
+            file << "v " << x << ' ' << 0.1f * sin(20.0f * x) * cos(20.0f * z) << ' ' << z << '\n';
+        }
+    }
+    if (normals) {
+        file << "vn 0 1 0\n";
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            int a = i * (n + 1) + j + 1;
+            int b = a + n + 1;
+            if (normals) {
+                file << "f " << a << "//1 " << b << "//1 " << b + 1 << "//1 " << a + 1 << "//1\n";
+            } else {
+                file << "f " << a << ' ' << b << ' ' << b + 1 << '\n';
+                file << "f " << a << ' ' << b + 1 << ' ' << a + 1 << '\n';
+            }
+        }
+    }
+    return path.string();
+}
+
+// Returns the best of several runs in milliseconds, or a negative value on failure
+static double time_load(const string &filename, const function<bool(BasicMesh &, const char *)> &load, BasicMesh &mesh) {
+    constexpr int kRuns = 3;
+
+    double best = numeric_limits<double>::max();
+    for (int i = 0; i < kRuns; ++i) {
+        auto start = chrono::steady_clock::now();
+        if (!load(mesh, filename.c_str())) {
+            return -1.0;
+        }
+        auto end = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double, milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> files;
+    for (int i = 1; i < argc; ++i) {
+        files.emplace_back(argv[i]);
+    }
+    if (files.empty()) {
+        files.emplace_back("models/face.obj");
+        for (int n : {256, 1024, 2048}) {
+            files.push_back(write_grid(n, false));
+        }
+        files.push_back(write_grid(1024, true));
+    }
+
+    cout << left << setw(40) << "file"
+         << right << setw(12) << "triangles"
+         << setw(14) << "openmesh ms"
+         << setw(12) << "native ms"
+         << setw(10) << "speedup" << endl;
+
+    int ret = 0;
+    for (const auto &file : files) {
+        BasicMesh reference, mesh;
+        double openmesh_ms = time_load(file, [](BasicMesh &m, const char *f) { return m.load_openmesh(f); }, reference);
+        double native_ms = time_load(file, [](BasicMesh &m, const char *f) { return m.load_obj(f); }, mesh);
+
+        if (openmesh_ms < 0.0 || native_ms < 0.0) {
+            cerr << "Failed to load " << file << endl;
+            ret = 1;
+            continue;
+        }
+
+        cout << left << setw(40) << fs::path(file).filename().string()
+             << right << setw(12) << mesh.num_triangles()
+             << fixed << setprecision(1)
+             << setw(14) << openmesh_ms
+             << setw(12) << native_ms
+             << setw(9) << openmesh_ms / native_ms << 'x' << endl;
+
+        if (mesh.num_vertices() != reference.num_vertices() || mesh.num_triangles() != reference.num_triangles()) {
+            // OpenMesh drops non-manifold faces, so counts may legitimately differ
+            cerr << "  note: native " << mesh.num_vertices() << " vertices / " << mesh.num_triangles()
+                 << " triangles, OpenMesh " << reference.num_vertices() << " / " << reference.num_triangles() << endl;
+        }
+    }
+
+    return ret;
+}